@@ -0,0 +1,241 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compare ways of framing a byte stream that arrives in partial reads.
+ * The strstr() path is what socket_recv() used to do, searching all of
+ * the unframed data again after every read. The memchr() path and the
+ * framer path only look at bytes that arrived since the last read, the
+ * first with memchr() plus a check of the second delimiter byte, the
+ * second with framer_scan(). Reads are taken straight from the stream so
+ * only the framing is timed. IRC lines end in "\r\n", FreeSWITCH events
+ * in "\n\n" with a "\n" after every header.
+ */
+
+#include "bench.h"
+#include "framer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/types.h>
+
+
+#define BENCH_STREAM	(16*1024*1024)
+#define BENCH_RUNS		5
+
+#define BENCH_STRSTR	0
+#define BENCH_MEMCHR	1
+#define BENCH_FRAMER	2
+
+static const char *bench_paths[] = {"strstr rescan", "memchr", "framer_scan"};
+
+/*
+ * Fill a stream with IRC lines.
+ * Return value:
+ *   The number of lines written.
+ */
+static size_t
+bench_irc(char *s, size_t size)
+{
+	size_t n = 0, len = 0;
+	
+	while(len+512 < size)
+	{
+		len += sprintf(s+len, ":nick%zu!user@host.example.org PRIVMSG #channel :%.*s\r\n",
+					   n, (int)(rand() % 300),
+					   "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+					   "eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim "
+					   "ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut "
+					   "aliquip ex ea commodo consequat. Duis aute irure dolor in "
+					   "reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla.");
+		n++;
+	}
+	s[len] = '\0';
+	
+	return(n);
+}
+
+/*
+ * Fill a stream with FreeSWITCH events of 20 to 60 headers each.
+ * Return value:
+ *   The number of events written.
+ */
+static size_t
+bench_fs(char *s, size_t size)
+{
+	int h, headers;
+	size_t n = 0, len = 0;
+	
+	while(len+4096 < size)
+	{
+		headers = 20+rand() % 40;
+		for(h = 0; h < headers; h++)
+			len += sprintf(s+len, "Variable_header_%d: value-%d-%zu\n", h, rand(), n);
+		s[len++] = '\n';
+		n++;
+	}
+	s[len] = '\0';
+	
+	return(n);
+}
+
+/*
+ * Frame the stream with one path, as if it arrived in reads of 1 to
+ * readmax bytes. The byte after the last read is cut off with a NUL
+ * while we look, the way the old receive buffer was terminated.
+ * Return value:
+ *   The number of frames found.
+ */
+static size_t
+bench_frame(int path, char *s, size_t size, size_t readmax, const char *delim,
+			size_t delim_len)
+{
+	char *hit, c;
+	u_int seed = 1;
+	size_t frames = 0, start = 0, end = 0, scan = 0, pos;
+	
+	while(end < size)
+	{
+		/* A cheap generator, rand() would cost more than the scan. */
+		seed = seed*1103515245+12345;
+		end += 1+(seed >> 16) % readmax;
+		if(end > size)
+			end = size;
+		
+		c = s[end];
+		s[end] = '\0';
+		for(;;)
+		{
+			pos = FRAMER_NPOS;
+			switch(path)
+			{
+				case BENCH_STRSTR:
+					if((hit = strstr(s+start, delim)) != NULL)
+						pos = hit-s;
+					break;
+				
+				case BENCH_MEMCHR:
+					for(; (hit = memchr(s+scan, delim[0], end-scan)) != NULL; scan++)
+					{
+						scan = hit-s;
+						if(end-scan < 2 || hit[1] == delim[1])
+						{
+							pos = scan;
+							break;
+						}
+					}
+					break;
+				
+				case BENCH_FRAMER:
+					if((pos = framer_scan(s+scan, end-scan, delim, delim_len)) != FRAMER_NPOS)
+						pos += scan;
+					break;
+			}
+			
+			/* Nothing yet, or only the start of a delimiter. */
+			if(pos == FRAMER_NPOS || pos+delim_len > end)
+			{
+				scan = pos == FRAMER_NPOS ? end : pos;
+				break;
+			}
+			
+			frames++;
+			start = scan = pos+delim_len;
+		}
+		s[end] = c;
+	}
+	
+	return(frames);
+}
+
+/*
+ * Time every path over one stream and check they agree.
+ * Return value:
+ *   None.
+ */
+static void
+bench_run(const char *name, char *s, size_t frames, size_t readmax, const char *delim)
+{
+	int path, run;
+	size_t found, size = strlen(s);
+	double ns, t;
+	
+	printf("framer: %s, %zu frames in %zu bytes, reads of up to %zu bytes, best of %d\n",
+		   name, frames, size, readmax, BENCH_RUNS);
+	for(path = BENCH_STRSTR; path <= BENCH_FRAMER; path++)
+	{
+		for(ns = 0, run = 0; run < BENCH_RUNS; run++)
+		{
+			t = bench_now();
+			found = bench_frame(path, s, size, readmax, delim, strlen(delim));
+			t = bench_now()-t;
+			
+			if(found != frames)
+			{
+				fprintf(stderr, "%s found %zu of %zu frames.\n", bench_paths[path], found, frames);
+				exit(1);
+			}
+			
+			if(ns == 0 || t < ns)
+				ns = t;
+		}
+		
+		bench_report(name, bench_paths[path], ns, frames, "frame");
+		printf("%-10s %-18s %10.1f MB/s\n", "", "", size/ns*1e3);
+	}
+	printf("\n");
+}
+
+int
+main(void)
+{
+	char *s;
+	size_t frames;
+	
+	if((s = malloc(BENCH_STREAM+1)) == NULL)
+	{
+		perror("malloc()");
+		return(1);
+	}
+	
+	/* Full segments, then a slow peer trickling data in. */
+	srand(1);
+	frames = bench_irc(s, BENCH_STREAM);
+	bench_run("irc", s, frames, 1460, "\r\n");
+	bench_run("irc", s, frames, 32, "\r\n");
+	
+	srand(1);
+	frames = bench_fs(s, BENCH_STREAM);
+	bench_run("freeswitch", s, frames, 1460, "\n\n");
+	bench_run("freeswitch", s, frames, 32, "\n\n");
+	
+	free(s);
+	
+	return(0);
+}
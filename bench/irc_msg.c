@@ -0,0 +1,170 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compare the old irc_mesg_re path of irc_parse() with irc_msg_parse().
+ * The regex path matches the line, then copies from, command, to and
+ * mesg into four fresh strings. The tokenizer splits a copy of the line
+ * in place, since the real one would be the socket buffer it may write
+ * to. Lines the regex can't match still cost a regexec() call.
+ */
+
+#include "bench.h"
+#include "irc_msg.h"
+
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BENCH_ROUNDS	100000
+
+static const char *bench_lines[] = {
+	":nick!user@host.example.org PRIVMSG #channel :hello there, how is everyone doing today?",
+	":nick!user@host.example.org PRIVMSG voce :!lag",
+	":irc.example.org NOTICE * :*** Looking up your hostname...",
+	":irc.example.org 433 * voce :Nickname is already in use.",
+	"@time=2009-01-01T00:00:00.000Z;account=nick :nick!user@host PRIVMSG #channel :tagged",
+	":nick!user@host.example.org JOIN #channel",
+	":irc.example.org 353 voce = #channel :voce @op +voice nick other",
+	":nick!user@host.example.org MODE #channel +o voce",
+	NULL
+};
+
+static regex_t irc_mesg_re;
+
+/*
+ * Copy one regex match into a new string, as irc_parse() used to.
+ * Return value:
+ *   The new string, or NULL if we ran out of memory.
+ */
+static char *
+bench_field(const char *line, regmatch_t *m)
+{
+	char *s;
+	size_t len = m->rm_eo-m->rm_so;
+	
+	if((s = malloc(len+1)) == NULL)
+		return(NULL);
+	
+	strncpy(s, line+m->rm_so, len);
+	s[len] = '\0';
+	
+	return(s);
+}
+
+/*
+ * Split a line the old way.
+ * Return value:
+ *   Returns 1 if the line matched, otherwise 0.
+ */
+static int
+bench_regex(const char *line)
+{
+	int i, matched;
+	size_t num = irc_mesg_re.re_nsub+1;
+	char *field[4];
+	regmatch_t *preg = calloc(num, sizeof(*preg));
+	
+	matched = (regexec(&irc_mesg_re, line, num, preg, 0) == 0);
+	if(matched)
+	{
+		for(i = 0; i < 4; i++)
+			field[i] = bench_field(line, &preg[i+1]);
+		
+		for(i = 0; i < 4; i++)
+			free(field[i]);
+	}
+	
+	/* The old code leaked preg, don't let that skew the numbers. */
+	free(preg);
+	
+	return(matched);
+}
+
+/*
+ * Split a line with the tokenizer.
+ * Return value:
+ *   Returns 1 if the line parsed, otherwise 0.
+ */
+static int
+bench_tokenizer(const char *line, size_t len)
+{
+	char copy[512];
+	struct irc_msg msg;
+	
+	memcpy(copy, line, len+1);
+	
+	return(irc_msg_parse(copy, &msg) == 0);
+}
+
+int
+main(void)
+{
+	int i, round;
+	size_t lines = 0, matched, parsed, len[sizeof(bench_lines)/sizeof(*bench_lines)];
+	double ns;
+	
+	if(regcomp(&irc_mesg_re, "^:([^ ]+) ([^ ]+) ?\\*? ([^ ]+) :([^[:cntrl:]]*)$", REG_EXTENDED) != 0)
+	{
+		fprintf(stderr, "regcomp() failed.\n");
+		return(1);
+	}
+	
+	for(i = 0; bench_lines[i] != NULL; i++)
+		len[i] = strlen(bench_lines[i]);
+	lines = (size_t)i*BENCH_ROUNDS;
+	
+	printf("irc_msg: %zu lines, %d different ones\n", lines, i);
+	
+	matched = 0;
+	ns = bench_now();
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for(i = 0; bench_lines[i] != NULL; i++)
+			matched += bench_regex(bench_lines[i]);
+	}
+	ns = bench_now()-ns;
+	bench_report("irc_msg", "irc_mesg_re", ns, lines, "line");
+	printf("%-10s %-18s %10zu%% of lines split\n", "", "", matched*100/lines);
+	
+	parsed = 0;
+	ns = bench_now();
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		for(i = 0; bench_lines[i] != NULL; i++)
+			parsed += bench_tokenizer(bench_lines[i], len[i]);
+	}
+	ns = bench_now()-ns;
+	bench_report("irc_msg", "irc_msg_parse", ns, lines, "line");
+	printf("%-10s %-18s %10zu%% of lines split\n", "", "", parsed*100/lines);
+	
+	regfree(&irc_mesg_re);
+	
+	return(0);
+}
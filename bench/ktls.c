@@ -0,0 +1,289 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compare TLS output through SSL_write() against kernel TLS. The output
+ * queue of IRC lines is flushed the way socket_flush() does it: one
+ * SSL_write() per chunk when OpenSSL owns the record layer, or a single
+ * gathered writev() once the handshake has handed it to the kernel. A
+ * thread on the other end of a loopback connection reads and decrypts
+ * everything, so the time covers delivery too.
+ */
+
+#include "bench.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+
+#define BENCH_LINES		500000
+#define BENCH_BATCH		32
+#define BENCH_LINE		"PRIVMSG #channel :the quick brown fox jumps over the lazy dog, twice\r\n"
+
+static SSL_CTX *server_ctx;
+
+/*
+ * Make a throwaway key and self signed certificate for the server end.
+ * Return value:
+ *   None.
+ */
+static void
+bench_cert(SSL_CTX *ctx)
+{
+	EVP_PKEY *key = NULL;
+	EVP_PKEY_CTX *kctx;
+	X509 *cert;
+	
+	if((kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL)) == NULL ||
+	   EVP_PKEY_keygen_init(kctx) <= 0 ||
+	   EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) <= 0 ||
+	   EVP_PKEY_keygen(kctx, &key) <= 0 || (cert = X509_new()) == NULL)
+	{
+		ERR_print_errors_fp(stderr);
+		exit(1);
+	}
+	EVP_PKEY_CTX_free(kctx);
+	
+	ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+	X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+	X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+	X509_set_pubkey(cert, key);
+	X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+							   (const u_char *)"localhost", -1, -1, 0);
+	X509_set_issuer_name(cert, X509_get_subject_name(cert));
+	
+	if(X509_sign(cert, key, EVP_sha256()) == 0 || SSL_CTX_use_certificate(ctx, cert) != 1 ||
+	   SSL_CTX_use_PrivateKey(ctx, key) != 1)
+	{
+		ERR_print_errors_fp(stderr);
+		exit(1);
+	}
+	
+	X509_free(cert);
+	EVP_PKEY_free(key);
+}
+
+/*
+ * Accept one connection and read it dry.
+ * Return value:
+ *   The number of bytes received, cast to a pointer.
+ */
+static void *
+bench_server(void *arg)
+{
+	int fd, lfd = *(int *)arg;
+	char buf[16384];
+	size_t total = 0;
+	SSL *ssl;
+	
+	if((fd = accept(lfd, NULL, NULL)) == -1)
+	{
+		perror("accept()");
+		exit(1);
+	}
+	
+	ssl = SSL_new(server_ctx);
+	SSL_set_fd(ssl, fd);
+	if(SSL_accept(ssl) != 1)
+	{
+		ERR_print_errors_fp(stderr);
+		exit(1);
+	}
+	
+	for(;;)
+	{
+		int len = SSL_read(ssl, buf, sizeof(buf));
+		
+		if(len <= 0)
+			break;
+		
+		total += len;
+	}
+	
+	SSL_free(ssl);
+	close(fd);
+	
+	return((void *)total);
+}
+
+/*
+ * Send every line over a fresh TLS connection, asking for kTLS or not.
+ * Return value:
+ *   The time taken in nanoseconds, or a negative value if kTLS was asked
+ *   for and the kernel did not take over.
+ */
+static double
+bench_send(int ktls)
+{
+	int fd, lfd, i, n;
+	size_t len = strlen(BENCH_LINE);
+	double start;
+	void *total;
+	socklen_t slen;
+	struct sockaddr_in sin;
+	struct iovec iov[BENCH_BATCH];
+	pthread_t thread;
+	SSL_CTX *ctx;
+	SSL *ssl;
+	
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	slen = sizeof(sin);
+	
+	if((lfd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1 ||
+	   bind(lfd, (struct sockaddr *)&sin, slen) == -1 || listen(lfd, 1) == -1 ||
+	   getsockname(lfd, (struct sockaddr *)&sin, &slen) == -1 ||
+	   (fd = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1)
+	{
+		perror("socket()");
+		exit(1);
+	}
+	
+	pthread_create(&thread, NULL, bench_server, &lfd);
+	
+	if(connect(fd, (struct sockaddr *)&sin, slen) == -1)
+	{
+		perror("connect()");
+		exit(1);
+	}
+	
+	ctx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY);
+#ifdef SSL_OP_ENABLE_KTLS
+	if(ktls)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#endif /* SSL_OP_ENABLE_KTLS */
+	
+	ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, fd);
+	if(SSL_connect(ssl) != 1)
+	{
+		ERR_print_errors_fp(stderr);
+		exit(1);
+	}
+
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	if(ktls && !BIO_get_ktls_send(SSL_get_wbio(ssl)))
+		ktls = -1;
+#else
+	if(ktls)
+		ktls = -1;
+#endif /* SSL_OP_ENABLE_KTLS */
+	
+	for(i = 0; i < BENCH_BATCH; i++)
+	{
+		iov[i].iov_base = BENCH_LINE;
+		iov[i].iov_len = len;
+	}
+	
+	start = bench_now();
+	for(i = 0; ktls >= 0 && i < BENCH_LINES; i += BENCH_BATCH)
+	{
+		if(ktls)
+		{
+			if(writev(fd, iov, BENCH_BATCH) != (ssize_t)(len*BENCH_BATCH))
+			{
+				perror("writev()");
+				exit(1);
+			}
+			
+			continue;
+		}
+		
+		for(n = 0; n < BENCH_BATCH; n++)
+		{
+			if(SSL_write(ssl, BENCH_LINE, len) != (int)len)
+			{
+				ERR_print_errors_fp(stderr);
+				exit(1);
+			}
+		}
+	}
+	
+	/* The reader stops at the end of the stream. */
+	shutdown(fd, SHUT_WR);
+	pthread_join(thread, &total);
+	start = bench_now()-start;
+	
+	if(ktls >= 0 && (size_t)total != len*BENCH_LINES)
+	{
+		fprintf(stderr, "Received %zu of %zu bytes.\n", (size_t)total, len*BENCH_LINES);
+		exit(1);
+	}
+	
+	SSL_free(ssl);
+	SSL_CTX_free(ctx);
+	close(fd);
+	close(lfd);
+	
+	return(ktls < 0 ? -1 : start);
+}
+
+int
+main(void)
+{
+	double ns;
+	size_t bytes = strlen(BENCH_LINE)*BENCH_LINES;
+	
+	SSL_library_init();
+	SSL_load_error_strings();
+	
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	bench_cert(server_ctx);
+	
+	printf("ktls: %d lines of %zu bytes, flushed %d at a time\n",
+		   BENCH_LINES, strlen(BENCH_LINE), BENCH_BATCH);
+	
+	ns = bench_send(0);
+	bench_report("ktls", "SSL_write", ns, BENCH_LINES, "line");
+	printf("%-10s %-18s %10.1f MB/s\n", "", "", bytes/ns*1e3);
+	
+	if((ns = bench_send(1)) < 0)
+	{
+		printf("%-10s %-18s unavailable, the kernel did not take the record layer\n",
+			   "ktls", "kTLS writev");
+		return(0);
+	}
+	bench_report("ktls", "kTLS writev", ns, BENCH_LINES, "line");
+	printf("%-10s %-18s %10.1f MB/s\n", "", "", bytes/ns*1e3);
+	
+	return(0);
+}
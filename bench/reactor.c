@@ -0,0 +1,307 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compare the epoll and io_uring reactor receive paths. A few thousand
+ * mostly idle connections are held open while a small set of them gets
+ * a line every round. The epoll path waits for readiness and reads each
+ * socket itself. The io_uring path keeps a multishot receive on every
+ * connection, fed from the provided buffer ring in src/uring.c, and
+ * collects the data with one io_uring_enter() per wait.
+ */
+
+#include "bench.h"
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+
+#define BENCH_CONNS		2000
+#define BENCH_ACTIVE	64
+#define BENCH_ROUNDS	5000
+#define BENCH_RUNS		5
+#define BENCH_LINE		":nick!user@host PRIVMSG #channel :hello there\r\n"
+
+static int conns;
+static int (*pairs)[2];
+static u_long syscalls;
+
+/*
+ * Write a line to the active connections of this round, walking through
+ * all of them over the run so none stay warm.
+ * Return value:
+ *   The number of bytes the reader should expect.
+ */
+static size_t
+bench_send(int round)
+{
+	int i;
+	size_t len = strlen(BENCH_LINE);
+	
+	for(i = 0; i < BENCH_ACTIVE; i++)
+	{
+		if(write(pairs[(round*BENCH_ACTIVE+i) % conns][1], BENCH_LINE, len) != (ssize_t)len)
+		{
+			perror("write()");
+			exit(1);
+		}
+	}
+	
+	return(len*BENCH_ACTIVE);
+}
+
+/*
+ * Receive every round through epoll readiness and recv().
+ * Return value:
+ *   The time taken in nanoseconds.
+ */
+static double
+bench_epoll(void)
+{
+	int epfd, i, n, round;
+	char buf[4096];
+	double start;
+	struct epoll_event ev, events[256];
+	
+	if((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	{
+		perror("epoll_create1()");
+		exit(1);
+	}
+	
+	for(i = 0; i < conns; i++)
+	{
+		ev.events = EPOLLIN|EPOLLRDHUP;
+		ev.data.fd = pairs[i][0];
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, pairs[i][0], &ev) == -1)
+		{
+			perror("epoll_ctl()");
+			exit(1);
+		}
+	}
+	
+	syscalls = 0;
+	start = bench_now();
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		size_t want = bench_send(round);
+		
+		while(want > 0)
+		{
+			n = epoll_wait(epfd, events, 256, -1);
+			syscalls++;
+			
+			for(i = 0; i < n; i++)
+			{
+				ssize_t len = recv(events[i].data.fd, buf, sizeof(buf), 0);
+				
+				syscalls++;
+				if(len > 0)
+					want -= len;
+			}
+		}
+	}
+	
+	start = bench_now()-start;
+	close(epfd);
+	
+	return(start);
+}
+
+/*
+ * Arm a multishot receive on one connection.
+ * Return value:
+ *   None.
+ */
+static void
+bench_uring_recv(struct uring *u, int i)
+{
+	struct io_uring_sqe *sqe;
+	
+	if((sqe = uring_sqe(u)) == NULL)
+	{
+		perror("uring_sqe()");
+		exit(1);
+	}
+	
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = pairs[i][0];
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = i;
+}
+
+/*
+ * Receive every round through multishot receives on io_uring.
+ * Return value:
+ *   The time taken in nanoseconds, or a negative value if the kernel
+ *   lacks io_uring.
+ */
+static double
+bench_uring(void)
+{
+	int i, round;
+	double start;
+	struct uring u;
+	struct io_uring_cqe *cqe;
+	
+	if(uring_init(&u, URING_ENTRIES) == -1)
+		return(-1);
+	
+	for(i = 0; i < conns; i++)
+		bench_uring_recv(&u, i);
+	
+	if(uring_submit(&u) == -1)
+	{
+		perror("uring_submit()");
+		exit(1);
+	}
+	
+	syscalls = 0;
+	start = bench_now();
+	for(round = 0; round < BENCH_ROUNDS; round++)
+	{
+		size_t want = bench_send(round);
+		
+		while(want > 0)
+		{
+			if(uring_wait(&u, -1) == -1)
+			{
+				perror("uring_wait()");
+				exit(1);
+			}
+			syscalls++;
+			
+			while((cqe = uring_cqe(&u)) != NULL)
+			{
+				int res = cqe->res;
+				u_int flags = cqe->flags;
+				
+				i = cqe->user_data;
+				uring_cqe_seen(&u);
+				
+				if(flags & IORING_CQE_F_BUFFER)
+					uring_buf_release(&u, flags >> IORING_CQE_BUFFER_SHIFT);
+				
+				if(res > 0)
+					want -= res;
+				else if(res != -ENOBUFS)
+				{
+					fprintf(stderr, "recv: %s\n", strerror(-res));
+					exit(1);
+				}
+				
+				if(!(flags & IORING_CQE_F_MORE))
+					bench_uring_recv(&u, i);
+			}
+		}
+	}
+	
+	start = bench_now()-start;
+	uring_free(&u);
+	
+	return(start);
+}
+
+int
+main(void)
+{
+	int i, err = 0;
+	u_long epoll_calls = 0;
+	double ns, nu, t;
+	struct rlimit rl;
+	
+	/* Two descriptors per connection, leave room for the rest. */
+	conns = BENCH_CONNS;
+	if(getrlimit(RLIMIT_NOFILE, &rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		getrlimit(RLIMIT_NOFILE, &rl);
+		if(rl.rlim_cur != RLIM_INFINITY && (rlim_t)conns*2+32 > rl.rlim_cur)
+			conns = (rl.rlim_cur-32)/2;
+	}
+	
+	if(conns < BENCH_ACTIVE || (pairs = calloc(conns, sizeof(*pairs))) == NULL)
+	{
+		fprintf(stderr, "Not enough descriptors for the benchmark.\n");
+		return(1);
+	}
+	
+	for(i = 0; i < conns; i++)
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, pairs[i]) == -1)
+		{
+			perror("socketpair()");
+			return(1);
+		}
+	}
+	
+	printf("reactor: %d connections, %d active per round, %d rounds, best of %d\n",
+		   conns, BENCH_ACTIVE, BENCH_ROUNDS, BENCH_RUNS);
+	
+	/* Take turns so both see the same noise from the rest of the system. */
+	for(ns = 0, nu = 0, i = 0; i < BENCH_RUNS; i++)
+	{
+		t = bench_epoll();
+		if(ns == 0 || t < ns)
+			ns = t;
+		epoll_calls = syscalls;
+		
+		if((t = bench_uring()) < 0)
+		{
+			err = errno;
+			nu = -1;
+			break;
+		}
+		
+		if(nu == 0 || t < nu)
+			nu = t;
+	}
+	
+	bench_report("reactor", "epoll", ns, BENCH_ROUNDS, "round");
+	printf("%-10s %-18s %10.1f syscalls/round\n", "", "", (double)epoll_calls/BENCH_ROUNDS);
+	
+	if(nu < 0)
+	{
+		printf("%-10s %-18s unavailable (%s)\n", "reactor", "io_uring", strerror(err));
+		return(0);
+	}
+	bench_report("reactor", "io_uring", nu, BENCH_ROUNDS, "round");
+	printf("%-10s %-18s %10.1f syscalls/round\n", "", "", (double)syscalls/BENCH_ROUNDS);
+	
+	return(0);
+}
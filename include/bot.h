@@ -32,12 +32,33 @@
 /* Bot included header files. */
 #include <pthread.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+
+#include "reactor.h"
+#include "irc_sched.h"
 
 
 /* Bot constants. */
 #define E_NONE				1
 #define E_RECONN			2
 #define E_REWAIT			3
+#define E_LAGGED			4
+#define E_DROPPED			5
+#define E_FAILED			6
+
+/* Reconnect backoff and per server circuit breaker, in milliseconds. */
+#define BOT_BACKOFF_MIN		1000
+#define BOT_BACKOFF_MAX		300000
+#define BOT_BREAKER_FAILS	3
+#define BOT_BREAKER_COOLDOWN	600000
+#define BOT_REWAIT			30000
+
+/* Lag probing, in seconds unless set in the config. */
+#define BOT_PINGINTERVAL	60
+#define BOT_PINGTIMEOUT		30
+
+/* How many message IDs we remember, to drop messages we have seen. */
+#define BOT_MSGIDS			64
 
 /* Bot status bitmap. */
 #define	BOT_STATUS_NORECONN		0x01
@@ -48,6 +69,9 @@
 
 
 /* Bot structs and variables. */
+struct socket_in;
+struct upgrade_bot;
+
 struct chan_list
 {
 	char *name;
@@ -55,22 +79,56 @@ struct chan_list
 	struct chan_list *next;
 };
 
+struct server_list
+{
+	char *host;
+	char *port;
+	u_int fails;
+	uint64_t open_until;
+	struct server_list *prev;
+	struct server_list *next;
+};
+
 struct bot_in
 {
 	u_int bot_id;
-	pthread_t thread_id;
 	int bot_status;
 	int irc_ssl;
+	int irc_recv_policy;
+	size_t irc_recv_max;
 	char *irc_admins;
-	char *irc_host;
 	char *irc_name;
 	char *irc_nick;
 	char *irc_nick_temp;
 	char *irc_nspass;
 	char *irc_pass;
 	char *irc_port;
+	char *irc_sasl_mech;
+	char *irc_sasl_pass;
+	char *irc_sasl_user;
 	char *irc_user;
 	struct chan_list *irc_channels;
+	struct server_list *irc_servers;
+	struct server_list *irc_server;
+	struct sockaddr_storage irc_addr;
+	socklen_t irc_addrlen;
+	struct reactor *reactor;
+	struct reactor_timer irc_timer;
+	struct reactor_timer irc_ping_timer;
+	uint64_t irc_ping_sent;
+	uint64_t irc_last_rx;
+	int irc_lag;
+	int irc_delay;
+	uint64_t irc_msgids[BOT_MSGIDS];
+	u_int irc_msgid_next;
+	u_int irc_retries;
+	int irc_caps;
+	int irc_cap_pending;
+	int irc_authed;
+	int irc_out_class;
+	struct sched irc_out;
+	struct socket_in *irc_sock;
+	struct upgrade_bot *irc_resume;
 	struct bot_in *prev;
 	struct bot_in *next;
 };
@@ -82,8 +140,6 @@ struct
 	struct bot_in *b_last;
 } *bots;
 
-pthread_attr_t thread_attr;
-pthread_key_t m_sock_fds;
 pthread_key_t bot;
 pthread_key_t irc_s;
 pthread_mutex_t mtx_bots;
@@ -94,6 +150,7 @@ struct bot_in *bot_new_config(void);
 struct bot_in *bot_clone_config(const struct bot_in *orig);
 int bot_destory_config(struct bot_in *config);
 int bot_add_channel(struct bot_in *bot_config, const char *channel);
+int bot_add_server(struct bot_in *bot_config, const char *servers);
 int bot_remove_channel(struct bot_in *bot_config, const char *channel);
 void bot_spawn(struct bot_in *bot_config);
 
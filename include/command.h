@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _H_COMMAND
+#define _H_COMMAND
+
+/* Command included header files. */
+#include <sys/types.h>
+
+
+/* Command constants. */
+#define COMMAND_USER		0
+#define COMMAND_ADMIN		1
+
+#define COMMAND_MAXARGS		8
+#define COMMAND_LINEMAX		512
+#define COMMAND_BUCKETS		64
+
+
+/* Command structs and variables. */
+struct command_call
+{
+	const char *from;
+	const char *to;
+	const char *name;
+	const char *args;
+	u_int argc;
+	const char *argv[COMMAND_MAXARGS];
+};
+
+struct command
+{
+	char *name;
+	int level;
+	u_int min_args;
+	u_int max_args;
+	void (*handler)(const struct command_call *call);
+	const void *owner;
+	struct command *next;
+};
+
+
+/* Command functions. */
+int command_register(const void *owner, const char *name, int level,
+					 u_int min_args, u_int max_args,
+					 void (*handler)(const struct command_call *call));
+void command_unregister(const void *owner);
+int command_dispatch(const char *from, const char *to, const char *line, int admin);
+
+
+#endif /* _H_COMMAND */
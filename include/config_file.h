@@ -30,6 +30,7 @@
 #define _H_CONFIG_FILE
 
 /* Bot included header files. */
+#include <sys/types.h>
 
 
 /* Config constants. */
@@ -39,6 +40,20 @@
 
 
 /* Config structs and variables. */
+struct config_global
+{
+	u_int reactor_threads;
+	u_int connect_timeout;
+	u_int ping_interval;
+	u_int ping_timeout;
+	u_int flood_burst;
+	u_int flood_rate;
+	char *ssl_session_file;
+	char *ssl_cert_file;
+	char *ssl_key_file;
+};
+
+extern struct config_global config_global;
 
 
 /* Config functions. */
@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "bot.h"
 
 
@@ -53,7 +54,6 @@
 /* Global structs and variables. */
 pthread_t threads[MAX_THREADS];
 int vlevel;
-regex_t irc_mesg_re;
 regex_t fs_caller_name_re;
 regex_t fs_caller_num_re;
 regex_t fs_conference_re;
@@ -97,34 +97,34 @@ vout(int level, int direction, const char *endpoint, const char *str)
 /*
  * C implementation of the XPath normalize-space() function.
  * Return value:
- *   Returns a pointer to the normalized string or NULL on failure.
+ *   Returns a pointer to the normalized string, which lives in the
+ *   arena, or NULL on failure.
  */
 static inline char *
 normalize_space(const char *source)
 {
-	size_t len, offset = 0;
-	char *dest, *part, *temp;
+	size_t len;
+	char *dest, *p;
 	
 	/* Sanity checks. */
 	if(source == NULL)
 		return(NULL);
 	
-	if((temp = strdup(source)) == NULL)
-		return(NULL);
-	if((dest = calloc(strlen(source)+1, sizeof(*dest))) == NULL)
+	if((dest = p = arena_alloc(strlen(source)+1)) == NULL)
 		return(NULL);
 	
-	for(len = strlen(temp), part = strtok(temp, "\r\n\t\v ");
-		part != NULL;
-		part = strtok(NULL, "\r\n\t\v "))
+	for(source += strspn(source, "\r\n\t\v ");
+		*source != '\0';
+		source += strspn(source, "\r\n\t\v "))
 	{
-		strcpy(dest+offset, part);
-		offset += strlen(part)+1;
-		
-		if(offset < len)
-			memset(dest+offset-1, ' ', 1);
+		len = strcspn(source, "\r\n\t\v ");
+		if(p != dest)
+			*p++ = ' ';
+		memcpy(p, source, len);
+		p += len;
+		source += len;
 	}
-	free(temp);
+	*p = '\0';
 	
 	return(dest);
 }
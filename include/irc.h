@@ -35,6 +35,8 @@
 
 /* Bot constants. */
 #define IRC_DEFAULT_MODES		"+xipTB-w"
+#define IRC_DEFAULT_PORT		"6667"
+#define IRC_LAG_TOKEN			"voce-lag-"
 
 /* Command types. */
 #define IRC_ACTION				1
@@ -50,16 +52,249 @@
 #define IRC_QUIT				10
 #define IRC_RAW					11
 #define IRC_USER				12
+#define IRC_PING				13
+#define IRC_CAP					14
+#define IRC_PASS				15
+#define IRC_AUTHENTICATE		16
+
+/* Capabilities we ask for, bits of irc_caps. */
+#define IRC_CAP_MULTIPREFIX		0x01
+#define IRC_CAP_SASL			0x02
+#define IRC_CAP_SERVERTIME		0x04
+#define IRC_CAP_MESSAGETAGS		0x08
+
+/* SASL sends its payload in pieces of this size. */
+#define IRC_SASL_CHUNK			400
+
+/* What core handlers tell irc_parse(), besides an E_ status. */
+#define IRC_NEXT				0
+#define IRC_DONE				-1
+
+/* How many hooks may watch any one numeric or verb. */
+#define IRC_HOOKMAX				8
+
+/*
+ * Server replies, RFC 1459 and 2812 plus the IRCv3 SASL ones. A numeric's
+ * code is its number.
+ */
+#define IRC_NUMERICS(X) \
+	X(RPL_WELCOME, 1) \
+	X(RPL_YOURHOST, 2) \
+	X(RPL_CREATED, 3) \
+	X(RPL_MYINFO, 4) \
+	X(RPL_ISUPPORT, 5) \
+	X(RPL_TRACELINK, 200) \
+	X(RPL_TRACECONNECTING, 201) \
+	X(RPL_TRACEHANDSHAKE, 202) \
+	X(RPL_TRACEUNKNOWN, 203) \
+	X(RPL_TRACEOPERATOR, 204) \
+	X(RPL_TRACEUSER, 205) \
+	X(RPL_TRACESERVER, 206) \
+	X(RPL_TRACESERVICE, 207) \
+	X(RPL_TRACENEWTYPE, 208) \
+	X(RPL_TRACECLASS, 209) \
+	X(RPL_TRACERECONNECT, 210) \
+	X(RPL_STATSLINKINFO, 211) \
+	X(RPL_STATSCOMMANDS, 212) \
+	X(RPL_STATSCLINE, 213) \
+	X(RPL_STATSNLINE, 214) \
+	X(RPL_STATSILINE, 215) \
+	X(RPL_STATSKLINE, 216) \
+	X(RPL_STATSYLINE, 218) \
+	X(RPL_ENDOFSTATS, 219) \
+	X(RPL_UMODEIS, 221) \
+	X(RPL_SERVLIST, 234) \
+	X(RPL_SERVLISTEND, 235) \
+	X(RPL_STATSLLINE, 241) \
+	X(RPL_STATSUPTIME, 242) \
+	X(RPL_STATSOLINE, 243) \
+	X(RPL_STATSHLINE, 244) \
+	X(RPL_LUSERCLIENT, 251) \
+	X(RPL_LUSEROP, 252) \
+	X(RPL_LUSERUNKNOWN, 253) \
+	X(RPL_LUSERCHANNELS, 254) \
+	X(RPL_LUSERME, 255) \
+	X(RPL_ADMINME, 256) \
+	X(RPL_ADMINLOC1, 257) \
+	X(RPL_ADMINLOC2, 258) \
+	X(RPL_ADMINEMAIL, 259) \
+	X(RPL_TRACELOG, 261) \
+	X(RPL_TRACEEND, 262) \
+	X(RPL_TRYAGAIN, 263) \
+	X(RPL_NONE, 300) \
+	X(RPL_AWAY, 301) \
+	X(RPL_USERHOST, 302) \
+	X(RPL_ISON, 303) \
+	X(RPL_UNAWAY, 305) \
+	X(RPL_NOWAWAY, 306) \
+	X(RPL_WHOISUSER, 311) \
+	X(RPL_WHOISSERVER, 312) \
+	X(RPL_WHOISOPERATOR, 313) \
+	X(RPL_WHOWASUSER, 314) \
+	X(RPL_ENDOFWHO, 315) \
+	X(RPL_WHOISIDLE, 317) \
+	X(RPL_ENDOFWHOIS, 318) \
+	X(RPL_WHOISCHANNELS, 319) \
+	X(RPL_LISTSTART, 321) \
+	X(RPL_LIST, 322) \
+	X(RPL_LISTEND, 323) \
+	X(RPL_CHANNELMODEIS, 324) \
+	X(RPL_UNIQOPIS, 325) \
+	X(RPL_NOTOPIC, 331) \
+	X(RPL_TOPIC, 332) \
+	X(RPL_INVITING, 341) \
+	X(RPL_SUMMONING, 342) \
+	X(RPL_INVITELIST, 346) \
+	X(RPL_ENDOFINVITELIST, 347) \
+	X(RPL_EXCEPTLIST, 348) \
+	X(RPL_ENDOFEXCEPTLIST, 349) \
+	X(RPL_VERSION, 351) \
+	X(RPL_WHOREPLY, 352) \
+	X(RPL_NAMREPLY, 353) \
+	X(RPL_LINKS, 364) \
+	X(RPL_ENDOFLINKS, 365) \
+	X(RPL_ENDOFNAMES, 366) \
+	X(RPL_BANLIST, 367) \
+	X(RPL_ENDOFBANLIST, 368) \
+	X(RPL_ENDOFWHOWAS, 369) \
+	X(RPL_INFO, 371) \
+	X(RPL_MOTD, 372) \
+	X(RPL_ENDOFINFO, 374) \
+	X(RPL_MOTDSTART, 375) \
+	X(RPL_ENDOFMOTD, 376) \
+	X(RPL_YOUREOPER, 381) \
+	X(RPL_REHASHING, 382) \
+	X(RPL_YOURESERVICE, 383) \
+	X(RPL_TIME, 391) \
+	X(RPL_USERSSTART, 392) \
+	X(RPL_USERS, 393) \
+	X(RPL_ENDOFUSERS, 394) \
+	X(RPL_NOUSERS, 395) \
+	X(ERR_NOSUCHNICK, 401) \
+	X(ERR_NOSUCHSERVER, 402) \
+	X(ERR_NOSUCHCHANNEL, 403) \
+	X(ERR_CANNOTSENDTOCHAN, 404) \
+	X(ERR_TOOMANYCHANNELS, 405) \
+	X(ERR_WASNOSUCHNICK, 406) \
+	X(ERR_TOOMANYTARGETS, 407) \
+	X(ERR_NOSUCHSERVICE, 408) \
+	X(ERR_NOORIGIN, 409) \
+	X(ERR_NORECIPIENT, 411) \
+	X(ERR_NOTEXTTOSEND, 412) \
+	X(ERR_NOTOPLEVEL, 413) \
+	X(ERR_WILDTOPLEVEL, 414) \
+	X(ERR_BADMASK, 415) \
+	X(ERR_UNKNOWNCOMMAND, 421) \
+	X(ERR_NOMOTD, 422) \
+	X(ERR_NOADMININFO, 423) \
+	X(ERR_FILEERROR, 424) \
+	X(ERR_NONICKNAMEGIVEN, 431) \
+	X(ERR_ERRONEUSNICKNAME, 432) \
+	X(ERR_NICKNAMEINUSE, 433) \
+	X(ERR_NICKCOLLISION, 436) \
+	X(ERR_UNAVAILRESOURCE, 437) \
+	X(ERR_USERNOTINCHANNEL, 441) \
+	X(ERR_NOTONCHANNEL, 442) \
+	X(ERR_USERONCHANNEL, 443) \
+	X(ERR_NOLOGIN, 444) \
+	X(ERR_SUMMONDISABLED, 445) \
+	X(ERR_USERSDISABLED, 446) \
+	X(ERR_NOTREGISTERED, 451) \
+	X(ERR_NEEDMOREPARAMS, 461) \
+	X(ERR_ALREADYREGISTRED, 462) \
+	X(ERR_NOPERMFORHOST, 463) \
+	X(ERR_PASSWDMISMATCH, 464) \
+	X(ERR_YOUREBANNEDCREEP, 465) \
+	X(ERR_YOUWILLBEBANNED, 466) \
+	X(ERR_KEYSET, 467) \
+	X(ERR_CHANNELISFULL, 471) \
+	X(ERR_UNKNOWNMODE, 472) \
+	X(ERR_INVITEONLYCHAN, 473) \
+	X(ERR_BANNEDFROMCHAN, 474) \
+	X(ERR_BADCHANNELKEY, 475) \
+	X(ERR_BADCHANMASK, 476) \
+	X(ERR_NOCHANMODES, 477) \
+	X(ERR_BANLISTFULL, 478) \
+	X(ERR_NOPRIVILEGES, 481) \
+	X(ERR_CHANOPRIVSNEEDED, 482) \
+	X(ERR_CANTKILLSERVER, 483) \
+	X(ERR_RESTRICTED, 484) \
+	X(ERR_UNIQOPPRIVSNEEDED, 485) \
+	X(ERR_NOOPERHOST, 491) \
+	X(ERR_UMODEUNKNOWNFLAG, 501) \
+	X(ERR_USERSDONTMATCH, 502) \
+	X(RPL_LOGGEDIN, 900) \
+	X(RPL_LOGGEDOUT, 901) \
+	X(ERR_NICKLOCKED, 902) \
+	X(RPL_SASLSUCCESS, 903) \
+	X(ERR_SASLFAIL, 904) \
+	X(ERR_SASLTOOLONG, 905) \
+	X(ERR_SASLABORTED, 906) \
+	X(ERR_SASLALREADY, 907) \
+	X(RPL_SASLMECHS, 908)
+
+/* Commands from the server by name, in any order. */
+#define IRC_VERBS(X) \
+	X(ACCOUNT) \
+	X(AUTHENTICATE) \
+	X(AWAY) \
+	X(BATCH) \
+	X(CAP) \
+	X(CHGHOST) \
+	X(ERROR) \
+	X(INVITE) \
+	X(JOIN) \
+	X(KICK) \
+	X(KILL) \
+	X(MODE) \
+	X(NICK) \
+	X(NOTICE) \
+	X(PART) \
+	X(PING) \
+	X(PONG) \
+	X(PRIVMSG) \
+	X(QUIT) \
+	X(SETNAME) \
+	X(TAGMSG) \
+	X(TOPIC) \
+	X(WALLOPS)
 
 
 /* Bot structs and variables. */
+struct irc_msg;
+
+/* Numerics and verbs parsed to one code, for table lookups. */
+enum irc_code
+{
+#define IRC_NUMERIC_CODE(name, num) IRC_##name = num,
+	IRC_NUMERICS(IRC_NUMERIC_CODE)
+#undef IRC_NUMERIC_CODE
+	IRC_VERB_BASE = 1000,
+#define IRC_VERB_CODE(name) IRC_VERB_##name,
+	IRC_VERBS(IRC_VERB_CODE)
+#undef IRC_VERB_CODE
+	IRC_UNKNOWN,
+	IRC_CODES
+};
+
+struct irc_hook_in
+{
+	int (*handler)(const struct irc_msg *msg);
+	const void *owner;
+	struct irc_hook_in *next;
+};
 
 
 /* Bot functions. */
-int irc_connect(struct socket_in **s, const char *host, const char *port, int ssl);
-int irc_parse(const char *buf);
+int irc_init(void);
+int irc_connect(struct bot_in *bot_t, void (*callback)(struct socket_in *, int, void *));
+int irc_register(void);
+int irc_parse(char *buf);
 int irc_cmd(int type, const char *arg1, const char *arg2);
 int irc_is_admin(const char *ident);
+int irc_code(const char *command);
+int irc_hook(const void *owner, int code, int (*handler)(const struct irc_msg *msg));
+void irc_unhook(const void *owner);
 
 
 #endif /* _H_IRC */
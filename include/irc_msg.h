@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _H_IRC_MSG
+#define _H_IRC_MSG
+
+/* IRC message included header files. */
+#include <sys/types.h>
+
+
+/* IRC message constants. */
+#define IRC_MSG_MAXPARAMS		15
+#define IRC_MSG_MAXTAGS			16
+
+
+/* IRC message structs and variables. */
+struct irc_slice
+{
+	const char *s_data;
+	size_t s_len;
+};
+
+struct irc_tag
+{
+	struct irc_slice key;
+	struct irc_slice value;
+};
+
+struct irc_msg
+{
+	struct irc_slice tags;
+	struct irc_tag tagv[IRC_MSG_MAXTAGS];
+	u_int ntags;
+	struct irc_slice prefix;
+	struct irc_slice nick;
+	struct irc_slice user;
+	struct irc_slice host;
+	struct irc_slice command;
+	int code;						/* Set by irc_parse(), see irc_code(). */
+	struct irc_slice params[IRC_MSG_MAXPARAMS];
+	u_int nparams;
+};
+
+
+/* IRC message functions. */
+int irc_msg_parse(char *line, struct irc_msg *msg);
+const struct irc_tag *irc_msg_tag(const struct irc_msg *msg, const char *key);
+ssize_t irc_msg_tag_value(const struct irc_tag *tag, char *buf, size_t size);
+
+
+#endif /* _H_IRC_MSG */
@@ -0,0 +1,101 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _H_IRC_SCHED
+#define _H_IRC_SCHED
+
+/* Sched included header files. */
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "reactor.h"
+
+
+/* Sched constants. */
+#define SCHED_URGENT		0
+#define SCHED_ADMIN			1
+#define SCHED_BULK			2
+#define SCHED_CLASSES		3
+
+/* Commands whose targets can be merged. */
+#define SCHED_JOIN			0
+#define SCHED_PART			1
+#define SCHED_PRIVMSG		2
+#define SCHED_NOTICE		3
+#define SCHED_MERGEABLE		4
+
+/* Longest line the server takes, without the CRLF. */
+#define SCHED_LINEMAX		510
+
+/* RFC 1459 flood control: a line every two seconds, five in a burst. */
+#define SCHED_BURST			5
+#define SCHED_RATE			2000
+
+
+/* Sched structs and variables. */
+struct socket_in;
+
+struct sched_line
+{
+	struct sched_line *next;
+	char data[];
+};
+
+struct sched_target
+{
+	char *name;
+	struct sched_line *first;
+	struct sched_line *last;
+	struct sched_target *next;
+};
+
+struct sched
+{
+	int64_t tokens;
+	uint64_t stamp;
+	u_int burst;
+	u_int rate;
+	u_int queued;
+	u_int targmax[SCHED_MERGEABLE];
+	struct sched_target *ring[SCHED_CLASSES];
+	struct socket_in *sock;
+	struct reactor *reactor;
+	struct reactor_timer timer;
+};
+
+
+/* Sched functions. */
+void sched_init(struct sched *q, struct reactor *r, struct socket_in *s,
+				u_int burst, u_int rate);
+int sched_push(struct sched *q, int class, const char *target, const char *line);
+int sched_targmax(struct sched *q, const char *cmd, u_int max);
+void sched_refill(struct sched *q);
+void sched_clear(struct sched *q);
+
+
+#endif /* _H_IRC_SCHED */
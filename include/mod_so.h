@@ -30,6 +30,7 @@
 #define _H_MOD_SO
 
 /* Module included header files. */
+#include <sys/types.h>
 
 
 /* Module constants. */
@@ -46,6 +47,8 @@ struct mod_object
 	char *filename;
 	int (*irc_callback)(const char *from, const char *to,
 						const char *command, const char *mesg);
+	u_int refs;
+	int unloading;
 	struct mod_object *prev;
 	struct mod_object *next;
 };
@@ -56,6 +59,8 @@ struct mod_object
 void mod_init(void);
 int mod_load(char *mod);
 int mod_unload(const char *mod);
+void mod_hold(const void *owner);
+void mod_release(const void *owner);
 int mod_irc_callback(const char *from, const char *to,
 					 const char *command, const char *mesg);
 int mod_register_irc(struct mod_object *mh,
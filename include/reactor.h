@@ -0,0 +1,142 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _H_REACTOR
+#define _H_REACTOR
+
+/* Reactor included header files. */
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+
+/* Reactor constants. */
+#define REACTOR_DEFAULT_THREADS		2
+#define REACTOR_MAX_THREADS			64
+#define REACTOR_MAX_EVENTS			64
+
+/* Reactor event bitmap. */
+#define REACTOR_READ				0x01
+#define REACTOR_WRITE				0x02
+#define REACTOR_ERROR				0x04
+#define REACTOR_FLUSH				0x08
+#define REACTOR_RECV				0x10
+#define REACTOR_SENT				0x20
+
+
+/* Reactor structs and variables. */
+struct reactor;
+struct uring;
+
+struct reactor_handler
+{
+	int fd;
+	int events;
+	int removed;
+	int deferred;
+	int polling;
+	int recving;
+	int starved;
+	u_int pending;
+	int cancel;						/* Cancel still owed to the kernel. */
+	ssize_t result;
+	char *rx_data;
+	u_int rx_bid;
+	void *arg;
+	void (*callback)(struct reactor_handler *h, int events);
+	void (*reap)(void *arg);		/* Frees arg along with the handler. */
+	struct reactor *reactor;
+	struct reactor_handler *d_next;
+	struct reactor_handler *s_next;
+	struct reactor_handler *next;
+};
+
+struct reactor_timer
+{
+	int armed;
+	uint64_t deadline;
+	void *arg;
+	void (*callback)(void *arg);
+	struct reactor *reactor;
+	struct reactor_timer *prev;
+	struct reactor_timer *next;
+};
+
+struct reactor_task
+{
+	void *arg;
+	void (*callback)(void *arg);
+	struct reactor_task *next;
+};
+
+struct reactor
+{
+	u_int r_id;
+	u_int r_load;
+	pthread_t thread_id;
+	int epfd;
+	int wakefd;
+	pthread_mutex_t mtx_tasks;
+	struct reactor_task *t_first;
+	struct reactor_task *t_last;
+	struct reactor_timer *timers;
+	struct reactor_handler *deferred;
+	struct reactor_handler *starved;
+	struct reactor_handler *dead;
+	struct uring *uring;
+	int refilled;
+};
+
+pthread_key_t m_reactor;
+
+
+/* Reactor functions. */
+int reactor_init(u_int threads);
+struct reactor *reactor_pick(void);
+void reactor_release(struct reactor *r);
+int reactor_call(struct reactor *r, void (*callback)(void *), void *arg);
+int reactor_pause(void);
+void reactor_resume(void);
+struct reactor_handler *reactor_add(struct reactor *r, int fd, int events,
+									void (*callback)(struct reactor_handler *, int),
+									void *arg);
+int reactor_modify(struct reactor_handler *h, int events);
+int reactor_remove(struct reactor_handler *h);
+int reactor_remove_free(struct reactor_handler *h, void (*reap)(void *));
+void reactor_defer(struct reactor_handler *h);
+int reactor_recv(struct reactor_handler *h);
+void reactor_recv_done(struct reactor_handler *h, u_int bid);
+int reactor_send(struct reactor_handler *h, const struct iovec *iov, int iovcnt);
+void reactor_timer_set(struct reactor *r, struct reactor_timer *t, u_int ms,
+					   void (*callback)(void *), void *arg);
+void reactor_timer_cancel(struct reactor_timer *t);
+uint64_t reactor_time(void);
+
+
+#endif /* _H_REACTOR */
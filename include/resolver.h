@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _H_RESOLVER
+#define _H_RESOLVER
+
+/* Resolver included header files. */
+#include <netdb.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "reactor.h"
+
+
+/* Resolver constants. */
+#define RESOLVER_THREADS			2
+#define RESOLVER_TTL				300
+#define RESOLVER_MINTTL				5
+#define RESOLVER_MAXTTL				86400
+#define RESOLVER_NEGTTL				10
+
+
+/* Resolver structs and variables. */
+struct resolver_entry;
+
+struct resolver_waiter
+{
+	struct reactor *reactor;
+	struct resolver_entry *entry;
+	void *arg;
+	void (*callback)(struct resolver_entry *e, void *arg);
+	struct resolver_waiter *next;
+};
+
+struct resolver_entry
+{
+	char *host;
+	char *port;
+	int status;
+	int pending;
+	u_int refs;
+	uint64_t expires;
+	struct addrinfo *ai;
+	struct resolver_waiter *waiters;
+	struct resolver_entry *q_next;
+	struct resolver_entry *next;
+};
+
+
+/* Resolver functions. */
+int resolver_init(u_int threads);
+void resolver_stop(void);
+int resolver_lookup(struct reactor *r, const char *host, const char *port,
+					void (*callback)(struct resolver_entry *, void *), void *arg);
+void resolver_release(struct resolver_entry *e);
+
+
+#endif /* _H_RESOLVER */
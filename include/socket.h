@@ -37,18 +37,39 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "reactor.h"
+#include "resolver.h"
+
 /* OpenSSL included header files. */
 #ifdef WITH_SSL
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 #include <openssl/rand.h>
 #endif /* WITH_SSL */
 
 /* Socket constants. */
-#define SOCKET_WBUFSIZE		4096
+#define SOCKET_RBUFSIZE		4096
+#define SOCKET_RBUFMAX		65536
+#define SOCKET_RBUFLIMIT	16777216
+#define SOCKET_RBUFIDLE		64
+#define SOCKET_NPOS			((size_t)-1)
+#define SOCKET_CHUNKSIZE	4096
+#define SOCKET_IOVMAX		16
+#define SOCKET_ADDRMAX		16
+#define SOCKET_ATTEMPTDELAY	250
+#define SOCKET_CONNTIMEOUT	10000
+#define SOCKET_UNIXPREFIX	"unix:"
+#define SSL_SESSION_KEYMAX	1024
+#define SSL_SESSION_SAVEDELAY	30
 #define E_BUFTOOSMALL		0x01
 
+/* What to do with a line that doesn't fit in the receive ring. */
+#define SOCKET_LINE_DROP		0
+#define SOCKET_LINE_TRUNCATE	1
+#define SOCKET_LINE_CLOSE		2
+
 #ifdef WITH_SSL
 #if (OPENSSL_VERSION_NUMBER < 0x0090600fL)
 #warning Must use OpenSSL 0.9.6 or later... disabling OpenSSL support.
@@ -58,36 +79,137 @@
 #endif /* WITH_SSL */
 
 /* Socket structs and variables. */
-struct socket_line
+struct socket_view
 {
-	char *l_data;
-	struct socket_line *l_next;
+	char *v_data;
+	size_t v_len;
+	size_t v_end;
 };
 struct socket_buf
 {
-	char *w_start;
-	char *w_next;
-	struct socket_line *l_first;
-	struct socket_line *l_last;
+	char *r_data;
+	char *r_line;
+	size_t r_size;
+	size_t r_max;
+	size_t r_head;
+	size_t r_peek;
+	size_t r_tail;
+	size_t r_scan;
+	size_t r_linesize;
+	size_t r_peak;
+	u_int r_quiet;
+	u_int r_views;
+	int r_discard;
+	int r_full;
+	int r_policy;
+	u_long r_dropped;
+	u_long r_truncated;
+};
+struct socket_chunk
+{
+	size_t c_start;
+	size_t c_end;
+	struct socket_chunk *c_next;
+	char c_data[SOCKET_CHUNKSIZE];
+};
+struct socket_rx
+{
+	char *x_data;
+	size_t x_len;
+	size_t x_off;
+	u_int x_bid;
+	struct socket_rx *x_next;
 };
 struct socket_in
 {
 	int fd;
-	struct addrinfo *servinfo;
+	int error;
+	int w_busy;
+	int rd_want;
+	int wr_want;
+	int handshaking;
+	int ktls;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
 	struct socket_buf *buffer;
+	struct socket_chunk *w_first;
+	struct socket_chunk *w_last;
+	struct socket_chunk *w_free;
+	struct iovec w_iov[SOCKET_IOVMAX];
+	struct socket_rx *rx_first;
+	struct socket_rx *rx_last;
+	struct socket_rx *rx_free;
+	struct reactor_handler *handler;
+	void *arg;
+	void (*callback)(struct socket_in *s, int events, void *arg);
+	struct reactor_timer hs_timer;
+	void *hs_arg;
+	void (*hs_callback)(struct socket_in *s, int status, void *arg);
+	char *rb_buf;
+	size_t rb_len;
+	size_t rb_got;
+	void *rb_arg;
+	void (*rb_callback)(struct socket_in *s, int status, void *arg);
 #ifdef OPENSSL_ENABLED
 	SSL *ssl;
 #endif /* OPENSSL_ENABLED */
 };
+struct socket_conn;
+struct socket_attempt
+{
+	int fd;
+	int fastopen;
+	struct socket_in *sock;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	struct reactor_handler *handler;
+	struct reactor_timer timer;
+	struct socket_conn *conn;
+	struct socket_attempt *next;
+};
+struct socket_conn
+{
+	int ssl;
+	int done;
+	int resolved;
+	int last_tried;
+	u_int timeout;
+	u_int a_count;
+	u_int a_next;
+	char *host;
+	char *port;
+	struct sockaddr_storage last;
+	socklen_t lastlen;
+	struct reactor *reactor;
+	struct resolver_entry *dns;
+	const struct addrinfo *addrs[SOCKET_ADDRMAX];
+	struct reactor_timer timer;
+	struct socket_attempt *attempts;
+	void *arg;
+	void (*callback)(struct socket_in *s, int status, void *arg);
+};
 
 
 /* Socket functions. */
 int socket_create(struct socket_in **s, const char *addr, const char *port, int ssl);
+int socket_connect(struct reactor *r, const char *addr, const char *port, int ssl,
+				   u_int timeout, const struct sockaddr *last, socklen_t lastlen,
+				   void (*callback)(struct socket_in *, int, void *), void *arg);
+int socket_attach(struct socket_in *s, struct reactor *r,
+				  void (*callback)(struct socket_in *, int, void *), void *arg);
 size_t socket_send(struct socket_in *s, const char *buf);
-ssize_t socket_recv(struct socket_in *s, const char *delim);
-size_t socket_recv_bytes(struct socket_in *s, char *buf, size_t max_bytes);
-size_t socket_chunk(struct socket_in *s, const char *delim);
-char *socket_next_chunk(struct socket_in *s);
+int socket_flush(struct socket_in *s);
+ssize_t socket_recv(struct socket_in *s);
+ssize_t socket_recv_bytes(struct socket_in *s, char *buf, size_t len);
+int socket_read_bytes(struct socket_in *s, char *buf, size_t len,
+					  void (*callback)(struct socket_in *, int, void *), void *arg);
+int socket_next_line(struct socket_in *s, const char *delim, struct socket_view *v);
+void socket_release(struct socket_in *s, const struct socket_view *v);
+size_t socket_take(struct socket_in *s, char *buf, size_t len);
+ssize_t socket_unread(struct socket_in *s, char **data);
+ssize_t socket_unsent(struct socket_in *s, char **data);
+int socket_adopt(struct socket_in **s, int fd, const char *data, size_t len);
+int socket_limits(struct socket_in *s, size_t max, int policy);
 int socket_close(struct socket_in *s);
 
 
@@ -95,7 +217,8 @@ int socket_close(struct socket_in *s);
 #ifdef OPENSSL_ENABLED
 
 /* OpenSSL functions. */
-int ssl_init(void);
+int ssl_init(const char *session_file, const char *cert_file, const char *key_file);
+int ssl_session_save(void);
 void ssl_locking_callback(int mode, int n, const char *file, int line);
 unsigned long ssl_threadid_callback(void);
 
@@ -104,10 +227,10 @@ unsigned long ssl_threadid_callback(void);
 
 
 void berr_exit(char *string);
-int ssl_start(struct socket_in *s);
-size_t ssl_send(struct socket_in *s, const char *buf);
-ssize_t ssl_recv(struct socket_in *s, const char *delim);
-size_t ssl_recv_bytes(struct socket_in *s, char *buf, size_t max_bytes);
+int ssl_start(struct socket_in *s, const char *host, const char *port);
+int ssl_handshake(struct socket_in *s);
+ssize_t ssl_write(struct socket_in *s, const char *buf, size_t len);
+ssize_t ssl_read(struct socket_in *s, char *buf, size_t len);
 
 #endif /* _SSL_STACK */
 #endif /* OPENSSL_ENABLED */
@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _H_URING
+#define _H_URING
+
+#ifdef WITH_URING
+
+/* Uring included header files. */
+#include <stdint.h>
+#include <sys/types.h>
+#include <linux/io_uring.h>
+
+
+/* Uring constants. */
+#define URING_ENTRIES				256
+#define URING_BUFS					128
+#define URING_BUFSIZE				4096
+#define URING_BGID					0
+
+
+/* Uring structs and variables. */
+struct uring
+{
+	int fd;
+	u_int sq_mask;
+	u_int sq_entries;
+	u_int sq_pending;
+	u_int *sq_head;
+	u_int *sq_tail;
+	u_int *sq_array;
+	u_int cq_mask;
+	u_int *cq_head;
+	u_int *cq_tail;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+	struct io_uring_buf_ring *br;
+	u_short br_tail;
+	char *bufs;
+};
+
+
+/* Uring functions. */
+int uring_init(struct uring *u, u_int entries);
+void uring_free(struct uring *u);
+struct io_uring_sqe *uring_sqe(struct uring *u);
+int uring_submit(struct uring *u);
+int uring_wait(struct uring *u, int timeout);
+struct io_uring_cqe *uring_cqe(struct uring *u);
+void uring_cqe_seen(struct uring *u);
+char *uring_buf(struct uring *u, u_int bid);
+void uring_buf_release(struct uring *u, u_int bid);
+
+#endif /* WITH_URING */
+
+#endif /* _H_URING */
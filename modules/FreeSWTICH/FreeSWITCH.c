@@ -28,6 +28,7 @@
 
 #include "FreeSWITCH.h"
 
+#include <errno.h>
 #include <stdlib.h>
 
 
@@ -54,6 +55,25 @@ int fs_connect(struct socket_in **s, char *host, char *port)
 	return 0;
 }
 
+/*
+ * A body announced by Content-Length has arrived, parse it along with
+ * its headers and go back to reading events.
+ */
+static void fs_body(struct socket_in *fs_t, int status, void *arg)
+{
+	char *temp = arg;
+	
+	if(status == 0 && fs_parse(temp) != -1)
+	{
+		free(temp);
+		fs_recv();
+		return;
+	}
+	
+	free(temp);
+	socket_close(fs_t);
+}
+
 /*
  * Parse events and execute the appropriate functions.
  */
@@ -157,8 +177,10 @@ int fs_parse(char *buf)
 		 * XXX After we get the configuration stuff done, this should be changed
 		 * to use the value in the bot's configuration file.
 		 */
-		sprintf(buf, "auth %s\n\nevent plain CUSTOM conference::maintenance\n\n", bot_t->fs_pass);
-		socket_send(fs_t, buf);
+		char auth[512];
+		
+		snprintf(auth, sizeof(auth), "auth %s\n\nevent plain CUSTOM conference::maintenance\n\n", bot_t->fs_pass);
+		socket_send(fs_t, auth);
 		return 0;
 	}
 	
@@ -215,67 +237,84 @@ int fs_api_call(int type, char *arg1, char *arg2)
  * Return value:
  *   Returns 0 on success, or -1 on fatal socket error.
  */
-int fs_recv(char **buf)
+int fs_recv(void)
 {
-	char *temp;
-	fd_set *m_sock_fds_t = pthread_getspecific(m_sock_fds);
+	struct socket_view event;
 	struct socket_in *fs_t = pthread_getspecific(fs_s);
 	
-	if(socket_recv(fs_t, *buf, "\n\n") == -1)
-	{
-		switch(errno)
-		{
-			case EBADF:
-			case ECONNRESET:
-			case ENOTCONN:
-			case ENOTSOCK:
-			case EFAULT:
-				return -1;
-		}
-	}
-	
 	do
 	{
-		size_t buf_len, content_len = 0;
-		char *cbuf;
-		
-		/*
-		 * Default copy address of buf to temp. If we find content-length
-		 * then we'll free it and overwrite.
-		 */
-		temp = *buf;
+		if(socket_recv(fs_t) == -1)
+			return -1;
 		
-		/* If there is a content-len header, get the full message. */
-		if((cbuf = strstr(temp, "Content-Length: ")) != NULL)
+		/* Events are parsed right out of the socket's receive buffer. */
+		while(socket_next_line(fs_t, "\n\n", &event) == 0)
 		{
-			struct socket_buf *b = &fs_t->buffer;
+			int ret;
+			size_t content_len;
+			char *cbuf, *temp;
 			
-			content_len = atoi(cbuf+16);
-			buf_len = strlen(*buf)+2;
+			/* Without a content-len header the event is all there is. */
+			if((cbuf = strstr(event.v_data, "Content-Length: ")) == NULL)
+			{
+				ret = fs_parse(event.v_data);
+				socket_release(fs_t, &event);
+				
+				if(ret == -1)
+				{
+					/* The socket had a fatal error so we close it down. */
+					socket_close(fs_t);
+					return -1;
+				}
+				continue;
+			}
 			
-			/* Create some memory and get the rest of the buffer. */
-			temp = calloc(buf_len+content_len+b->offset+1, sizeof(*temp));
-			memcpy(temp, *buf, buf_len-2);
-			memset(temp+buf_len-2, '\n', 2);
-			memcpy(temp+buf_len, b->buf, b->offset);
+			/* The length comes from the peer, don't trust it. */
+			{
+				char *end;
+				u_long len;
+				
+				errno = 0;
+				len = strtoul(cbuf+16, &end, 10);
+				if(errno != 0 || end == cbuf+16 || cbuf[16] == '-' || len > FS_BODY_MAX)
+				{
+					fprintf(stderr, "[ERROR] fs_recv(): Bad Content-Length from FreeSWITCH.\n");
+					socket_release(fs_t, &event);
+					socket_close(fs_t);
+					return -1;
+				}
+				content_len = len;
+			}
 			
-			socket_recv_bytes(fs_t, temp+buf_len+b->offset, content_len);
+			/* Create some memory for the headers and the full body. */
+			if((temp = calloc(event.v_len+2+content_len+1, sizeof(*temp))) == NULL)
+			{
+				perror("[ERROR] fs_recv(): calloc()");
+				socket_release(fs_t, &event);
+				socket_close(fs_t);
+				return -1;
+			}
+			memcpy(temp, event.v_data, event.v_len);
+			memset(temp+event.v_len, '\n', 2);
+			socket_release(fs_t, &event);
 			
-			/* Zero out our buffer. */
-			memset(b, 0, sizeof(*b));
-		}
-		
-		if(fs_parse(temp) == -1)
-		{
-			/* The socket had a fatal error so we close it down. */
-			FD_CLR(fs_t->fd, m_sock_fds_t);
-			socket_close(fs_t);
-			return -1;
-		}
-		if(content_len > 0)
+			/* Big bodies are read by the reactor as they come in. */
+			ret = socket_read_bytes(fs_t, temp+event.v_len+2, content_len, fs_body, temp);
+			if(ret == 1)
+				return 0;
+			
+			if(ret == 0)
+				ret = fs_parse(temp);
 			free(temp);
+			
+			if(ret == -1)
+			{
+				socket_close(fs_t);
+				return -1;
+			}
+		}
 	}
-	while(socket_next_chunk(fs_t, *buf, "\n\n") != 0);
+	while(fs_t->buffer->r_full);
 	
 	return 0;
 }
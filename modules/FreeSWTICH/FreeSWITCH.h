@@ -39,6 +39,8 @@
 #define FS_KICK			FS_DROP
 #define FS_RAW			3
 
+#define FS_BODY_MAX		(1024*1024)
+
 
 /* FreeSWITCH structs and variables. */
 
@@ -47,7 +49,7 @@
 int fs_connect(struct socket_in **s, char *host, char *port);
 int fs_parse(char *buf);
 int fs_api_call(int type, char *arg1, char *arg2);
-int fs_recv(char **buf);
+int fs_recv(void);
 
 
 #endif /* _H_FREESWITCH */
\ No newline at end of file
@@ -33,6 +33,7 @@
  * Include required files....
  */
 #include "../include/config.h"
+#include <stddef.h>
 
 /*
  * The constants needed.
@@ -56,6 +57,15 @@
 #define IRC_RAW					11
 #define IRC_USER				12
 
+/* Commands */
+#define COMMAND_USER		0
+#define COMMAND_ADMIN		1
+#define COMMAND_MAXARGS		8
+
+/* Parsed lines */
+#define IRC_MSG_MAXPARAMS	15
+#define IRC_MSG_MAXTAGS		16
+
 
 /*
  * Variables and structures needed..
@@ -66,10 +76,49 @@ struct mod_object
 	char *filename;
 	int (*irc_callback)(const char *from, const char *to,
 						const char *command, const char *mesg);
+	unsigned int refs;
+	int unloading;
 	struct mod_object *prev;
 	struct mod_object *next;
 };
 
+struct command_call
+{
+	const char *from;
+	const char *to;
+	const char *name;
+	const char *args;
+	unsigned int argc;
+	const char *argv[COMMAND_MAXARGS];
+};
+
+struct irc_slice
+{
+	const char *s_data;
+	size_t s_len;
+};
+
+struct irc_tag
+{
+	struct irc_slice key;
+	struct irc_slice value;
+};
+
+struct irc_msg
+{
+	struct irc_slice tags;
+	struct irc_tag tagv[IRC_MSG_MAXTAGS];
+	unsigned int ntags;
+	struct irc_slice prefix;
+	struct irc_slice nick;
+	struct irc_slice user;
+	struct irc_slice host;
+	struct irc_slice command;
+	int code;
+	struct irc_slice params[IRC_MSG_MAXPARAMS];
+	unsigned int nparams;
+};
+
 
 /*
  * The prototypes needed...
@@ -79,5 +128,16 @@ int (*mod_load)(char *mod);
 int (*mod_unload)(const char *mod);
 int (*mod_register_irc)(struct mod_object *mh,
 					 int (*callback)(char *from, char *to, char *command, char *mesg));
+int (*command_register)(const void *owner, const char *name, int level,
+						unsigned int min_args, unsigned int max_args,
+						void (*handler)(const struct command_call *call));
+/* Look codes up once with irc_code("433") or irc_code("PRIVMSG"). */
+int (*irc_code)(const char *command);
+int (*irc_hook)(const void *owner, int code, int (*handler)(const struct irc_msg *msg));
+
+/* Scratch memory that is taken back once the current message is handled. */
+void *(*arena_alloc)(size_t size);
+char *(*arena_strdup)(const char *s);
+char *(*arena_strndup)(const char *s, size_t n);
 
 #endif /* _MODULES_H */
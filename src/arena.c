@@ -0,0 +1,229 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "arena.h"
+
+#include <stdint.h>
+
+
+static struct arena *arena_get(void);
+static struct arena_chunk *arena_chunk_new(size_t size);
+static void arena_destroy(void *arg);
+
+/*
+ * Set up the key each thread finds its arena by. Arenas themselves are
+ * made the first time a thread asks for memory.
+ * Return value:
+ *   Returns 0 on success and -1 on failure.
+ */
+int
+arena_init(void)
+{
+	return(pthread_key_create(&m_arena, arena_destroy) == 0 ? 0 : -1);
+}
+
+/*
+ * Hand out memory that lives until the message being handled is done
+ * with, which for a reactor thread is when bot_event() resets the arena.
+ * Nothing from here is freed on its own, don't keep pointers past that.
+ * Return value:
+ *   Returns the memory, aligned for any type, or NULL on failure.
+ */
+void *
+arena_alloc(size_t size)
+{
+	void *p;
+	struct arena_chunk *c;
+	struct arena *a = arena_get();
+	
+	if(a == NULL || size > SIZE_MAX-ARENA_ALIGN)
+		return(NULL);
+	size = (size == 0 ? ARENA_ALIGN : (size+ARENA_ALIGN-1) & ~(size_t)(ARENA_ALIGN-1));
+	
+	/* The rest of a full chunk is left be, it is back next reset. */
+	if((c = a->chunks) == NULL || c->c_size-c->c_used < size)
+	{
+		if((c = arena_chunk_new(size > ARENA_CHUNK ? size : ARENA_CHUNK)) == NULL)
+			return(NULL);
+		c->next = a->chunks;
+		a->chunks = c;
+	}
+	
+	p = c->c_data+c->c_used;
+	c->c_used += size;
+	a->a_used += size;
+	
+	return(p);
+}
+
+/*
+ * Copy a string into the arena.
+ * Return value:
+ *   Returns the copy or NULL on failure.
+ */
+char *
+arena_strdup(const char *s)
+{
+	return(arena_strndup(s, strlen(s)));
+}
+
+/*
+ * Copy at most n characters of a string into the arena, the copy is
+ * always NUL terminated.
+ * Return value:
+ *   Returns the copy or NULL on failure.
+ */
+char *
+arena_strndup(const char *s, size_t n)
+{
+	char *copy;
+	
+	n = strnlen(s, n);
+	if((copy = arena_alloc(n+1)) == NULL)
+		return(NULL);
+	memcpy(copy, s, n);
+	copy[n] = '\0';
+	
+	return(copy);
+}
+
+/*
+ * Take back everything this thread's arena handed out. A message that
+ * needed more than one chunk leaves a single chunk its size behind, up
+ * to ARENA_KEEP, so the next one like it is served without malloc.
+ * Return value:
+ *   None.
+ */
+void
+arena_reset(void)
+{
+	size_t want;
+	struct arena_chunk *c;
+	struct arena *a = pthread_getspecific(m_arena);
+	
+	if(a == NULL || a->chunks == NULL)
+		return;
+	
+	if(a->chunks->next != NULL || a->chunks->c_size > ARENA_KEEP)
+	{
+		want = (a->a_used+ARENA_CHUNK-1)/ARENA_CHUNK*ARENA_CHUNK;
+		if(want > ARENA_KEEP)
+			want = ARENA_KEEP;
+		
+		/* The newest chunk is kept if it is big enough already. */
+		if(a->chunks->c_size >= want && a->chunks->c_size <= ARENA_KEEP)
+		{
+			c = a->chunks->next;
+			a->chunks->next = NULL;
+		}
+		else
+		{
+			c = a->chunks;
+			a->chunks = NULL;
+		}
+		
+		while(c != NULL)
+		{
+			struct arena_chunk *next = c->next;
+			
+			free(c);
+			c = next;
+		}
+		
+		if(a->chunks == NULL)
+			a->chunks = arena_chunk_new(want);
+	}
+	
+	if(a->chunks != NULL)
+		a->chunks->c_used = 0;
+	a->a_used = 0;
+}
+
+/*
+ * Find the calling thread's arena, making it if this is the first time.
+ * Return value:
+ *   Returns the arena or NULL on failure.
+ */
+static struct arena *
+arena_get(void)
+{
+	struct arena *a = pthread_getspecific(m_arena);
+	
+	if(a != NULL)
+		return(a);
+	
+	if((a = calloc(1, sizeof(*a))) == NULL)
+		return(NULL);
+	
+	if(pthread_setspecific(m_arena, a) != 0)
+	{
+		free(a);
+		return(NULL);
+	}
+	
+	return(a);
+}
+
+/*
+ * Allocate an empty chunk with room for size bytes.
+ * Return value:
+ *   Returns the chunk or NULL on failure.
+ */
+static struct arena_chunk *
+arena_chunk_new(size_t size)
+{
+	struct arena_chunk *c;
+	
+	if((c = malloc(sizeof(*c)+size)) == NULL)
+		return(NULL);
+	c->next = NULL;
+	c->c_size = size;
+	c->c_used = 0;
+	
+	return(c);
+}
+
+/*
+ * Free a thread's arena as the thread goes away.
+ * Return value:
+ *   None.
+ */
+static void
+arena_destroy(void *arg)
+{
+	struct arena *a = arg;
+	struct arena_chunk *c;
+	
+	while((c = a->chunks) != NULL)
+	{
+		a->chunks = c->next;
+		free(c);
+	}
+	free(a);
+}
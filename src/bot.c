@@ -29,138 +29,426 @@
 #include "global.h"
 #include "bot.h"
 #include "irc.h"
+#include "config_file.h"
+#include "upgrade.h"
 
 #include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <sys/select.h>
 
 
-static int bot_loop(void);
+static void bot_connected(struct socket_in *irc_t, int status, void *arg);
+static void bot_event(struct socket_in *irc_t, int events, void *arg);
+static void bot_stop(struct bot_in *bot_t, int status);
+static void bot_reconnect(struct bot_in *bot_t, int failed, u_int floor);
+static void bot_retry(void *bot_config);
+static void bot_ping(void *bot_config);
+static int bot_online(struct bot_in *bot_t, struct socket_in *irc_t);
+static int bot_resume(struct bot_in *bot_t);
 
 /*
- * This is where it all starts. The first function of our actual bot.
+ * Point our thread specific data at a bot before doing work on its behalf.
+ * Many bots share one reactor thread so this must be done on every event.
  * Return value:
  *   None.
  */
-static void *
-bot_thread(void *bot_config)
+static void
+bot_context(struct bot_in *bot_t)
+{
+	pthread_setspecific(bot, bot_t);
+	pthread_setspecific(irc_s, bot_t->irc_sock);
+}
+
+/*
+ * This is where it all starts. Connect our bot and hand its socket to the
+ * reactor. Runs on the reactor thread chosen by bot_spawn().
+ * Return value:
+ *   None.
+ */
+static void
+bot_start(void *bot_config)
 {
-	fd_set *m_sock_fds_t = malloc(sizeof(*m_sock_fds_t));
 	struct bot_in *bot_t = (struct bot_in *)bot_config;
-	struct socket_in *irc_t;
 	
 	/* A quick break for sanity checks. */
-	if(m_sock_fds_t == NULL || bot_t == NULL)
-		pthread_exit(NULL);
+	if(bot_t == NULL)
+		return;
 	
-	/* Clear our descripto sets in prep. for adding our sockets. */
-	FD_ZERO(m_sock_fds_t);
+	bot_t->irc_sock = NULL;
+	bot_context(bot_t);
 	
-	/* XXX Add IRC connection creation and add to m_read_fds. */
-	if(irc_connect(&irc_t, bot_t->irc_host, bot_t->irc_port, bot_t->irc_ssl) == 0)
-		FD_SET(irc_t->fd, m_sock_fds_t);
+	if(bot_t->irc_server == NULL)
+		bot_t->irc_server = bot_t->irc_servers;
 	
+	/* Carry on with a connection from before an upgrade, if we have one. */
+	if(bot_t->irc_resume != NULL && bot_resume(bot_t) == 0)
+		return;
 	
+	if(irc_connect(bot_t, bot_connected) != 0)
+	{
+		reactor_release(bot_t->reactor);
+		bot_destory_config(bot_t);
+	}
+}
+
+/*
+ * Called once the bot's IRC connection is up, or could not be made.
+ * Return value:
+ *   None.
+ */
+static void
+bot_connected(struct socket_in *irc_t, int status, void *arg)
+{
+	struct bot_in *bot_t = (struct bot_in *)arg;
+	
+	bot_context(bot_t);
+	
+	/* Nobody answered, the next server gets a turn after a backoff. */
+	if(status != 0)
+	{
+		bot_t->irc_addrlen = 0;
+		bot_stop(bot_t, E_FAILED);
+		return;
+	}
+	
+	if(bot_online(bot_t, irc_t) != 0)
+		return;
+	
+	/* Don't wait for the server, it reads our registration when it is ready. */
+	irc_register();
+}
+
+/*
+ * Put a connected socket to work for our bot: hook it into the reactor,
+ * start pacing our output and start watching for the link going quiet.
+ * Shared by fresh connections and ones handed over across an upgrade.
+ * Return value:
+ *   0 on success, -1 if the bot had to be torn down.
+ */
+static int
+bot_online(struct bot_in *bot_t, struct socket_in *irc_t)
+{
 	/* Set our thread specific stuffs. */
-	pthread_setspecific(m_sock_fds, m_sock_fds_t);
-	pthread_setspecific(bot, bot_t);
-	pthread_setspecific(irc_s, irc_t);
+	bot_t->irc_sock = irc_t;
+	bot_context(bot_t);
 	
+	socket_limits(irc_t, bot_t->irc_recv_max, bot_t->irc_recv_policy);
 	
-	/*
-	 * Call our bot's loop function.
-	 * If we return -1 that means we should try to reestablish a connections. Otherwise
-	 * just free our memroy and quit.
-	 */
-	switch(bot_loop())
+	/* Register the IRC connection with our reactor. */
+	if(socket_attach(irc_t, bot_t->reactor, bot_event, bot_t) != 0)
+	{
+		socket_close(irc_t);
+		bot_t->irc_sock = NULL;
+		reactor_release(bot_t->reactor);
+		bot_destory_config(bot_t);
+		return(-1);
+	}
+	
+	/* Everything we send is paced to stay within the server's flood limits. */
+	bot_t->irc_out_class = SCHED_BULK;
+	sched_init(&bot_t->irc_out, bot_t->reactor, irc_t,
+			   (config_global.flood_burst > 0 ? config_global.flood_burst : SCHED_BURST),
+			   (config_global.flood_rate > 0 ? config_global.flood_rate : SCHED_RATE));
+	
+	/* Start watching for the connection going quiet on us. */
+	bot_t->irc_lag = -1;
+	bot_t->irc_delay = -1;
+	bot_t->irc_ping_sent = 0;
+	bot_t->irc_last_rx = reactor_time();
+	reactor_timer_set(bot_t->reactor, &bot_t->irc_ping_timer,
+					  (config_global.ping_interval > 0 ? config_global.ping_interval : BOT_PINGINTERVAL)*1000,
+					  bot_ping, bot_t);
+	return(0);
+}
+
+/*
+ * Pick up a connection our previous process image handed over through
+ * exec(). The server never saw us leave so there is nothing to register,
+ * we just carry on where we were, lines half read and half sent included.
+ * Return value:
+ *   0 on success, -1 if the connection could not be taken over.
+ */
+static int
+bot_resume(struct bot_in *bot_t)
+{
+	struct socket_in *irc_t = NULL;
+	struct upgrade_bot *u = bot_t->irc_resume;
+	
+	bot_t->irc_resume = NULL;
+	if(socket_adopt(&irc_t, u->fd, u->rx, u->rx_len) != 0)
+	{
+		upgrade_free(u);
+		return(-1);
+	}
+	u->fd = -1;
+	
+	if(bot_online(bot_t, irc_t) != 0)
+	{
+		upgrade_free(u);
+		return(0);
+	}
+	
+	bot_t->bot_status = BOT_STATUS_RUNNING;
+	bot_t->irc_caps = u->caps;
+	bot_t->irc_authed = u->authed;
+	bot_t->irc_cap_pending = 0;
+	if(u->tx != NULL && u->tx[0] != '\0')
+		socket_send(irc_t, u->tx);
+	upgrade_free(u);
+	
+	/* Anything that arrived while we were busy exec()ing is already ours. */
+	bot_event(irc_t, REACTOR_READ, bot_t);
+	return(0);
+}
+
+/*
+ * Keep an eye on an idle connection. Once nothing has come in for the
+ * ping interval we send a PING carrying the time, the PONG gives us our
+ * lag. If the server still says nothing by the ping timeout the
+ * connection is dead, even if TCP hasn't noticed yet.
+ * Return value:
+ *   None.
+ */
+static void
+bot_ping(void *bot_config)
+{
+	char token[32];
+	uint64_t now = reactor_time(), idle;
+	u_int interval = (config_global.ping_interval > 0 ? config_global.ping_interval : BOT_PINGINTERVAL)*1000;
+	u_int timeout = (config_global.ping_timeout > 0 ? config_global.ping_timeout : BOT_PINGTIMEOUT)*1000;
+	struct bot_in *bot_t = (struct bot_in *)bot_config;
+	
+	bot_context(bot_t);
+	
+	/* Anything at all from the server shows the connection is alive. */
+	if(bot_t->irc_ping_sent != 0 && bot_t->irc_last_rx < bot_t->irc_ping_sent)
+	{
+		if(now-bot_t->irc_ping_sent >= timeout)
+		{
+			vout(1, VOUT_FLOW_NONE, "BOT", "No reply to our PING, reconnecting.");
+			bot_stop(bot_t, E_LAGGED);
+			return;
+		}
+		
+		reactor_timer_set(bot_t->reactor, &bot_t->irc_ping_timer,
+						  timeout-(now-bot_t->irc_ping_sent), bot_ping, bot_t);
+		return;
+	}
+	
+	bot_t->irc_ping_sent = 0;
+	idle = now-bot_t->irc_last_rx;
+	
+	if(idle < interval)
+	{
+		reactor_timer_set(bot_t->reactor, &bot_t->irc_ping_timer,
+						  interval-idle, bot_ping, bot_t);
+		return;
+	}
+	
+	snprintf(token, sizeof(token), "%s%llu", IRC_LAG_TOKEN, (unsigned long long)now);
+	irc_cmd(IRC_PING, token, NULL);
+	bot_t->irc_ping_sent = now;
+	
+	reactor_timer_set(bot_t->reactor, &bot_t->irc_ping_timer, timeout, bot_ping, bot_t);
+}
+
+/*
+ * Tear down the bot's connection and decide what to do next.
+ * Everything but E_NONE tries to reestablish the connection from this
+ * reactor. Otherwise just free our memory and quit.
+ * Return value:
+ *   None.
+ */
+static void
+bot_stop(struct bot_in *bot_t, int status)
+{
+	reactor_timer_cancel(&bot_t->irc_ping_timer);
+	sched_clear(&bot_t->irc_out);
+	
+	if(bot_t->irc_sock != NULL)
+	{
+		struct socket_in *irc_t = bot_t->irc_sock;
+		
+		/* Remember where we got through to, if the server ever spoke. */
+		if(status != E_LAGGED && irc_t->buffer->r_tail > 0 &&
+		   irc_t->addrlen <= sizeof(bot_t->irc_addr))
+		{
+			memcpy(&bot_t->irc_addr, &irc_t->addr, irc_t->addrlen);
+			bot_t->irc_addrlen = irc_t->addrlen;
+		}
+		else
+			bot_t->irc_addrlen = 0;
+		
+		socket_close(bot_t->irc_sock);
+		bot_t->irc_sock = NULL;
+		pthread_setspecific(irc_s, NULL);
+	}
+	
+	switch(status)
 	{
 		default:
 			vout(4, VOUT_FLOW_INBOUND, "BOT", "Something went seriously wrong.");
+			/* FALLTHROUGH */
 		case E_NONE:
+			reactor_release(bot_t->reactor);
 			bot_destory_config(bot_t);
+			
+			/*
+			 * Once the last bot is gone there is nothing left to do. Let
+			 * main() stop the other threads before the process exits.
+			 */
+			pthread_mutex_lock(&mtx_bots);
+			if(bots->b_first == NULL)
+				kill(getpid(), SIGTERM);
+			pthread_mutex_unlock(&mtx_bots);
 			break;
 		case E_REWAIT:
-			sleep(30);
-			/* Fallthrough */
+			/* The server told us to slow down, so we do. */
+			bot_reconnect(bot_t, 1, BOT_REWAIT);
+			break;
+		case E_FAILED:
+		case E_LAGGED:
+			/* A server that failed us is worth moving away from. */
+			bot_reconnect(bot_t, 1, 0);
+			break;
+		case E_DROPPED:
+			/* Dropped before we were let in counts against the server. */
+			bot_reconnect(bot_t, (bot_t->bot_status & BOT_STATUS_STARTING) != 0, 0);
+			break;
 		case E_RECONN:
-			bot_spawn(bot_t);
+			bot_reconnect(bot_t, 0, 0);
 			break;
 	}
+}
+
+/*
+ * Schedule the next connection attempt on the bot's own reactor, so the
+ * bot keeps its config, reactor and timers. Attempts in a row wait up to
+ * twice as long as the one before, capped at BOT_BACKOFF_MAX, and the
+ * actual wait is picked at random below that so bots dropped together
+ * don't come back in lockstep. A server that fails BOT_BREAKER_FAILS
+ * times running is skipped for BOT_BREAKER_COOLDOWN.
+ * Return value:
+ *   None.
+ */
+static void
+bot_reconnect(struct bot_in *bot_t, int failed, u_int floor)
+{
+	u_int delay, cap = BOT_BACKOFF_MAX;
+	uint64_t now = reactor_time();
+	struct server_list *server = bot_t->irc_server, *next, *soonest = NULL;
 	
-	/* Free up our memory and exit. */
-	free(m_sock_fds_t);
+	if(failed && server != NULL)
+	{
+		if(++server->fails >= BOT_BREAKER_FAILS)
+			server->open_until = now+BOT_BREAKER_COOLDOWN;
+		
+		/* Take the next server that isn't cooling off, or the one back first. */
+		next = server;
+		do
+		{
+			next = (next->next != NULL ? next->next : bot_t->irc_servers);
+			if(soonest == NULL || next->open_until < soonest->open_until)
+				soonest = next;
+		}
+		while(next != server && next->open_until > now);
+		
+		if(next->open_until > now)
+			next = soonest;
+		if(next != server)
+			bot_t->irc_addrlen = 0;
+		
+		bot_t->irc_server = server = next;
+	}
+	
+	if(bot_t->irc_retries < 16 && ((u_int)BOT_BACKOFF_MIN << bot_t->irc_retries) < cap)
+		cap = (u_int)BOT_BACKOFF_MIN << bot_t->irc_retries;
+	bot_t->irc_retries++;
+	
+	delay = random()%(cap+1);
+	if(delay < floor)
+		delay = floor;
+	if(server != NULL && server->open_until > now+delay)
+		delay = server->open_until-now;
 	
-	pthread_exit(NULL);
+	reactor_timer_set(bot_t->reactor, &bot_t->irc_timer, delay, bot_retry, bot_t);
 }
 
 /*
- * Main bot loop. From here everything will be done!
+ * Try connecting again, once bot_reconnect()'s timer is up.
  * Return value:
- *   Returns one of E_NONE, E_RECONN, or E_REWAIT.
+ *   None.
  */
-static int
-bot_loop(void)
+static void
+bot_retry(void *bot_config)
 {
-	char *buf = NULL;
-	fd_set sock_fds, *m_sock_fds_t = pthread_getspecific(m_sock_fds);
-	struct socket_in *irc_t = pthread_getspecific(irc_s);
+	struct bot_in *bot_t = (struct bot_in *)bot_config;
+	
+	bot_context(bot_t);
+	
+	if(bot_t->irc_server == NULL)
+		bot_t->irc_server = bot_t->irc_servers;
+	
+	if(irc_connect(bot_t, bot_connected) != 0)
+	{
+		if(bot_t->irc_server == NULL)
+		{
+			reactor_release(bot_t->reactor);
+			bot_destory_config(bot_t);
+			return;
+		}
+		bot_reconnect(bot_t, 1, 0);
+	}
+}
+
+/*
+ * Called by the reactor when the bot's IRC socket has data or an error.
+ * From here everything will be done!
+ * Return value:
+ *   None.
+ */
+static void
+bot_event(struct socket_in *irc_t, int events, void *arg)
+{
+	struct socket_view line;
+	struct bot_in *bot_t = (struct bot_in *)arg;
+	
+	/* Errors don't need telling apart, socket_recv() reports them too. */
+	(void)events;
+	
+	bot_context(bot_t);
+	bot_t->irc_last_rx = reactor_time();
 	
-	while(1)
+	do
 	{
 		/*
-		 * XXX Are these the same? Confirm which is better.
-		 * memcpy(&sock_fds, m_sock_fds_t, sizeof(*m_sock_fds_t));
-		 * sock_fds = *m_sock_fds_t;
+		 * Check the IRC's socket for data. Anything but EAGAIN is fatal
+		 * here, otherwise the reactor would keep waking us up for it.
 		 */
-		memcpy(&sock_fds, m_sock_fds_t, sizeof(*m_sock_fds_t));
-		if(select(FD_SETSIZE, &sock_fds, NULL, NULL, NULL) == -1)
+		if(socket_recv(irc_t) == -1)
 		{
-			/*
-			 * XXX Handle select() errors, see man page for more details. For
-			 * we will just break out of the loop, but soon some actual
-			 * error checking.
-			 */
-			printf("Oops!\n\n");
-			break;
+			bot_stop(bot_t, (bot_t->bot_status & BOT_STATUS_QUITTING ? E_NONE : E_DROPPED));
+			return;
 		}
 		
-		/* Check the IRC's socket for data. */
-		if(FD_ISSET(irc_t->fd, &sock_fds))
+		/* Lines are parsed right out of the socket's receive buffer. */
+		while(socket_next_line(irc_t, "\r\n", &line) == 0)
 		{
-			if(socket_recv(irc_t, "\r\n") == -1)
-			{
-				switch(errno)
-				{
-					case EBADF:
-					case ECONNRESET:
-					case ENOTCONN:
-					case ENOTSOCK:
-					case EFAULT:
-						return(-1);
-				}
-			}
+			int ret = irc_parse(line.v_data);
+			socket_release(irc_t, &line);
 			
-			while((buf = socket_next_chunk(irc_t)) != NULL)
+			/* Whatever was needed to handle the line goes with it. */
+			arena_reset();
+			
+			if(ret != 0)
 			{
-				int ret = irc_parse(buf);
-				if(buf != NULL)
-					free(buf);
-				
-				if(ret != 0)
-				{
-					socket_close(irc_t);
-					return(ret);
-				}
+				bot_stop(bot_t, ret);
+				return;
 			}
 		}
-		
-		
-		/* XXX Here we will check our other sockets from our modules. */
 	}
-	
-	/* This should be unreachable. */
-	return(0);
+	while(irc_t->buffer->r_full);
 }
 
 /*
@@ -216,9 +504,9 @@ bot_clone_config(const struct bot_in *orig)
 	
 	/* Start copying over anything that isn't NULL. */
 	clone->irc_ssl = orig->irc_ssl;
+	clone->irc_recv_max = orig->irc_recv_max;
+	clone->irc_recv_policy = orig->irc_recv_policy;
 	
-	if(orig->irc_host != NULL)
-		clone->irc_host = strdup(orig->irc_host);
 	if(orig->irc_port != NULL)
 		clone->irc_port = strdup(orig->irc_port);
 	
@@ -231,6 +519,25 @@ bot_clone_config(const struct bot_in *orig)
 	if(orig->irc_admins != NULL)
 		clone->irc_admins = strdup(orig->irc_admins);
 	
+	/* Servers are stored split up, so put them back together. */
+	{
+		struct server_list *cur = orig->irc_servers;
+		
+		for(; cur != NULL; cur = cur->next)
+		{
+			if(cur->port != NULL)
+			{
+				char buf[512];
+				
+				snprintf(buf, sizeof(buf), (strchr(cur->host, ':') != NULL ? "[%s]:%s" : "%s:%s"),
+						 cur->host, cur->port);
+				bot_add_server(clone, buf);
+			}
+			else
+				bot_add_server(clone, cur->host);
+		}
+	}
+	
 	/*
 	 * This require a bit more work... Luckily we have a nice function.
 	 */
@@ -274,6 +581,9 @@ bot_destory_config(struct bot_in *config)
 	if(bots->b_last == config)
 		bots->b_last = config->prev;
 	
+	else
+		config->next->prev = config->prev;
+	
 	
 	/* Unlock now that we don't need it. */
 	pthread_mutex_unlock(&mtx_bots);
@@ -284,9 +594,6 @@ bot_destory_config(struct bot_in *config)
 		if(config->irc_admins != NULL)
 			free(config->irc_admins);
 		
-		if(config->irc_host != NULL)
-			free(config->irc_host);
-		
 		if(config->irc_name != NULL)
 			free(config->irc_name);
 		
@@ -305,9 +612,31 @@ bot_destory_config(struct bot_in *config)
 		if(config->irc_port != NULL)
 			free(config->irc_port);
 		
+		if(config->irc_sasl_mech != NULL)
+			free(config->irc_sasl_mech);
+		
+		if(config->irc_sasl_pass != NULL)
+			free(config->irc_sasl_pass);
+		
+		if(config->irc_sasl_user != NULL)
+			free(config->irc_sasl_user);
+		
 		if(config->irc_user != NULL)
 			free(config->irc_user);
 		
+		if(config->irc_resume != NULL)
+			upgrade_free(config->irc_resume);
+		
+		while(config->irc_servers != NULL)
+		{
+			struct server_list *cur = config->irc_servers;
+			
+			config->irc_servers = cur->next;
+			free(cur->host);
+			free(cur->port);
+			free(cur);
+		}
+		
 		/*
 		 * Again slightly more complex...
 		 * We don't use bot_remove_channel() because we don't want excesive
@@ -375,11 +704,9 @@ bot_add_channel(struct bot_in *bot_config, const char *channel)
 		char *chan, *channels;
 		struct chan_list *temp_clist;
 		
-		if((channels = malloc(sizeof(*channels)*(strlen(channel)+1))) == NULL)
-			return(-1);
-		
 		/* Make a copy of our channels buffer. */
-		strcpy(channels, channel);
+		if((channels = arena_strdup(channel)) == NULL)
+			return(-1);
 		
 		for(chan = strtok(channels, ",");
 			chan != NULL;
@@ -403,10 +730,6 @@ bot_add_channel(struct bot_in *bot_config, const char *channel)
 			}
 			cur_clist = temp_clist;
 		}
-		
-		/* A bit of clean up. */
-		if(channels != NULL)
-			free(channels);
 	}
 	
 	
@@ -488,6 +811,79 @@ bot_add_channel(struct bot_in *bot_config, const char *channel)
 	return(0);
 }
 
+/*
+ * Add one or more comma separated servers to our bot's server list. Each
+ * is a host with an optional port, as in "irc.example.net:6697" or
+ * "[2001:db8::1]:6667", or a local socket as in "unix:/run/ircd.sock".
+ * Servers without a port use irc_port.
+ * Return value:
+ *   Returns 0 on success, otherwise returns -1.
+ */
+int
+bot_add_server(struct bot_in *bot_config, const char *servers)
+{
+	char *copy, *entry, *last;
+	struct server_list *tail;
+	
+	/* Sanity checks... */
+	if(bot_config == NULL || servers == NULL)
+		return(-1);
+	
+	if((copy = strdup(servers)) == NULL)
+		return(-1);
+	
+	/* Find the end of our list, new servers go last. */
+	for(tail = bot_config->irc_servers; tail != NULL && tail->next != NULL; tail = tail->next);
+	
+	for(entry = strtok_r(copy, ", ", &last);
+		entry != NULL;
+		entry = strtok_r(NULL, ", ", &last))
+	{
+		char *port = NULL;
+		struct server_list *server;
+		
+		/* Local sockets have no port, their colon is part of the name. */
+		if(strncmp(entry, SOCKET_UNIXPREFIX, sizeof(SOCKET_UNIXPREFIX)-1) == 0)
+			port = NULL;
+		
+		/* Brackets keep the colons of an IPv6 address out of the way. */
+		else if(*entry == '[' && (port = strchr(entry, ']')) != NULL)
+		{
+			*port++ = '\0';
+			entry++;
+			port = (*port == ':' ? port+1 : NULL);
+		}
+		else if((port = strchr(entry, ':')) != NULL && strchr(port+1, ':') == NULL)
+			*port++ = '\0';
+		else
+			port = NULL;
+		
+		if((server = calloc(1, sizeof(*server))) == NULL)
+			break;
+		
+		if((server->host = strdup(entry)) == NULL ||
+		   (port != NULL && *port != '\0' && (server->port = strdup(port)) == NULL))
+		{
+			free(server->host);
+			free(server);
+			break;
+		}
+		
+		if(tail == NULL)
+			bot_config->irc_servers = server;
+		else
+		{
+			tail->next = server;
+			server->prev = tail;
+		}
+		tail = server;
+	}
+	
+	free(copy);
+	
+	return(entry == NULL ? 0 : -1);
+}
+
 /*
  * Remove a channel from our bot's config.
  * Return value:
@@ -506,7 +902,8 @@ bot_remove_channel(struct bot_in *bot_config, const char *channel_old)
 		return(-1);
 	
 	/* Remove any funky characters before we parse anything. */
-	channel = normalize_space(channel_old);
+	if((channel = normalize_space(channel_old)) == NULL)
+		return(-1);
 	
 	/* Lock our precious mutex. */
 	pthread_mutex_lock(&mtx_bots);
@@ -545,17 +942,18 @@ bot_remove_channel(struct bot_in *bot_config, const char *channel_old)
 }
 
 /*
- * Start a new thread with a bot config.
+ * Start a bot on the least loaded reactor thread.
  * Return value:
  *   None.
  */
 void
 bot_spawn(struct bot_in *bot_config)
 {
-	/*
-	 * XXX Could probably use some mutex locks here... ya.
-	 * Start our new thread.
-	 */
-	pthread_create(&bot_config->thread_id, &thread_attr,
-				   bot_thread, (void *)bot_config);
+	if(bot_config == NULL)
+		return;
+	
+	if((bot_config->reactor = reactor_pick()) == NULL)
+		return;
+	
+	reactor_call(bot_config->reactor, bot_start, bot_config);
 }
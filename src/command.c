@@ -0,0 +1,208 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "command.h"
+#include "mod_so.h"
+
+#include <ctype.h>
+
+
+static struct command *commands[COMMAND_BUCKETS];
+static pthread_mutex_t mtx_commands = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Hash a command name, case doesn't matter to us or our users.
+ * Return value:
+ *   The bucket the name belongs in.
+ */
+static u_int
+command_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+	
+	for(; *name != '\0'; name++)
+		hash = (hash^(unsigned char)tolower((unsigned char)*name))*16777619U;
+	
+	return(hash%COMMAND_BUCKETS);
+}
+
+/*
+ * Add a command users can run by saying COMMAND_PREFIX and its name.
+ * The first max_args words are split out for the handler, the last of
+ * them taking the rest of the line, and anything with fewer than
+ * min_args is ignored. COMMAND_ADMIN commands only answer to admins.
+ * Modules pass their mod_object as owner, so they can be cleaned up.
+ * Return value:
+ *   Returns 0 on success or -1 if the name is taken or on error.
+ */
+int
+command_register(const void *owner, const char *name, int level,
+				 u_int min_args, u_int max_args,
+				 void (*handler)(const struct command_call *call))
+{
+	u_int bucket;
+	struct command *cmd;
+	
+	if(name == NULL || handler == NULL || max_args > COMMAND_MAXARGS || min_args > max_args)
+		return(-1);
+	
+	bucket = command_hash(name);
+	
+	pthread_mutex_lock(&mtx_commands);
+	for(cmd = commands[bucket]; cmd != NULL; cmd = cmd->next)
+	{
+		if(strcasecmp(cmd->name, name) == 0)
+		{
+			pthread_mutex_unlock(&mtx_commands);
+			return(-1);
+		}
+	}
+	
+	if((cmd = calloc(1, sizeof(*cmd))) == NULL || (cmd->name = strdup(name)) == NULL)
+	{
+		pthread_mutex_unlock(&mtx_commands);
+		free(cmd);
+		return(-1);
+	}
+	
+	cmd->level = level;
+	cmd->min_args = min_args;
+	cmd->max_args = max_args;
+	cmd->handler = handler;
+	cmd->owner = owner;
+	cmd->next = commands[bucket];
+	commands[bucket] = cmd;
+	pthread_mutex_unlock(&mtx_commands);
+	
+	return(0);
+}
+
+/*
+ * Remove every command an owner registered, before a module goes away.
+ * Return value:
+ *   None.
+ */
+void
+command_unregister(const void *owner)
+{
+	u_int i;
+	struct command **link, *cmd;
+	
+	pthread_mutex_lock(&mtx_commands);
+	for(i = 0; i < COMMAND_BUCKETS; i++)
+	{
+		for(link = &commands[i]; (cmd = *link) != NULL;)
+		{
+			if(cmd->owner != owner)
+			{
+				link = &cmd->next;
+				continue;
+			}
+			
+			*link = cmd->next;
+			free(cmd->name);
+			free(cmd);
+		}
+	}
+	pthread_mutex_unlock(&mtx_commands);
+}
+
+/*
+ * Run the command in a line that had COMMAND_PREFIX taken off. The line
+ * is split once into a copy on our stack and one lookup finds the
+ * handler. The caller has already worked out if the sender is an admin.
+ * Return value:
+ *   Returns 0 if the line was a command, otherwise -1.
+ */
+int
+command_dispatch(const char *from, const char *to, const char *line, int admin)
+{
+	char buf[COMMAND_LINEMAX+1], *p;
+	size_t len;
+	u_int min, max;
+	struct command *cmd;
+	struct command_call call;
+	const void *owner;
+	void (*handler)(const struct command_call *call);
+	
+	if((len = strlen(line)) > COMMAND_LINEMAX)
+		len = COMMAND_LINEMAX;
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+	
+	call.from = from;
+	call.to = to;
+	call.name = buf;
+	p = buf+strcspn(buf, " ");
+	if(*p != '\0')
+		*p++ = '\0';
+	p += strspn(p, " ");
+	call.args = line+(p-buf);
+	
+	/*
+	 * The handler is copied out and its module held, so an unload on
+	 * another reactor can't close the code while it runs.
+	 */
+	pthread_mutex_lock(&mtx_commands);
+	for(cmd = commands[command_hash(call.name)];
+		cmd != NULL && strcasecmp(cmd->name, call.name) != 0;
+		cmd = cmd->next);
+	
+	if(cmd == NULL || (cmd->level == COMMAND_ADMIN && admin == 0))
+	{
+		pthread_mutex_unlock(&mtx_commands);
+		return(-1);
+	}
+	
+	handler = cmd->handler;
+	min = cmd->min_args;
+	max = cmd->max_args;
+	owner = cmd->owner;
+	mod_hold(owner);
+	pthread_mutex_unlock(&mtx_commands);
+	
+	/* Split out the arguments, the last one takes what is left over. */
+	for(call.argc = 0; *p != '\0' && call.argc < max;)
+	{
+		call.argv[call.argc++] = p;
+		if(call.argc == max)
+			break;
+		
+		p += strcspn(p, " ");
+		if(*p != '\0')
+			*p++ = '\0';
+		p += strspn(p, " ");
+	}
+	
+	if(call.argc >= min)
+		handler(&call);
+	mod_release(owner);
+	
+	return(0);
+}
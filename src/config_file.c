@@ -29,6 +29,7 @@
 #include "global.h"
 #include "bot.h"
 #include "config_file.h"
+#include "socket.h"
 
 #include <errno.h>
 #include <regex.h>
@@ -36,6 +37,8 @@
 #include <unistd.h>
 
 
+struct config_global config_global;
+
 static char *get_line(FILE *fp);
 
 /*
@@ -50,7 +53,8 @@ read_config(char *path)
 	char *line, err[512];
 	regex_t re;
 	
-	if((fp = fopen(path, "r")) == NULL)
+	/* Close-on-exec, or every upgrade would leak another copy. */
+	if((fp = fopen(path, "re")) == NULL)
 	{
 		if(errno == ENOENT)
 			fprintf(stderr, "[ERROR] No configuration file (%s).\n", path);
@@ -108,13 +112,48 @@ read_config(char *path)
 			key[key_len] = '\0';
 			value[value_len] = '\0';
 			
-			/* Bit of sanity checking... */
+			/* Settings before the first [bot] apply to the whole process. */
 			if(curr_bot == NULL)
+			{
+				if(strcmp(key, "reactor_threads") == 0)
+					config_global.reactor_threads = atoi(value);
+				else if(strcmp(key, "connect_timeout") == 0)
+					config_global.connect_timeout = atoi(value);
+				else if(strcmp(key, "ping_interval") == 0)
+					config_global.ping_interval = atoi(value);
+				else if(strcmp(key, "ping_timeout") == 0)
+					config_global.ping_timeout = atoi(value);
+				else if(strcmp(key, "flood_burst") == 0)
+					config_global.flood_burst = atoi(value);
+				else if(strcmp(key, "flood_rate") == 0)
+					config_global.flood_rate = atoi(value);
+				else if(strcmp(key, "ssl_session_file") == 0)
+				{
+					config_global.ssl_session_file = value;
+					value = NULL;
+				}
+				else if(strcmp(key, "ssl_cert_file") == 0)
+				{
+					config_global.ssl_cert_file = value;
+					value = NULL;
+				}
+				else if(strcmp(key, "ssl_key_file") == 0)
+				{
+					config_global.ssl_key_file = value;
+					value = NULL;
+				}
+				
+				free(value);
+				free(key);
+				free(line);
 				continue;
+			}
 			
 			if(strcmp(key, "irc_host") == 0)
 			{
-				curr_bot->irc_host = value;
+				/* Any number of servers, the bot rotates through them. */
+				bot_add_server(curr_bot, value);
+				free(value);
 			}
 			else if(strcmp(key, "irc_port") == 0)
 			{
@@ -124,6 +163,31 @@ read_config(char *path)
 			{
 				curr_bot->irc_ssl = (strcmp(value, "yes") == 0 ? 1 : 0);
 			}
+			else if(strcmp(key, "irc_recv_max") == 0)
+			{
+				unsigned long max;
+				
+				errno = 0;
+				max = strtoul(value, NULL, 10);
+				if(errno == ERANGE || max > SOCKET_RBUFLIMIT)
+				{
+					fprintf(stderr, "[ERROR] irc_recv_max can be at most %d.\n",
+							SOCKET_RBUFLIMIT);
+				}
+				else
+					curr_bot->irc_recv_max = max;
+				free(value);
+			}
+			else if(strcmp(key, "irc_recv_policy") == 0)
+			{
+				if(strcmp(value, "truncate") == 0)
+					curr_bot->irc_recv_policy = SOCKET_LINE_TRUNCATE;
+				else if(strcmp(value, "close") == 0)
+					curr_bot->irc_recv_policy = SOCKET_LINE_CLOSE;
+				else
+					curr_bot->irc_recv_policy = SOCKET_LINE_DROP;
+				free(value);
+			}
 			else if(strcmp(key, "irc_pass") == 0)
 			{
 				curr_bot->irc_pass = value;
@@ -136,6 +200,18 @@ read_config(char *path)
 			{
 				curr_bot->irc_nspass = value;
 			}
+			else if(strcmp(key, "irc_sasl_mech") == 0)
+			{
+				curr_bot->irc_sasl_mech = value;
+			}
+			else if(strcmp(key, "irc_sasl_user") == 0)
+			{
+				curr_bot->irc_sasl_user = value;
+			}
+			else if(strcmp(key, "irc_sasl_pass") == 0)
+			{
+				curr_bot->irc_sasl_pass = value;
+			}
 			else if(strcmp(key, "irc_user") == 0)
 			{
 				curr_bot->irc_user = value;
@@ -178,6 +254,7 @@ read_config(char *path)
 	}
 	
 	regfree(&re);
+	fclose(fp);
 	return(0);
 }
 
@@ -190,6 +267,7 @@ static char *
 get_line(FILE *fp)
 {
 	int i = 2;
+	size_t len;
 	char *temp, *buf = malloc(sizeof(*buf)*CONFIG_LINE_SIZE);
 	
 	if(!buf)
@@ -203,6 +281,7 @@ get_line(FILE *fp)
 	
 	while((temp = strstr(buf, "\n")) == NULL)
 	{
+		len = strlen(buf);
 		temp = realloc(buf, CONFIG_LINE_SIZE*i);
 		
 		if(temp == NULL)
@@ -213,7 +292,8 @@ get_line(FILE *fp)
 		
 		buf = temp;
 		
-		if(fgets(buf+CONFIG_LINE_SIZE*i++, CONFIG_LINE_SIZE, fp) == NULL)
+		/* Carry on from where the last read left off. */
+		if(fgets(buf+len, CONFIG_LINE_SIZE*i++-len, fp) == NULL)
 			return(buf);
 	}
 	
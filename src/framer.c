@@ -0,0 +1,86 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "framer.h"
+
+
+/*
+ * Check whether the delimiter starts at pos, whose first byte is already
+ * known to match. Near the end of the data only the part of it that fits
+ * has to match, the rest may still arrive.
+ * Return value:
+ *   Returns 1 if it matches, otherwise 0.
+ */
+static inline int
+framer_match(const char *data, size_t len, size_t pos, const char *delim, size_t delim_len)
+{
+	size_t i;
+	
+	/* Delimiters are a byte or two, a loop beats calling memcmp(). */
+	for(i = 1; i < delim_len && pos+i < len; i++)
+	{
+		if(data[pos+i] != delim[i])
+			return(0);
+	}
+	
+	return(1);
+}
+
+/*
+ * Find the first delimiter in len bytes of data, such as "\r\n" for IRC
+ * or "\n\n" for FreeSWITCH events. Data does not need to be NUL
+ * terminated. A delimiter cut off by the end of data counts as found, so
+ * the caller can check whether the rest of it arrives, or has arrived
+ * elsewhere as with a ring buffer that wraps.
+ * Return value:
+ *   Returns the offset of the delimiter, or FRAMER_NPOS if there is none.
+ */
+size_t
+framer_scan(const char *data, size_t len, const char *delim, size_t delim_len)
+{
+	const char *hit;
+	size_t pos = 0;
+	
+	if(data == NULL || delim == NULL || delim_len == 0)
+		return(FRAMER_NPOS);
+	
+	/* The C library's memchr() is already vectorized, let it skip ahead. */
+	while(pos < len)
+	{
+		if((hit = memchr(data+pos, delim[0], len-pos)) == NULL)
+			break;
+		
+		pos = hit-data;
+		if(framer_match(data, len, pos, delim, delim_len))
+			return(pos);
+		pos++;
+	}
+	
+	return(FRAMER_NPOS);
+}
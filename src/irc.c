@@ -27,27 +27,199 @@
  */
 
 #include "global.h"
+#include "config_file.h"
 #include "irc.h"
+#include "command.h"
+#include "irc_msg.h"
 #include "mod_so.h"
 
+#include <openssl/evp.h>
 #include <openssl/rand.h>
 
+#include <ctype.h>
+#include <sys/time.h>
 
+
+static inline u_int irc_verb_hash(const char *name);
+static int irc_tags(const struct irc_msg *msg);
+static int irc_hooks_run(int code, const struct irc_msg *msg);
+static int irc_ping(const struct irc_msg *msg);
+static int irc_pong(const struct irc_msg *msg);
+static int irc_cap(const struct irc_msg *msg);
+static int irc_list_has(const char *list, size_t len, const char *item);
+static void irc_cap_end(void);
+static const char *irc_sasl_mech(const struct bot_in *bot_t);
+static int irc_sasl(const struct irc_msg *msg);
+static int irc_sasl_done(const struct irc_msg *msg);
+static int irc_isupport(const struct irc_msg *msg);
+static int irc_welcome(const struct irc_msg *msg);
+static int irc_nick_taken(const struct irc_msg *msg);
+static int irc_motd_end(const struct irc_msg *msg);
+static int irc_nickserv(const struct irc_msg *msg);
+static int irc_error(const struct irc_msg *msg);
 static void irc_respond(const char *from, const char *to,
 						const char *command, const char *mesg);
+static void irc_cmd_conf(const struct command_call *call);
+static void irc_cmd_lag(const struct command_call *call);
+static void irc_cmd_join(const struct command_call *call);
+static void irc_cmd_part(const struct command_call *call);
+static void irc_cmd_say(const struct command_call *call);
+static void irc_cmd_me(const struct command_call *call);
+static void irc_cmd_nick(const struct command_call *call);
+static void irc_cmd_raw(const struct command_call *call);
+static void irc_cmd_quit(const struct command_call *call);
+static void irc_cmd_reconnect(const struct command_call *call);
+static void irc_cmd_spawn(const struct command_call *call);
+static void irc_cmd_load(const struct command_call *call);
+static void irc_cmd_unload(const struct command_call *call);
+
+/* The commands every bot understands, modules can add their own. */
+static const struct
+{
+	const char *name;
+	int level;
+	u_int min_args;
+	u_int max_args;
+	void (*handler)(const struct command_call *call);
+} irc_commands[] = {
+	{"conf", COMMAND_USER, 0, 1, irc_cmd_conf},
+	{"lag", COMMAND_ADMIN, 0, 0, irc_cmd_lag},
+	{"join", COMMAND_ADMIN, 1, 1, irc_cmd_join},
+	{"part", COMMAND_ADMIN, 1, 1, irc_cmd_part},
+	{"say", COMMAND_ADMIN, 1, 2, irc_cmd_say},
+	{"me", COMMAND_ADMIN, 1, 2, irc_cmd_me},
+	{"nick", COMMAND_ADMIN, 1, 1, irc_cmd_nick},
+	{"raw", COMMAND_ADMIN, 1, 1, irc_cmd_raw},
+	{"quit", COMMAND_ADMIN, 0, 1, irc_cmd_quit},
+	{"reconnect", COMMAND_ADMIN, 0, 1, irc_cmd_reconnect},
+	{"spawn", COMMAND_ADMIN, 1, 1, irc_cmd_spawn},
+	{"load", COMMAND_ADMIN, 1, 1, irc_cmd_load},
+	{"unload", COMMAND_ADMIN, 1, 1, irc_cmd_unload},
+	{NULL, 0, 0, 0, NULL}
+};
+
+/* Names of the verbs, in the same order as their codes. */
+static const char *const irc_verbs[] = {
+#define IRC_VERB_NAME(name) #name,
+	IRC_VERBS(IRC_VERB_NAME)
+#undef IRC_VERB_NAME
+};
+
+/* Verbs by a hash of their name, as an index into irc_verbs plus one. */
+#define IRC_VERB_SLOTS	64
+static u_char irc_verb_slots[IRC_VERB_SLOTS];
+
+/* What the core does with a line, found by its code. */
+static int (*const irc_core[IRC_CODES])(const struct irc_msg *msg) = {
+	[IRC_RPL_WELCOME] = irc_welcome,
+	[IRC_RPL_ISUPPORT] = irc_isupport,
+	[IRC_RPL_ENDOFMOTD] = irc_motd_end,
+	[IRC_ERR_NOMOTD] = irc_motd_end,
+	[IRC_ERR_NICKNAMEINUSE] = irc_nick_taken,
+	[IRC_ERR_NICKLOCKED] = irc_sasl_done,
+	[IRC_RPL_SASLSUCCESS] = irc_sasl_done,
+	[IRC_ERR_SASLFAIL] = irc_sasl_done,
+	[IRC_ERR_SASLTOOLONG] = irc_sasl_done,
+	[IRC_ERR_SASLABORTED] = irc_sasl_done,
+	[IRC_ERR_SASLALREADY] = irc_sasl_done,
+	[IRC_VERB_AUTHENTICATE] = irc_sasl,
+	[IRC_VERB_CAP] = irc_cap,
+	[IRC_VERB_ERROR] = irc_error,
+	[IRC_VERB_NOTICE] = irc_nickserv,
+	[IRC_VERB_PING] = irc_ping,
+	[IRC_VERB_PONG] = irc_pong
+};
+
+/* Whatever modules asked to see, by code. */
+static struct irc_hook_in *irc_hooks[IRC_CODES];
+static pthread_mutex_t mtx_hooks = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Register the core bot commands.
+ * Return value:
+ *   Returns 0 on success and -1 on failure.
+ */
+int
+irc_init(void)
+{
+	int i;
+	u_int slot;
+	
+	/* Keep the table sparse so a lookup rarely probes more than once. */
+	if(sizeof(irc_verbs)/sizeof(*irc_verbs) > IRC_VERB_SLOTS/2)
+		return(-1);
+	
+	for(i = 0; i < (int)(sizeof(irc_verbs)/sizeof(*irc_verbs)); i++)
+	{
+		for(slot = irc_verb_hash(irc_verbs[i]); irc_verb_slots[slot] != 0;
+			slot = (slot+1) & (IRC_VERB_SLOTS-1));
+		irc_verb_slots[slot] = i+1;
+	}
+	
+	for(i = 0; irc_commands[i].name != NULL; i++)
+	{
+		if(command_register(NULL, irc_commands[i].name, irc_commands[i].level,
+							irc_commands[i].min_args, irc_commands[i].max_args,
+							irc_commands[i].handler) != 0)
+			return(-1);
+	}
+	
+	return(0);
+}
 
 
 /*
- * Connect to IRC.
+ * Start connecting a bot to its current IRC server. The callback is run
+ * on the bot's reactor once the connection is up or has failed.
  * Return value:
  *   Returns 0 on success and -1 on failure.
  */
 int
-irc_connect(struct socket_in **s, const char *host, const char *port, int ssl)
+irc_connect(struct bot_in *bot_t, void (*callback)(struct socket_in *, int, void *))
 {
+	const char *port = (bot_t->irc_port != NULL ? bot_t->irc_port : IRC_DEFAULT_PORT);
+	struct server_list *server = bot_t->irc_server;
+	
+	if(server == NULL)
+	{
+		fprintf(stderr, "[ERROR] irc_connect(): No irc_host configured for %s.\n",
+				bot_t->irc_nick);
+		return(-1);
+	}
+	
 	/* Create our IRC socket. */
-	if(socket_create(s, host, port, (ssl == 0 ? 0 : 1)) == -1)
-		exit(-1);
+	return(socket_connect(bot_t->reactor, server->host,
+						  (server->port != NULL ? server->port : port),
+						  (bot_t->irc_ssl == 0 ? 0 : 1), config_global.connect_timeout*1000,
+						  (struct sockaddr *)&bot_t->irc_addr, bot_t->irc_addrlen,
+						  callback, bot_t));
+}
+
+/*
+ * Send our registration as soon as the connection is up. CAP LS holds the
+ * registration open on servers that know it, so whatever we learn from it
+ * can still be used before we are let in.
+ * Return value:
+ *   Returns 0 on success and -1 on failure.
+ */
+int
+irc_register(void)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	bot_t->bot_status = (bot_t->bot_status & ~BOT_STATUS_RUNNING)|BOT_STATUS_STARTING;
+	bot_t->irc_caps = 0;
+	bot_t->irc_cap_pending = 1;
+	bot_t->irc_authed = 0;
+	
+	if(irc_cmd(IRC_CAP, "LS 302", NULL) != 0)
+		return(-1);
+	
+	if(bot_t->irc_pass != NULL)
+		irc_cmd(IRC_PASS, bot_t->irc_pass, NULL);
+	irc_cmd(IRC_USER, bot_t->irc_user, bot_t->irc_name);
+	irc_cmd(IRC_NICK, bot_t->irc_nick, NULL);
 	
 	return(0);
 }
@@ -58,94 +230,41 @@ irc_connect(struct socket_in **s, const char *host, const char *port, int ssl)
  *   Returns -1 if the bot quit and should reconnect, otherwise 0.
  */
 int
-irc_parse(const char *buf)
+irc_parse(char *buf)
 {
+	const char *to, *mesg;
+	int ret;
+	struct irc_msg msg;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
 	/* Add verbose output. */
 	vout(2, VOUT_FLOW_INBOUND, "IRC", buf);
 	
-	/* Respond to PING with a PONG. */
-	if(strncmp(buf, "PING :", 6) == 0)
-	{
-		irc_cmd(IRC_PONG, buf+6, NULL);
+	/* Split the line where it lies, it is no use to us after this anyway. */
+	if(irc_msg_parse(buf, &msg) != 0)
 		return(0);
-	}
 	
+	/* Something we have already seen, replayed or echoed twice. */
+	if(msg.ntags > 0 && irc_tags(&msg) != 0)
+		return(0);
 	
-	/* Split message into workable parts. */
-	{
-		int reg_err;
-		size_t len;
-		size_t num = irc_mesg_re.re_nsub+1;
-		regmatch_t *preg = calloc(num, sizeof(*preg));
-		char *from, *command, *to, *mesg;
-		
-		if((reg_err = regexec(&irc_mesg_re, buf, num, preg, 0)) != 0 && reg_err != REG_NOMATCH)
-		{
-			/* XXX Add error checking... */
-			return(-1);
-		}
-		
-		else if(reg_err == 0)
-		{
-			/* Get fields of the IRC message. */
-			len = preg[1].rm_eo-preg[1].rm_so;
-			if((from = malloc(sizeof(*from)*(len+1))) == NULL)
-				goto no_mem_free_from;
-			strncpy(from, buf+preg[1].rm_so, len);
-			from[len] = '\0';
-			
-			len = preg[2].rm_eo-preg[2].rm_so;
-			if((command = malloc(sizeof(*command)*(len+1))) == NULL)
-				goto no_mem_free_command;
-			strncpy(command, buf+preg[2].rm_so, len);
-			command[len] = '\0';
-			
-			len = preg[3].rm_eo-preg[3].rm_so;
-			if((to = malloc(sizeof(*to)*(len+1))) == NULL)
-				goto no_mem_free_to;
-			strncpy(to, buf+preg[3].rm_so, len);
-			to[len] = '\0';
-			
-			len = preg[4].rm_eo-preg[4].rm_so;
-			if((mesg = malloc(sizeof(*mesg)*(len+1))) == NULL)
-				goto no_mem_free_mesg;
-			strncpy(mesg, buf+preg[4].rm_so, len);
-			mesg[len] = '\0';
-			
-			/* Send message off to be handled (or not) by irc_response(). */
-			irc_respond(from, to, command, mesg);
-			
-			
-			/* Free our memory and return. */
-			no_mem_free_mesg:
-				free(mesg);
-			no_mem_free_to:
-				free(to);
-			no_mem_free_command:
-				free(command);
-			no_mem_free_from:
-				free(from);
-			
-			return(0);
-		}
-	}
-
-	/* Cleanup socket if it dies on us. */
-	if(strncasecmp(buf, "ERROR :Closing Link:", 20) == 0)
+	/* The command is looked at once, everything after goes by its code. */
+	msg.code = irc_code(msg.command.s_data);
+	if(irc_core[msg.code] != NULL && (ret = irc_core[msg.code](&msg)) != IRC_NEXT)
+		return(ret == IRC_DONE ? 0 : ret);
+	
+	if(irc_hooks_run(msg.code, &msg) == MOD_EAT_ALL)
+		return(0);
+	
+	/* Anyone talking to us, or the server telling us something. */
+	if(msg.prefix.s_len > 0 && msg.nparams > 0)
 	{
-		/* We are going to need our bot info for this one... */
-		struct bot_in *bot_t = pthread_getspecific(bot);
+		to = (msg.nparams > 1 ? msg.params[msg.nparams-2].s_data : "");
+		mesg = msg.params[msg.nparams-1].s_data;
 		
-		if(bot_t->bot_status & BOT_STATUS_RESTARTING)
-		{
-			bot_t->bot_status = (bot_t->bot_status & ~BOT_STATUS_RESTARTING)|
-								BOT_STATUS_STARTING;
-			return(E_RECONN);
-		}
-		else if(strstr(buf, "(Throttled: Reconnecting too fast)") != NULL)
-			return(E_REWAIT);
-		else if(bot_t->bot_status & BOT_STATUS_QUITTING)
-			return(E_NONE);
+		/* Send message off to be handled (or not) by irc_response(). */
+		irc_respond(msg.prefix.s_data, to, msg.command.s_data, mesg);
+		bot_t->irc_out_class = SCHED_BULK;
 	}
 	
 	return(0);
@@ -161,23 +280,32 @@ int
 irc_cmd(int type, const char *arg1, const char *arg2)
 {
 	char send_buf[513];
+	const char *target = NULL;
 	struct bot_in *bot_t = pthread_getspecific(bot);
-	struct socket_in *irc_t = pthread_getspecific(irc_s);
+	int class = bot_t->irc_out_class;
 	
 	/* Get the correct type of message to send. */
 	switch(type)
 	{
+		case IRC_PING:
+			snprintf(send_buf, 512, "PING :%s\r\n", arg1);
+			class = SCHED_URGENT;
+			break;
 		case IRC_PONG:
 			snprintf(send_buf, 512, "PONG :%s\r\n", arg1);
+			class = SCHED_URGENT;
 			break;
 		case IRC_PRIVMSG:
 			snprintf(send_buf, 512, "PRIVMSG %s :%s\r\n", arg1, arg2);
+			target = arg1;
 			break;
 		case IRC_ACTION:
 			snprintf(send_buf, 512, "PRIVMSG %s :\1ACTION %s\1\r\n", arg1, arg2);
+			target = arg1;
 			break;
 		case IRC_NOTICE:
 			snprintf(send_buf, 512, "NOTICE %s :%s\r\n", arg1, arg2);
+			target = arg1;
 			break;
 		case IRC_JOIN:
 			snprintf(send_buf, 512, "JOIN %s\r\n", arg1);
@@ -189,29 +317,49 @@ irc_cmd(int type, const char *arg1, const char *arg2)
 			break;
 		case IRC_NICK:
 			snprintf(send_buf, 512, "NICK %s\r\n", arg1);
+			if(bot_t->bot_status & BOT_STATUS_STARTING)
+				class = SCHED_URGENT;
 			break;
 		case IRC_MODE:
 			snprintf(send_buf, 512, "MODE %s :%s\r\n", arg1, arg2);
 			break;
 		case IRC_NICKSERV:
 			snprintf(send_buf, 512, "PRIVMSG NickServ :%s %s\r\n", arg1, arg2);
+			class = SCHED_URGENT;
 			break;
 		case IRC_USER:
 			snprintf(send_buf, 512, "USER %s * 8 :%s\r\n", arg1, (arg2 == NULL ? BOT_VERSION_STRING : arg2));
+			class = SCHED_URGENT;
 			break;
 		case IRC_QUIT:
 			bot_t->bot_status |= BOT_STATUS_QUITTING;
 			snprintf(send_buf, 512, "QUIT :%s\r\n", arg1);
+			class = SCHED_URGENT;
 			break;
 		case IRC_RAW:
 			snprintf(send_buf, 512, "%s\r\n", arg1);
 			break;
+		case IRC_CAP:
+			if(arg2 != NULL)
+				snprintf(send_buf, 512, "CAP %s :%s\r\n", arg1, arg2);
+			else
+				snprintf(send_buf, 512, "CAP %s\r\n", arg1);
+			class = SCHED_URGENT;
+			break;
+		case IRC_PASS:
+			snprintf(send_buf, 512, "PASS %s\r\n", arg1);
+			class = SCHED_URGENT;
+			break;
+		case IRC_AUTHENTICATE:
+			snprintf(send_buf, 512, "AUTHENTICATE %s\r\n", arg1);
+			class = SCHED_URGENT;
+			break;
 		default:
 			return(-1);
 	}
 	
-	/* Send off our command. */
-	socket_send(irc_t, send_buf);
+	/* Queue our command, the scheduler paces it out to the server. */
+	sched_push(&bot_t->irc_out, class, target, send_buf);
 	
 	/* Send verbose output. */
 	send_buf[strlen(send_buf)-2] = '\0';
@@ -244,296 +392,960 @@ irc_is_admin(const char *ident)
 	return(-1);
 }
 
+/*
+ * Hash a verb without regard to case.
+ * Return value:
+ *   The verb's slot in irc_verb_slots.
+ */
+static inline u_int
+irc_verb_hash(const char *name)
+{
+	u_int hash = 2166136261U;
+	
+	for(; *name != '\0'; name++)
+		hash = (hash^(u_char)toupper((u_char)*name))*16777619U;
+	
+	return(hash & (IRC_VERB_SLOTS-1));
+}
 
 /*
- * Send responses to the IRC server--if any are required.
+ * Work out the code for a command, which is the number of a numeric or
+ * IRC_VERB_BASE onwards for one of IRC_VERBS.
  * Return value:
- *   None.
+ *   The command's code, or IRC_UNKNOWN if we have no name for it.
  */
-static void
-irc_respond(const char *from, const char *to, const char *command, const char *mesg)
+int
+irc_code(const char *command)
 {
-	struct bot_in *bot_t = pthread_getspecific(bot);
+	u_int slot;
 	
-	/* Sanity checking. */
-	if(bot_t == NULL || from == NULL || to == NULL ||
-	   command == NULL || mesg == NULL)
-		return;
+	if(isdigit((unsigned char)command[0]) && isdigit((unsigned char)command[1]) &&
+	   isdigit((unsigned char)command[2]) && command[3] == '\0')
+	{
+		return((command[0]-'0')*100+(command[1]-'0')*10+(command[2]-'0'));
+	}
 	
-	/* Give our modules the first chance to hook some functions. */
-	if(mod_irc_callback(from, to, command, mesg) == MOD_EAT_ALL)
-		return;
+	for(slot = irc_verb_hash(command); irc_verb_slots[slot] != 0;
+		slot = (slot+1) & (IRC_VERB_SLOTS-1))
+	{
+		if(strcasecmp(command, irc_verbs[irc_verb_slots[slot]-1]) == 0)
+			return(IRC_VERB_BASE+irc_verb_slots[slot]);
+	}
+	
+	return(IRC_UNKNOWN);
+}
+
+/*
+ * Have a handler see every line with the given code, after the core has
+ * had its look. A handler returning MOD_EAT_ALL keeps the line from any
+ * hooks after it, module callbacks and commands. Modules pass their
+ * mod_object as owner, so they can be cleaned up.
+ * Return value:
+ *   Returns 0 on success or -1 on error.
+ */
+int
+irc_hook(const void *owner, int code, int (*handler)(const struct irc_msg *msg))
+{
+	int count = 0;
+	struct irc_hook_in *hook, **link;
 	
+	if(code < 0 || code >= IRC_CODES || handler == NULL)
+		return(-1);
 	
-	/* Check if there is a command to be run. */
-	if(strncmp(mesg, COMMAND_PREFIX, strlen(COMMAND_PREFIX)) == 0)
+	if((hook = calloc(1, sizeof(*hook))) == NULL)
+		return(-1);
+	hook->handler = handler;
+	hook->owner = owner;
+	
+	/* Hooks run in the order they were added. */
+	pthread_mutex_lock(&mtx_hooks);
+	for(link = &irc_hooks[code]; *link != NULL; link = &(*link)->next)
+		count++;
+	
+	if(count >= IRC_HOOKMAX)
 	{
-		mesg += strlen(COMMAND_PREFIX);
-		
-		/* User commands first, or something like that. */
-		if(strncasecmp(mesg, "conf", 4) == 0)
-		{
-			/* Get the first argument. */
-			int i = 0;
-			for(; i++ < 5 && *(mesg+1) != '\0'; mesg++);
-			
-			if(strcasecmp(mesg, "list") == 0)
-			{
-				/*
-				 * XXX Will implement soon...
-				 * fs_api_call(FS_CONFLIST, NULL, NULL);
-				 */
-				irc_cmd(IRC_PRIVMSG, to, "Coming soon!");
-			}
-			return;
-		}
-		
-		
-		/* If it was a join request, chck if it came from an admin. */
-		if(strncasecmp(mesg, "join ", 5) == 0 && irc_is_admin(from) == 0)
-		{
-			if(strlen(mesg) > 5)
-				irc_cmd(IRC_JOIN, mesg+5, NULL);
-			return;
-		}
-		
-		/* If it was a join request, chck if it came from an admin. */
-		if(strncasecmp(mesg, "part ", 5) == 0 && irc_is_admin(from) == 0)
-		{
-			if(strlen(mesg) > 5)
-				irc_cmd(IRC_PART, mesg+5, NULL);
-			return;
-		}
-		
-		/* If it was a privmsg request, chck if it came from an admin. */
-		if(strncasecmp(mesg, "say ", 4) == 0 && irc_is_admin(from) == 0)
+		pthread_mutex_unlock(&mtx_hooks);
+		free(hook);
+		return(-1);
+	}
+	*link = hook;
+	pthread_mutex_unlock(&mtx_hooks);
+	
+	return(0);
+}
+
+/*
+ * Remove every hook an owner added, before a module goes away.
+ * Return value:
+ *   None.
+ */
+void
+irc_unhook(const void *owner)
+{
+	int i;
+	struct irc_hook_in **link, *hook;
+	
+	pthread_mutex_lock(&mtx_hooks);
+	for(i = 0; i < IRC_CODES; i++)
+	{
+		for(link = &irc_hooks[i]; (hook = *link) != NULL;)
 		{
-			if(strlen(mesg) > 4)
+			if(hook->owner != owner)
 			{
-				mesg += 4;
-				if(*mesg == '#')
-				{
-					size_t chan_len = (strchr(mesg, ' ')-mesg)+1;
-					char *chan = calloc(chan_len, sizeof(*chan));
-					
-					strncpy(chan, mesg, chan_len-1);
-					chan[chan_len] = '\0';
-					
-					irc_cmd(IRC_PRIVMSG, chan, mesg+chan_len);
-					free(chan);
-				}
-				else if(*to == '#')
-					irc_cmd(IRC_PRIVMSG, to, mesg);
+				link = &hook->next;
+				continue;
 			}
-			return;
+			
+			*link = hook->next;
+			free(hook);
 		}
-		
-		/* If it was an action request, chck if it came from an admin. */
-		if(strncasecmp(mesg, "me ", 3) == 0 && irc_is_admin(from) == 0)
+	}
+	pthread_mutex_unlock(&mtx_hooks);
+}
+
+
+/*
+ * Act on the IRCv3 tags we know. A server-time stamp tells us how long
+ * the message took to reach us, unless it was played back from history.
+ * A msgid we have seen before means the message is a repeat.
+ * Return value:
+ *   Returns -1 if the message is a repeat, otherwise 0.
+ */
+static int
+irc_tags(const struct irc_msg *msg)
+{
+	char value[64];
+	int ms = 0, end = 0;
+	uint64_t hash;
+	size_t i;
+	struct tm tm;
+	struct timeval now;
+	const struct irc_tag *tag;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if((tag = irc_msg_tag(msg, "time")) != NULL && irc_msg_tag(msg, "batch") == NULL &&
+	   irc_msg_tag_value(tag, value, sizeof(value)) > 0)
+	{
+		memset(&tm, 0, sizeof(tm));
+		if(sscanf(value, "%4d-%2d-%2dT%2d:%2d:%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+				  &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &end) == 6 && end > 0)
 		{
-			if(strlen(mesg) > 4)
+			int scale;
+			int64_t delay;
+			const char *p = value+end;
+			
+			/* Any number of fraction digits, ".5" is 500ms not 5ms. */
+			if(*p == '.')
 			{
-				mesg += 3;
-				if(*mesg == '#')
-				{
-					size_t chan_len = (strchr(mesg, ' ')-mesg)+1;
-					char *chan = calloc(chan_len, sizeof(*chan));
-					
-					strncpy(chan, mesg, chan_len-1);
-					chan[chan_len] = '\0';
-					
-					irc_cmd(IRC_ACTION, chan, mesg+chan_len);
-					free(chan);
-				}
-				else if(*to == '#')
-					irc_cmd(IRC_ACTION, to, mesg);
+				for(p++, scale = 100; *p >= '0' && *p <= '9'; p++, scale /= 10)
+					ms += (*p-'0')*scale;
 			}
-			return;
-		}
-		
-		/* If it was a nick change request, check if it came from an admin. */
-		if(strncasecmp(mesg, "nick ", 5) == 0 && irc_is_admin(from) == 0)
-		{
-			if(strlen(mesg) > 5)
-				irc_cmd(IRC_NICK, mesg+5, NULL);
-			return;
-		}
-		
-		/* If it was a raw IRC request, check if it came from an admin. */
-		if(strncasecmp(mesg, "raw ", 4) == 0 && irc_is_admin(from) == 0)
-		{
-			if(strlen(mesg) > 4)
-				irc_cmd(IRC_RAW, mesg+4, NULL);
-			return;
-		}
-		
-		/* If it was a quit request, check if it came from an admin. */
-		if(strncasecmp(mesg, "quit", 4) == 0 && irc_is_admin(from) == 0)
-		{
-			irc_cmd(IRC_QUIT, (strlen(mesg) > 5 ? mesg+5 : BOT_VERSION_STRING), NULL);
-			return;
-		}
-		
-		/* If it was a restart request, check if it came from an admin. */
-		if(strncasecmp(mesg, "reconnect", 9) == 0 && irc_is_admin(from) == 0)
-		{
-			irc_cmd(IRC_QUIT, (strlen(mesg) > 9 ? mesg+9 : BOT_VERSION_STRING), NULL);
-			bot_t->bot_status |= BOT_STATUS_RESTARTING;
-			return;
-		}
-		
-		/* If it was a spawn request, check if it came from an admin. */
-		if(strncasecmp(mesg, "spawn", 5) == 0 && irc_is_admin(from) == 0)
-		{
-			size_t s_len = strlen(mesg+6);
-			char *n_nick;
-			struct bot_in *n_bot;
-			
-			n_nick = calloc(s_len+1, sizeof(*n_nick));
-			strncpy(n_nick, mesg+6, s_len);
-			n_nick[s_len] = 0;
-			
-			/* Copy our bot config and make changes as nessesary. */
-			n_bot = bot_clone_config(bot_t);
-			if(n_bot->irc_nick != NULL)
-				free(n_bot->irc_nick);
-			
-			n_bot->irc_nick = n_nick;
 			
-			/* Start our new thread. */
-			bot_spawn(n_bot);
+			tm.tm_year -= 1900;
+			tm.tm_mon--;
+			gettimeofday(&now, NULL);
+			delay = ((int64_t)now.tv_sec-timegm(&tm))*1000+now.tv_usec/1000-ms;
 			
-			return;
-		}
-		
-		/* Loading and unloading modules... this is a first. */
-		if(strncasecmp(mesg, "load ", 5) == 0 && irc_is_admin(from) == 0)
-		{
-			if(strlen(mesg) > 5)
-				mod_load((char *)mesg+5);
-			
-			return;
+			/* Our clocks can disagree a little, that isn't a negative delay. */
+			bot_t->irc_delay = (delay < 0 ? 0 : (delay > INT_MAX ? INT_MAX : delay));
 		}
+	}
+	
+	/* IDs are only compared, so FNV-1a of the escaped form does. */
+	if((tag = irc_msg_tag(msg, "msgid")) != NULL && tag->value.s_len > 0)
+	{
+		hash = 14695981039346656037ULL;
+		for(i = 0; i < tag->value.s_len; i++)
+			hash = (hash^(unsigned char)tag->value.s_data[i])*1099511628211ULL;
+		if(hash == 0)
+			hash = 1;
 		
-		if(strncasecmp(mesg, "unload ", 7) == 0 && irc_is_admin(from) == 0)
+		for(i = 0; i < BOT_MSGIDS; i++)
 		{
-			if(strlen(mesg) < 8)
-				return;
-			
-			mod_unload(mesg+7);
-			
-			return;
+			if(bot_t->irc_msgids[i] == hash)
+				return(-1);
 		}
+		bot_t->irc_msgids[bot_t->irc_msgid_next++%BOT_MSGIDS] = hash;
 	}
 	
+	return(0);
+}
+
+/*
+ * Run the hooks for a code. The handlers are copied out first, so they
+ * are free to add hooks of their own, and their modules are held so an
+ * unload can't close them while they run.
+ * Return value:
+ *   Returns MOD_EAT_ALL if a hook ate the line, otherwise MOD_EAT_NONE.
+ */
+static int
+irc_hooks_run(int code, const struct irc_msg *msg)
+{
+	int (*handlers[IRC_HOOKMAX])(const struct irc_msg *msg);
+	const void *owners[IRC_HOOKMAX];
+	int i, count = 0, eat = MOD_EAT_NONE;
+	struct irc_hook_in *hook;
+	
+	pthread_mutex_lock(&mtx_hooks);
+	for(hook = irc_hooks[code]; hook != NULL; hook = hook->next)
+	{
+		handlers[count] = hook->handler;
+		owners[count] = hook->owner;
+		mod_hold(owners[count++]);
+	}
+	pthread_mutex_unlock(&mtx_hooks);
 	
-	/* If our chosen nick is taken, create a new nick based on our old one. */
-	if(strcmp(command, "433") == 0)
+	for(i = 0; i < count; i++)
 	{
-		size_t nick_len = strlen(bot_t->irc_nick)+5;
-#ifdef OPENSSL_ENABLED
-		unsigned char rand_buf[2];
-		RAND_bytes(rand_buf, 2);
-#else
-		int rand_buf[2];
-		
-		/*
-		 * XXX Not even hardly psuedo-random, but doesn't need to be--I guess. I mean
-		 * its not like two truely psuedo-random (or even random) bytes can produce much
-		 * random data at only 2(2^8) bits. Long story short This isn't of any interest
-		 * to me, but feel free to fix it if you start loosing sleep over it.
-		 */
-		srand(time(NULL)%65530);
-		rand_buf[0] = rand();
-		rand_buf[1] = rand();
-#endif /* OPENSSL_ENABLED */
-		
-		bot_t->irc_nick_temp = calloc(nick_len, sizeof(char));
-		snprintf(bot_t->irc_nick_temp, nick_len, "%s%02x%02x", bot_t->irc_nick,
-				 rand_buf[0], rand_buf[1]);
-		bot_t->irc_nick_temp[nick_len] = '\0';
-		
-		irc_cmd(IRC_NICK, bot_t->irc_nick_temp, NULL);
+		if(eat != MOD_EAT_ALL && handlers[i](msg) == MOD_EAT_ALL)
+			eat = MOD_EAT_ALL;
+		mod_release(owners[i]);
 	}
 	
-	/*
-	 * Check if we must idnet...
-	 */
-	if(strncmp(from, "NickServ!", 9) == 0 && strcmp(command, "NOTICE") == 0)
+	return(eat);
+}
+
+/*
+ * Respond to PING with a PONG.
+ * Return value:
+ *   Returns IRC_DONE.
+ */
+static int
+irc_ping(const struct irc_msg *msg)
+{
+	irc_cmd(IRC_PONG, (msg->nparams > 0 ? msg->params[0].s_data : ""), NULL);
+	return(IRC_DONE);
+}
+
+/*
+ * Take the answer to one of our lag probes, the token holds when we sent
+ * it. Any other PONG is left for whoever asked.
+ * Return value:
+ *   Returns IRC_DONE for our own probes, otherwise IRC_NEXT.
+ */
+static int
+irc_pong(const struct irc_msg *msg)
+{
+	const char *mesg;
+	uint64_t sent;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(msg->nparams == 0)
+		return(IRC_NEXT);
+	
+	mesg = msg->params[msg->nparams-1].s_data;
+	if(strncmp(mesg, IRC_LAG_TOKEN, strlen(IRC_LAG_TOKEN)) != 0)
+		return(IRC_NEXT);
+	
+	sent = strtoull(mesg+strlen(IRC_LAG_TOKEN), NULL, 10);
+	if(sent != 0 && sent == bot_t->irc_ping_sent)
 	{
-		if(strncmp(mesg, "This nickname is registered", 27) == 0 &&
-		   bot_t->irc_nspass != NULL)
-		{
-			irc_cmd(IRC_NICKSERV, "IDENTIFY", bot_t->irc_nspass);
-		}
+		char metric[64];
 		
-		/* NickServ freed up our nick for us so take it back. */
-		else if(strcmp(mesg, "Ghost with your nick has been killed.") == 0)
-		{
-			irc_cmd(IRC_NICK, bot_t->irc_nick, NULL);
-			free(bot_t->irc_nick_temp);
-			bot_t->irc_nick_temp = NULL;
-		}
+		bot_t->irc_lag = reactor_time()-sent;
+		bot_t->irc_ping_sent = 0;
 		
-		return;
+		/* One key=value line per probe, for whatever watches our output. */
+		snprintf(metric, sizeof(metric), "bot=%u lag_ms=%d delay_ms=%d",
+				 bot_t->bot_id, bot_t->irc_lag, bot_t->irc_delay);
+		vout(1, VOUT_FLOW_NONE, "LAG", metric);
 	}
 	
-	/* End of MOTD, send our initial commands. */
-	if(strcmp(command, "376") == 0 || strcmp(command, "422") == 0)
+	return(IRC_DONE);
+}
+
+/*
+ * Handle the server's side of capability negotiation. Every LS line gets
+ * a REQ for the capabilities we use, and once nothing is outstanding,
+ * SASL included, CAP END lets registration finish.
+ * Return value:
+ *   Returns IRC_DONE.
+ */
+static int
+irc_cap(const struct irc_msg *msg)
+{
+	static const struct
+	{
+		const char *name;
+		int flag;
+	} caps[] = {
+		{"multi-prefix", IRC_CAP_MULTIPREFIX},
+		{"sasl", IRC_CAP_SASL},
+		{"server-time", IRC_CAP_SERVERTIME},
+		{"message-tags", IRC_CAP_MESSAGETAGS},
+		{NULL, 0}
+	};
+	char req[128];
+	const char *mech, *list, *sub;
+	size_t i, len, name_len, req_len = 0;
+	int more;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	/* Our nick, which is still * this early on, then what this is about. */
+	if(msg->nparams < 3)
+		return(IRC_DONE);
+	sub = msg->params[1].s_data;
+	list = msg->params[msg->nparams-1].s_data;
+	
+	/* A * before the list means another line follows. */
+	more = (msg->nparams > 3 && strcmp(msg->params[2].s_data, "*") == 0);
+	
+	if(strcmp(sub, "LS") == 0)
 	{
-		char *bnick = (bot_t->irc_nick_temp != NULL ? bot_t->irc_nick_temp : bot_t->irc_nick);
-		struct chan_list *clist;
+		mech = irc_sasl_mech(bot_t);
 		
-		/* If we think we own the nick, then try to take it over. */
-		if(bot_t->irc_nick_temp != NULL)
+		for(; *list != '\0'; list += len, list += strspn(list, " "))
 		{
-			if(bot_t->irc_nspass != NULL)
+			len = strcspn(list, " ");
+			name_len = strcspn(list, "= ");
+			
+			for(i = 0; caps[i].name != NULL; i++)
 			{
-				size_t buf_len = strlen(bot_t->irc_nick)+strlen(bot_t->irc_nspass)+3;
-				char *buf = calloc(buf_len, sizeof(*buf));
-				
-				snprintf(buf, buf_len-1, "%s %s", bot_t->irc_nick, bot_t->irc_nspass);
-				irc_cmd(IRC_NICKSERV, "GHOST", buf);
+				if(strlen(caps[i].name) != name_len || strncmp(list, caps[i].name, name_len) != 0)
+					continue;
 				
-				free(buf);
-			}
-			else
-			{
-				free(bot_t->irc_nick);
-				bot_t->irc_nick = bot_t->irc_nick_temp;
+				/* Only ask for SASL if the server takes our mechanism. */
+				if(caps[i].flag == IRC_CAP_SASL &&
+				   (mech == NULL || (list[name_len] == '=' &&
+									 irc_list_has(list+name_len+1, len-name_len-1, mech) == 0)))
+					break;
 				
-				/* Set temp nick to NULL since it isn't very 'temp' anymore. */
-				bot_t->irc_nick_temp = NULL;
+				if(req_len+name_len+2 < sizeof(req))
+				{
+					req_len += snprintf(req+req_len, sizeof(req)-req_len, "%s%s",
+										(req_len > 0 ? " " : ""), caps[i].name);
+				}
+				break;
 			}
 		}
 		
-		/* If we have a NickServ password... then use it. */
-		if(bot_t->irc_nspass != NULL)
-			irc_cmd(IRC_NICKSERV, "IDENTIFY", bot_t->irc_nspass);
-		
-		irc_cmd(IRC_MODE, bnick, IRC_DEFAULT_MODES);
-		
-		/* Join all our channels. */
-		for(clist = bot_t->irc_channels;
-			clist != NULL;
-			clist = clist->next)
+		if(req_len > 0)
 		{
-			irc_cmd(IRC_JOIN, clist->name, NULL);
+			bot_t->irc_cap_pending++;
+			irc_cmd(IRC_CAP, "REQ", req);
 		}
 		
-		bot_t->bot_status = (bot_t->bot_status & ~BOT_STATUS_STARTING)|
-							BOT_STATUS_RUNNING;
-		
-		return;
+		if(more == 0)
+			irc_cap_end();
 	}
-	
-	/* Check if we are connected to the server. */
-	if(strcasecmp(to, "AUTH") == 0 &&
-	   (strstr(mesg, "Found your hostname") != NULL ||
-		strstr(mesg, "Couldn't resolve your hostname") != NULL))
+	else if(strcmp(sub, "ACK") == 0)
 	{
-		irc_cmd(IRC_USER, bot_t->irc_user, bot_t->irc_name);
-		irc_cmd(IRC_NICK, bot_t->irc_nick, NULL);
-		return;
-	}
+		for(; *list != '\0'; list += len, list += strspn(list, " "))
+		{
+			len = strcspn(list, " ");
+			
+			for(i = 0; caps[i].name != NULL; i++)
+			{
+				if(strlen(caps[i].name) == len && strncmp(list, caps[i].name, len) == 0)
+					bot_t->irc_caps |= caps[i].flag;
+			}
+		}
+		
+		/* Log in before we finish, so NickServ never has to ask. */
+		if((bot_t->irc_caps & IRC_CAP_SASL) && bot_t->irc_authed == 0 &&
+		   (mech = irc_sasl_mech(bot_t)) != NULL && bot_t->irc_cap_pending > 0)
+		{
+			bot_t->irc_cap_pending++;
+			irc_cmd(IRC_AUTHENTICATE, mech, NULL);
+		}
+		
+		if(more == 0)
+			irc_cap_end();
+	}
+	else if(strcmp(sub, "NAK") == 0)
+		irc_cap_end();
+	
+	return(IRC_DONE);
+}
+
+/*
+ * Look for an item in a comma separated list that isn't NUL terminated.
+ * Return value:
+ *   Returns 1 if the item is there, otherwise 0.
+ */
+static int
+irc_list_has(const char *list, size_t len, const char *item)
+{
+	size_t n, item_len = strlen(item);
+	
+	while(len > 0)
+	{
+		for(n = 0; n < len && list[n] != ','; n++);
+		if(n == item_len && strncasecmp(list, item, n) == 0)
+			return(1);
+		
+		list += n;
+		len -= n;
+		if(len > 0)
+		{
+			list++;
+			len--;
+		}
+	}
+	
+	return(0);
+}
+
+/*
+ * One step of capability negotiation is done. Once none are left we let
+ * the server finish registering us.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cap_end(void)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(bot_t->irc_cap_pending > 0 && --bot_t->irc_cap_pending == 0)
+		irc_cmd(IRC_CAP, "END", NULL);
+}
+
+/*
+ * Work out which SASL mechanism a bot logs in with. Without one set,
+ * PLAIN is used whenever there is a password to send.
+ * Return value:
+ *   The mechanism's name, or NULL if the bot doesn't use SASL.
+ */
+static const char *
+irc_sasl_mech(const struct bot_in *bot_t)
+{
+	if(bot_t->irc_sasl_mech != NULL)
+	{
+		if(strcasecmp(bot_t->irc_sasl_mech, "EXTERNAL") == 0)
+			return("EXTERNAL");
+		if(strcasecmp(bot_t->irc_sasl_mech, "PLAIN") != 0)
+			return(NULL);
+	}
+	
+	if(bot_t->irc_sasl_pass == NULL && bot_t->irc_nspass == NULL)
+		return(NULL);
+	
+	return("PLAIN");
+}
+
+/*
+ * Answer the server's AUTHENTICATE challenge. EXTERNAL has nothing to
+ * say, our certificate already did the talking. PLAIN sends the account
+ * and password base64 encoded, in IRC_SASL_CHUNK sized pieces.
+ * Return value:
+ *   Returns IRC_DONE.
+ */
+static int
+irc_sasl(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	const char *mech = irc_sasl_mech(bot_t);
+	const char *user, *pass;
+	unsigned char *plain, *encoded;
+	char chunk[IRC_SASL_CHUNK+1];
+	size_t user_len, pass_len, plain_len, encoded_len, off;
+	
+	if(msg->nparams == 0 || strcmp(msg->params[0].s_data, "+") != 0 || mech == NULL)
+		return(IRC_DONE);
+	
+	if(strcmp(mech, "EXTERNAL") == 0)
+	{
+		irc_cmd(IRC_AUTHENTICATE, "+", NULL);
+		return(IRC_DONE);
+	}
+	
+	user = (bot_t->irc_sasl_user != NULL ? bot_t->irc_sasl_user : bot_t->irc_nick);
+	pass = (bot_t->irc_sasl_pass != NULL ? bot_t->irc_sasl_pass : bot_t->irc_nspass);
+	user_len = strlen(user);
+	pass_len = strlen(pass);
+	
+	/* authzid, authcid and password, separated by NULs. */
+	plain_len = user_len*2+pass_len+2;
+	plain = arena_alloc(plain_len);
+	encoded = arena_alloc(4*((plain_len+2)/3)+1);
+	if(plain == NULL || encoded == NULL)
+	{
+		irc_cmd(IRC_AUTHENTICATE, "*", NULL);
+		return(IRC_DONE);
+	}
+	
+	memcpy(plain, user, user_len+1);
+	memcpy(plain+user_len+1, user, user_len+1);
+	memcpy(plain+user_len*2+2, pass, pass_len);
+	encoded_len = EVP_EncodeBlock(encoded, plain, plain_len);
+	
+	for(off = 0; off < encoded_len; off += IRC_SASL_CHUNK)
+	{
+		snprintf(chunk, sizeof(chunk), "%.*s", IRC_SASL_CHUNK, (char *)encoded+off);
+		irc_cmd(IRC_AUTHENTICATE, chunk, NULL);
+	}
+	
+	/* A full last piece needs telling that nothing more is coming. */
+	if(encoded_len%IRC_SASL_CHUNK == 0)
+		irc_cmd(IRC_AUTHENTICATE, "+", NULL);
+	
+	/* The arena isn't cleared on reset, so the password is wiped now. */
+	OPENSSL_cleanse(plain, plain_len);
+	OPENSSL_cleanse(encoded, encoded_len);
+	
+	return(IRC_DONE);
+}
+
+/*
+ * The outcome of SASL, 903 and 907 mean we are logged in. Either way
+ * registration can go on.
+ * Return value:
+ *   Returns IRC_DONE.
+ */
+static int
+irc_sasl_done(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(msg->code == IRC_RPL_SASLSUCCESS || msg->code == IRC_ERR_SASLALREADY)
+		bot_t->irc_authed = 1;
+	irc_cap_end();
+	
+	return(IRC_DONE);
+}
+
+/*
+ * Pick out what we care about from an ISUPPORT (005) line. For now that
+ * is TARGMAX, how many targets a command may carry, which the output
+ * scheduler uses when merging lines.
+ * Return value:
+ *   Returns IRC_DONE.
+ */
+static int
+irc_isupport(const struct irc_msg *msg)
+{
+	char cmd[16];
+	size_t len;
+	u_int i;
+	const char *token = NULL;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	/* Tokens sit between our nick and the closing "are supported". */
+	for(i = 1; i+1 < msg->nparams && token == NULL; i++)
+	{
+		if(strncmp(msg->params[i].s_data, "TARGMAX=", 8) == 0)
+			token = msg->params[i].s_data+8;
+	}
+	
+	if(token == NULL)
+		return(IRC_DONE);
+	
+	/* A list like PRIVMSG:4,NOTICE:4,JOIN: where no number means no limit. */
+	while(*token != '\0')
+	{
+		len = strcspn(token, ":,");
+		if(token[len] == ':' && len < sizeof(cmd))
+		{
+			memcpy(cmd, token, len);
+			cmd[len] = '\0';
+			sched_targmax(&bot_t->irc_out, cmd, strtoul(token+len+1, NULL, 10));
+		}
+		token += strcspn(token, ",");
+		if(*token == ',')
+			token++;
+	}
+	
+	return(IRC_DONE);
+}
+
+/*
+ * Servers meter unregistered connections on their own, so what we
+ * pipelined during registration doesn't count against us from here.
+ * Return value:
+ *   Returns IRC_NEXT.
+ */
+static int
+irc_welcome(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	(void)msg;
+	
+	sched_refill(&bot_t->irc_out);
+	
+	/* We made it in, so the next drop starts the backoff afresh. */
+	bot_t->irc_retries = 0;
+	if(bot_t->irc_server != NULL)
+	{
+		bot_t->irc_server->fails = 0;
+		bot_t->irc_server->open_until = 0;
+	}
+	
+	return(IRC_NEXT);
+}
+
+/*
+ * If our chosen nick is taken, create a new nick based on our old one.
+ * Return value:
+ *   Returns IRC_NEXT.
+ */
+static int
+irc_nick_taken(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	size_t nick_len = strlen(bot_t->irc_nick)+5;
+#ifdef OPENSSL_ENABLED
+	unsigned char rand_buf[2];
+	RAND_bytes(rand_buf, 2);
+#else
+	int rand_buf[2];
+	
+	/*
+	 * XXX Not even hardly psuedo-random, but doesn't need to be--I guess. I mean
+	 * its not like two truely psuedo-random (or even random) bytes can produce much
+	 * random data at only 2(2^8) bits. Long story short This isn't of any interest
+	 * to me, but feel free to fix it if you start loosing sleep over it.
+	 */
+	srand(time(NULL)%65530);
+	rand_buf[0] = rand();
+	rand_buf[1] = rand();
+#endif /* OPENSSL_ENABLED */
+	
+	(void)msg;
+	
+	/* Our last try may have been taken too. */
+	free(bot_t->irc_nick_temp);
+	if((bot_t->irc_nick_temp = calloc(nick_len, sizeof(char))) == NULL)
+		return(IRC_NEXT);
+	snprintf(bot_t->irc_nick_temp, nick_len, "%s%02x%02x", bot_t->irc_nick,
+			 rand_buf[0], rand_buf[1]);
+	
+	irc_cmd(IRC_NICK, bot_t->irc_nick_temp, NULL);
+	
+	return(IRC_NEXT);
+}
+
+/*
+ * End of MOTD, or no MOTD at all, send our initial commands.
+ * Return value:
+ *   Returns IRC_NEXT.
+ */
+static int
+irc_motd_end(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	char *bnick = (bot_t->irc_nick_temp != NULL ? bot_t->irc_nick_temp : bot_t->irc_nick);
+	struct chan_list *clist;
+	
+	(void)msg;
+	
+	/* If we think we own the nick, then try to take it over. */
+	if(bot_t->irc_nick_temp != NULL)
+	{
+		if(bot_t->irc_nspass != NULL)
+		{
+			size_t buf_len = strlen(bot_t->irc_nick)+strlen(bot_t->irc_nspass)+2;
+			char *buf = arena_alloc(buf_len);
+			
+			if(buf != NULL)
+			{
+				snprintf(buf, buf_len, "%s %s", bot_t->irc_nick, bot_t->irc_nspass);
+				irc_cmd(IRC_NICKSERV, "GHOST", buf);
+			}
+		}
+		else
+		{
+			free(bot_t->irc_nick);
+			bot_t->irc_nick = bot_t->irc_nick_temp;
+			
+			/* Set temp nick to NULL since it isn't very 'temp' anymore. */
+			bot_t->irc_nick_temp = NULL;
+		}
+	}
+	
+	/* If we have a NickServ password... then use it, unless SASL did. */
+	if(bot_t->irc_nspass != NULL && bot_t->irc_authed == 0)
+		irc_cmd(IRC_NICKSERV, "IDENTIFY", bot_t->irc_nspass);
+	
+	irc_cmd(IRC_MODE, bnick, IRC_DEFAULT_MODES);
+	
+	/* Join all our channels. */
+	for(clist = bot_t->irc_channels;
+		clist != NULL;
+		clist = clist->next)
+	{
+		irc_cmd(IRC_JOIN, clist->name, NULL);
+	}
+	
+	bot_t->bot_status = (bot_t->bot_status & ~BOT_STATUS_STARTING)|
+						BOT_STATUS_RUNNING;
+	
+	return(IRC_NEXT);
+}
+
+/*
+ * Check if NickServ wants us to identify, or has freed up our nick.
+ * Return value:
+ *   Returns IRC_NEXT.
+ */
+static int
+irc_nickserv(const struct irc_msg *msg)
+{
+	const char *mesg;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(msg->nick.s_len != 8 || strncmp(msg->nick.s_data, "NickServ", 8) != 0 ||
+	   msg->nparams == 0)
+		return(IRC_NEXT);
+	mesg = msg->params[msg->nparams-1].s_data;
+	
+	if(strncmp(mesg, "This nickname is registered", 27) == 0 &&
+	   bot_t->irc_nspass != NULL && bot_t->irc_authed == 0)
+	{
+		irc_cmd(IRC_NICKSERV, "IDENTIFY", bot_t->irc_nspass);
+	}
+	
+	/* NickServ freed up our nick for us so take it back. */
+	else if(strcmp(mesg, "Ghost with your nick has been killed.") == 0)
+	{
+		irc_cmd(IRC_NICK, bot_t->irc_nick, NULL);
+		free(bot_t->irc_nick_temp);
+		bot_t->irc_nick_temp = NULL;
+	}
+	
+	return(IRC_NEXT);
+}
+
+/*
+ * Cleanup socket if it dies on us.
+ * Return value:
+ *   Returns an E_ status if the bot should reconnect or stop, otherwise
+ *   IRC_NEXT.
+ */
+static int
+irc_error(const struct irc_msg *msg)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(msg->nparams == 0 || strncasecmp(msg->params[0].s_data, "Closing Link:", 13) != 0)
+		return(IRC_NEXT);
+	
+	if(bot_t->bot_status & BOT_STATUS_RESTARTING)
+	{
+		bot_t->bot_status = (bot_t->bot_status & ~BOT_STATUS_RESTARTING)|
+							BOT_STATUS_STARTING;
+		return(E_RECONN);
+	}
+	else if(strstr(msg->params[0].s_data, "(Throttled: Reconnecting too fast)") != NULL)
+		return(E_REWAIT);
+	else if(bot_t->bot_status & BOT_STATUS_QUITTING)
+		return(E_NONE);
+	
+	return(IRC_NEXT);
+}
+
+/*
+ * Hand a line on to our modules, then run any command in it.
+ * Return value:
+ *   None.
+ */
+static void
+irc_respond(const char *from, const char *to, const char *command, const char *mesg)
+{
+	int admin;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	/* Sanity checking. */
+	if(bot_t == NULL || from == NULL || to == NULL ||
+	   command == NULL || mesg == NULL)
+		return;
+	
+	/* Give our modules the first chance to hook some functions. */
+	if(mod_irc_callback(from, to, command, mesg) == MOD_EAT_ALL)
+		return;
+	
+	/* Check if there is a command to be run. */
+	if(strncmp(mesg, COMMAND_PREFIX, strlen(COMMAND_PREFIX)) != 0)
+		return;
+	mesg += strlen(COMMAND_PREFIX);
+	admin = (irc_is_admin(from) == 0);
+	
+	/* Whatever an admin asked for goes out ahead of module chatter. */
+	if(admin)
+		bot_t->irc_out_class = SCHED_ADMIN;
+	
+	/* One lookup finds the command, whoever registered it. */
+	command_dispatch(from, to, mesg, admin);
+}
+
+/*
+ * !conf list, for the FreeSWITCH conference list.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_conf(const struct command_call *call)
+{
+	if(call->argc > 0 && strcasecmp(call->argv[0], "list") == 0)
+	{
+		/*
+		 * XXX Will implement soon...
+		 * fs_api_call(FS_CONFLIST, NULL, NULL);
+		 */
+		irc_cmd(IRC_PRIVMSG, call->to, "Coming soon!");
+	}
+}
+
+/*
+ * Report how long our last lag probe took to come back.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_lag(const struct command_call *call)
+{
+	char lag[64];
+	size_t len;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if(bot_t->irc_lag < 0)
+		len = snprintf(lag, sizeof(lag), "Lag: unknown");
+	else
+		len = snprintf(lag, sizeof(lag), "Lag: %d ms", bot_t->irc_lag);
+	
+	/* With server-time we also know how long messages take to get here. */
+	if(bot_t->irc_delay >= 0)
+		snprintf(lag+len, sizeof(lag)-len, ", delay: %d ms", bot_t->irc_delay);
+	
+	if(*call->to == '#')
+		irc_cmd(IRC_NOTICE, call->to, lag);
+	else
+	{
+		char *nick = arena_strndup(call->from, strcspn(call->from, "!"));
+		
+		if(nick != NULL)
+			irc_cmd(IRC_NOTICE, nick, lag);
+	}
+}
+
+/*
+ * !join and !part take a channel list, and keys or a reason if wanted.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_join(const struct command_call *call)
+{
+	irc_cmd(IRC_JOIN, call->argv[0], NULL);
+}
+
+static void
+irc_cmd_part(const struct command_call *call)
+{
+	irc_cmd(IRC_PART, call->argv[0], NULL);
+}
+
+/*
+ * !say and !me speak in the channel named first, or else in the channel
+ * they were asked in.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_say(const struct command_call *call)
+{
+	if(*call->argv[0] == '#')
+	{
+		if(call->argc > 1)
+			irc_cmd(IRC_PRIVMSG, call->argv[0], call->argv[1]);
+	}
+	else if(*call->to == '#')
+		irc_cmd(IRC_PRIVMSG, call->to, call->args);
+}
+
+static void
+irc_cmd_me(const struct command_call *call)
+{
+	if(*call->argv[0] == '#')
+	{
+		if(call->argc > 1)
+			irc_cmd(IRC_ACTION, call->argv[0], call->argv[1]);
+	}
+	else if(*call->to == '#')
+		irc_cmd(IRC_ACTION, call->to, call->args);
+}
+
+/*
+ * !nick changes our nick, !raw sends a line to the server as it is.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_nick(const struct command_call *call)
+{
+	irc_cmd(IRC_NICK, call->argv[0], NULL);
+}
+
+static void
+irc_cmd_raw(const struct command_call *call)
+{
+	irc_cmd(IRC_RAW, call->argv[0], NULL);
+}
+
+/*
+ * !quit leaves for good, !reconnect comes straight back.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_quit(const struct command_call *call)
+{
+	irc_cmd(IRC_QUIT, (call->argc > 0 ? call->argv[0] : BOT_VERSION_STRING), NULL);
+}
+
+static void
+irc_cmd_reconnect(const struct command_call *call)
+{
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	irc_cmd(IRC_QUIT, (call->argc > 0 ? call->argv[0] : BOT_VERSION_STRING), NULL);
+	bot_t->bot_status |= BOT_STATUS_RESTARTING;
+}
+
+/*
+ * Start another bot like us under the nick given.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_spawn(const struct command_call *call)
+{
+	char *n_nick;
+	struct bot_in *n_bot;
+	struct bot_in *bot_t = pthread_getspecific(bot);
+	
+	if((n_nick = strdup(call->argv[0])) == NULL)
+		return;
+	
+	/* Copy our bot config and make changes as nessesary. */
+	if((n_bot = bot_clone_config(bot_t)) == NULL)
+	{
+		free(n_nick);
+		return;
+	}
+	
+	if(n_bot->irc_nick != NULL)
+		free(n_bot->irc_nick);
+	n_bot->irc_nick = n_nick;
+	
+	/* Start our new thread. */
+	bot_spawn(n_bot);
+}
+
+/*
+ * Loading and unloading modules... this is a first.
+ * Return value:
+ *   None.
+ */
+static void
+irc_cmd_load(const struct command_call *call)
+{
+	mod_load((char *)call->argv[0]);
+}
+
+static void
+irc_cmd_unload(const struct command_call *call)
+{
+	mod_unload(call->argv[0]);
 }
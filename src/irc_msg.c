@@ -0,0 +1,257 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "irc_msg.h"
+
+#include <string.h>
+
+
+static const char irc_msg_empty[] = "";
+
+static void irc_msg_tags(struct irc_msg *msg);
+
+/*
+ * Cut the next space delimited field out of a line. The field is NUL
+ * terminated in place of the space that ended it.
+ * Return value:
+ *   A pointer just past the field.
+ */
+static inline char *
+irc_msg_field(char *p, struct irc_slice *slice)
+{
+	char *start = p;
+	
+	while(*p != ' ' && *p != '\0' && *p != '\r' && *p != '\n')
+		p++;
+	
+	slice->s_data = start;
+	slice->s_len = p-start;
+	
+	if(*p == ' ')
+		*p++ = '\0';
+	else
+		*p = '\0';
+	
+	while(*p == ' ')
+		p++;
+	
+	return(p);
+}
+
+/*
+ * Split a line from the server into its parts in one pass, without
+ * copying or allocating anything. Tags, prefix, command and parameters
+ * are NUL terminated where they sit in the line, so each slice can also
+ * be used as a string for as long as the line is around. Nick, user and
+ * host only point into the prefix and must be used by length. A prefix
+ * without ! or @ is a server name and goes in nick. Parts that are
+ * missing are empty.
+ * Return value:
+ *   Returns 0 on success or -1 if there is no command.
+ */
+int
+irc_msg_parse(char *line, struct irc_msg *msg)
+{
+	char *p = line;
+	const char *at;
+	struct irc_slice *param;
+	
+	msg->tags.s_data = msg->prefix.s_data = irc_msg_empty;
+	msg->nick.s_data = msg->user.s_data = msg->host.s_data = irc_msg_empty;
+	msg->tags.s_len = msg->prefix.s_len = 0;
+	msg->nick.s_len = msg->user.s_len = msg->host.s_len = 0;
+	msg->ntags = 0;
+	msg->nparams = 0;
+	
+	while(*p == ' ')
+		p++;
+	
+	if(*p == '@')
+	{
+		p = irc_msg_field(p+1, &msg->tags);
+		irc_msg_tags(msg);
+	}
+	
+	if(*p == ':')
+	{
+		p = irc_msg_field(p+1, &msg->prefix);
+		
+		/* nick[[!user]@host], all in one walk over the prefix. */
+		msg->nick.s_data = msg->prefix.s_data;
+		for(at = msg->prefix.s_data; *at != '\0' && *at != '!' && *at != '@'; at++);
+		msg->nick.s_len = at-msg->nick.s_data;
+		
+		if(*at == '!')
+		{
+			msg->user.s_data = ++at;
+			for(; *at != '\0' && *at != '@'; at++);
+			msg->user.s_len = at-msg->user.s_data;
+		}
+		
+		if(*at == '@')
+		{
+			msg->host.s_data = at+1;
+			msg->host.s_len = msg->prefix.s_len-(msg->host.s_data-msg->prefix.s_data);
+		}
+	}
+	
+	p = irc_msg_field(p, &msg->command);
+	if(msg->command.s_len == 0)
+		return(-1);
+	
+	while(*p != '\0' && *p != '\r' && *p != '\n' && msg->nparams < IRC_MSG_MAXPARAMS)
+	{
+		param = &msg->params[msg->nparams++];
+		
+		/*
+		 * A trailing parameter, marked by a colon or by being the last
+		 * one there is room for, runs to the end of the line.
+		 */
+		if(*p == ':' || msg->nparams == IRC_MSG_MAXPARAMS)
+		{
+			if(*p == ':')
+				p++;
+			
+			param->s_data = p;
+			for(; *p != '\0' && *p != '\r' && *p != '\n'; p++);
+			param->s_len = p-param->s_data;
+			*p = '\0';
+			break;
+		}
+		
+		p = irc_msg_field(p, param);
+	}
+	
+	return(0);
+}
+
+/*
+ * Find where each tag's key and value are. Values are left escaped, most
+ * are never looked at, irc_msg_tag_value() decodes the ones that are.
+ * Tags past IRC_MSG_MAXTAGS are ignored.
+ * Return value:
+ *   None.
+ */
+static void
+irc_msg_tags(struct irc_msg *msg)
+{
+	const char *p = msg->tags.s_data, *end = p+msg->tags.s_len;
+	struct irc_tag *tag;
+	
+	while(p < end && msg->ntags < IRC_MSG_MAXTAGS)
+	{
+		tag = &msg->tagv[msg->ntags];
+		tag->key.s_data = p;
+		for(; p < end && *p != '=' && *p != ';'; p++);
+		tag->key.s_len = p-tag->key.s_data;
+		
+		/* key and key= both mean an empty value. */
+		if(p < end && *p == '=')
+			p++;
+		tag->value.s_data = p;
+		for(; p < end && *p != ';'; p++);
+		tag->value.s_len = p-tag->value.s_data;
+		
+		if(p < end)
+			p++;
+		
+		if(tag->key.s_len > 0)
+			msg->ntags++;
+	}
+}
+
+/*
+ * Look up a tag by key, client-only tags include their leading +.
+ * Return value:
+ *   The tag, or NULL if the message doesn't carry it.
+ */
+const struct irc_tag *
+irc_msg_tag(const struct irc_msg *msg, const char *key)
+{
+	u_int i;
+	size_t len = strlen(key);
+	
+	for(i = 0; i < msg->ntags; i++)
+	{
+		if(msg->tagv[i].key.s_len == len && memcmp(msg->tagv[i].key.s_data, key, len) == 0)
+			return(&msg->tagv[i]);
+	}
+	
+	return(NULL);
+}
+
+/*
+ * Undo the escaping of a tag's value into buf, which is always NUL
+ * terminated. A value that doesn't fit is cut short.
+ * Return value:
+ *   Returns the length of the value, or -1 if buf has no room at all.
+ */
+ssize_t
+irc_msg_tag_value(const struct irc_tag *tag, char *buf, size_t size)
+{
+	const char *p = tag->value.s_data, *end = p+tag->value.s_len;
+	size_t len = 0;
+	
+	if(size == 0)
+		return(-1);
+	
+	for(; p < end && len+1 < size; p++)
+	{
+		if(*p != '\\')
+		{
+			buf[len++] = *p;
+			continue;
+		}
+		
+		/* A lone backslash at the end is dropped. */
+		if(++p == end)
+			break;
+		
+		switch(*p)
+		{
+			case ':':
+				buf[len++] = ';';
+				break;
+			case 's':
+				buf[len++] = ' ';
+				break;
+			case 'r':
+				buf[len++] = '\r';
+				break;
+			case 'n':
+				buf[len++] = '\n';
+				break;
+			default:
+				buf[len++] = *p;
+				break;
+		}
+	}
+	buf[len] = '\0';
+	
+	return(len);
+}
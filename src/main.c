@@ -28,12 +28,17 @@
 
 #include "global.h"
 #include "config_file.h"
+#include "irc.h"
 #include "mod_so.h"
+#include "reactor.h"
+#include "resolver.h"
 #include "socket.h"
+#include "upgrade.h"
 
 #include <errno.h>
 #include <regex.h>
 #include <libgen.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -51,6 +56,10 @@ int
 main(int argc, char **argv)
 {
 	char config_file[PATH_MAX+1];
+	sigset_t sigs;
+	
+	/* Remember how we were started in case we are asked to upgrade. */
+	upgrade_init(argv);
 	
 	/* Parse command line arguments. */
 	{
@@ -80,7 +89,8 @@ main(int argc, char **argv)
 					break;
 			}
 		}
-		if(dflag == 1)
+		/* After an upgrade we are already a daemon, and still the same pid. */
+		if(dflag == 1 && getenv(UPGRADE_ENV) == NULL)
 			daemonize();
 	}
 	
@@ -135,47 +145,108 @@ main(int argc, char **argv)
 		}
 	}
 	
+	/* Scratch memory for handling messages, modules may want it too. */
+	arena_init();
+	
 	/* Initialize our module system just before we read our configs. */
 	mod_init();
 	
+	/* The core commands, before any module can take their names. */
+	if(irc_init() == -1)
+	{
+		fprintf(stderr, "[ERROR] Unable to set up the IRC commands.\n");
+		return -1;
+	}
+	
 	/* Get bot configurations and place in bots. */
 	bots = calloc(1, sizeof(*bots));
 	if(bots == NULL)
 		return -1;
 	read_config(config_file);
 	
+	/* Take over from the process before us if this is an upgrade. */
+	if(upgrade_restore() == -1)
+		fprintf(stderr, "[ERROR] Unable to restore our state, starting over.\n");
+	
+	/* Nothing the config or the restore put in the arena is needed now. */
+	arena_reset();
+
 #ifdef OPENSSL_ENABLED
 	/* If compiled with OpenSSL support, setup thread locking callbacks and locks. */
-	ssl_init();
+	ssl_init(config_global.ssl_session_file, config_global.ssl_cert_file,
+			 config_global.ssl_key_file);
 #endif /* OPENSSL_ENABLED */
 	
 	/* Initialize our regular expressions. */
 	regex_init();
 	
+	/* Reconnect jitter only works if every process rolls differently. */
+	srandom(time(NULL)^getpid());
+	
 	
 	/* XXX Remove this for release. */
 	//mod_load("libmod_urltools.dylib");
 	
 	/* Create all nessesary threads. */
 	{
-		struct bot_in *next_bot = bots->b_first;
-		
-		/* Make our threads detachable. */
-		pthread_attr_init(&thread_attr);
-		pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+		struct bot_in *next_bot;
 		
 		/* Set some thread specific stuffs. */
-		pthread_key_create(&m_sock_fds, NULL);
+		pthread_key_create(&m_reactor, NULL);
 		pthread_key_create(&bot, NULL);
 		pthread_key_create(&irc_s, NULL);
 		
-		/* Launch a new thread per bot. */
-		for(; next_bot != NULL; next_bot = next_bot->next)
+		/* A dead peer should show up as EPIPE from write, not kill us. */
+		signal(SIGPIPE, SIG_IGN);
+		
+		/* Only this thread takes these, block them before anyone else exists. */
+		sigemptyset(&sigs);
+		sigaddset(&sigs, SIGTERM);
+		sigaddset(&sigs, SIGUSR2);
+		pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+		
+		/* Start our pool of reactor threads, the bots will share them. */
+		if(reactor_init(config_global.reactor_threads) == -1)
+		{
+			fprintf(stderr, "[ERROR] Unable to start reactor threads.\n");
+			exit(1);
+		}
+		
+		/* Name lookups get threads of their own so reactors never wait. */
+		if(resolver_init(RESOLVER_THREADS) == -1)
+		{
+			fprintf(stderr, "[ERROR] Unable to start resolver threads.\n");
+			exit(1);
+		}
+		
+		/* Hand each bot to a reactor, hold the lock so the list stays put. */
+		pthread_mutex_lock(&mtx_bots);
+		for(next_bot = bots->b_first; next_bot != NULL; next_bot = next_bot->next)
 			bot_spawn(next_bot);
+		pthread_mutex_unlock(&mtx_bots);
+	}
+	
+	/*
+	 * Wait around for SIGUSR2, which asks us to exec() a new binary, or
+	 * SIGTERM, which the last bot to stop sends us too.
+	 */
+	for(;;)
+	{
+		int sig;
+		
+		if(sigwait(&sigs, &sig) != 0)
+			continue;
+		
+		if(sig == SIGUSR2)
+			upgrade_exec();
+		else if(sig == SIGTERM)
+			break;
 	}
 	
-	/* Exit the current thread and allow the others to continue. */
-	pthread_exit(NULL);
+	/* Nobody may be using anything exit() tears down, like SSL or stdio. */
+	reactor_pause();
+	resolver_stop();
+	
 	return(0);
 }
 
@@ -185,13 +256,6 @@ main(int argc, char **argv)
 static void
 regex_init(void)
 {
-	/* Initialize our regex for parsing IRC message. */
-	if(regcomp(&irc_mesg_re, "^:([^ ]+) ([^ ]+) ?\\*? ([^ ]+) :([^[:cntrl:]]*)$", REG_EXTENDED) != 0)
-	{
-		/* XXX Handle exception... D: */
-		exit(1);
-	}
-	
 	/* Add some FreeSWITCH specific regex. */
 	if(regcomp(&fs_caller_name_re, "^Caller-Caller-ID-Name: ([^[:cntrl:]]+)$", REG_EXTENDED|REG_ICASE|REG_NEWLINE) != 0)
 	{
@@ -28,6 +28,7 @@
 
 #include "global.h"
 #include "mod_so.h"
+#include "command.h"
 #include "irc.h"
 
 #include <dlfcn.h>
@@ -38,6 +39,9 @@
 
 static struct mod_object *modules;
 static pthread_mutex_t mtx_mod;
+static pthread_mutex_t mtx_refs = PTHREAD_MUTEX_INITIALIZER;
+
+static int mod_close(struct mod_object *mh);
 
 
 /*
@@ -68,6 +72,13 @@ mod_load(char *mod)
 	int (**func_mod_load)(char *);
 	int (**func_mod_unload)(const char *);
 	int (**func_irc_cmd)(int, const char *, const char *);
+	int (**func_command_register)(const void *, const char *, int, u_int, u_int,
+								  void (*)(const struct command_call *));
+	int (**func_irc_hook)(const void *, int, int (*)(const struct irc_msg *));
+	int (**func_irc_code)(const char *);
+	void *(**func_arena_alloc)(size_t);
+	char *(**func_arena_strdup)(const char *);
+	char *(**func_arena_strndup)(const char *, size_t);
 	int (**func_mod_register_irc)(struct mod_object *,
 								  int (*)(const char *, const char *,
 										  const char *, const char *));
@@ -124,6 +135,24 @@ mod_load(char *mod)
 	if((func_irc_cmd = dlsym(mhand->dl_handler, "irc_cmd")) != NULL)
 		*func_irc_cmd = &irc_cmd;
 	
+	if((func_command_register = dlsym(mhand->dl_handler, "command_register")) != NULL)
+		*func_command_register = &command_register;
+	
+	if((func_irc_hook = dlsym(mhand->dl_handler, "irc_hook")) != NULL)
+		*func_irc_hook = &irc_hook;
+	
+	if((func_irc_code = dlsym(mhand->dl_handler, "irc_code")) != NULL)
+		*func_irc_code = &irc_code;
+	
+	if((func_arena_alloc = dlsym(mhand->dl_handler, "arena_alloc")) != NULL)
+		*func_arena_alloc = &arena_alloc;
+	
+	if((func_arena_strdup = dlsym(mhand->dl_handler, "arena_strdup")) != NULL)
+		*func_arena_strdup = &arena_strdup;
+	
+	if((func_arena_strndup = dlsym(mhand->dl_handler, "arena_strndup")) != NULL)
+		*func_arena_strndup = &arena_strndup;
+	
 	/* Runn our new plugin's module_init() function. */
 	if((*(void **)(&module_init) = dlsym(mhand->dl_handler, "module_init")) != NULL)
 		(*module_init)(mhand);
@@ -144,6 +173,7 @@ not_enough_mem:
 int
 mod_unload(const char *mod)
 {
+	int busy;
 	struct mod_object *mlist;
 	
 	if(modules == NULL || mod == NULL)
@@ -174,25 +204,90 @@ mod_unload(const char *mod)
 		}
 	}
 	
-	if(dlclose(mlist->dl_handler) != 0)
-		return(-1);
-	
+	/* Its commands and hooks must go before its code does. */
+	command_unregister(mlist);
+	irc_unhook(mlist);
 	
-	/* Unlock our mutex and free some memory. */
+	/* Unlock our mutex, nothing new can reach the module now. */
 	pthread_mutex_unlock(&mtx_mod);
 	
+	/*
+	 * One of its handlers may still be running on another reactor, or be
+	 * the one unloading it. Whoever finishes last closes it.
+	 */
+	pthread_mutex_lock(&mtx_refs);
+	mlist->unloading = 1;
+	busy = (mlist->refs > 0);
+	pthread_mutex_unlock(&mtx_refs);
+	
+	if(busy)
+		return(0);
+	
+	return(mod_close(mlist));
+}
+
+/*
+ * Keep a module's code mapped while one of its handlers runs. Callers
+ * hold the lock of the table they found the handler in, so the module
+ * can't have started unloading. A NULL owner is the core.
+ * Return value:
+ *   None.
+ */
+void
+mod_hold(const void *owner)
+{
+	struct mod_object *mh = (struct mod_object *)owner;
+	
+	if(mh == NULL)
+		return;
+	
+	pthread_mutex_lock(&mtx_refs);
+	mh->refs++;
+	pthread_mutex_unlock(&mtx_refs);
+}
+
+/*
+ * Let go of a module held by mod_hold(), closing it if it was unloaded
+ * in the meantime.
+ * Return value:
+ *   None.
+ */
+void
+mod_release(const void *owner)
+{
+	int last;
+	struct mod_object *mh = (struct mod_object *)owner;
+	
+	if(mh == NULL)
+		return;
+	
+	pthread_mutex_lock(&mtx_refs);
+	last = (--mh->refs == 0 && mh->unloading);
+	pthread_mutex_unlock(&mtx_refs);
+	
+	if(last)
+		mod_close(mh);
+}
+
+/*
+ * Close an unloaded module and free what is left of it.
+ * Return value:
+ *   Returns 0 on success, otherwise returns error code.
+ */
+static int
+mod_close(struct mod_object *mh)
+{
+	if(dlclose(mh->dl_handler) != 0)
+		return(-1);
+	
 	/*
 	 * Freeing memory memory.
 	 * NOTE: don't free function pointers or dl_handler, bad things
 	 *       bad things happen, ok.
 	 */
-	if(mlist != NULL)
-	{
-		if(mlist->filename != NULL)
-			free(mlist->filename);
-		
-		free(mlist);
-	}
+	if(mh->filename != NULL)
+		free(mh->filename);
+	free(mh);
 	
 	return(0);
 }
@@ -0,0 +1,1267 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "reactor.h"
+#include "uring.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+
+#ifdef WITH_URING
+/* Completions carry a handler pointer with the operation in its low bits. */
+#define REACTOR_OP_POLL		0x1
+#define REACTOR_OP_RECV		0x2
+#define REACTOR_OP_SEND		0x3
+#define REACTOR_OP_WAKE		0x4
+#define REACTOR_OP_MASK		0x7
+
+/* Only visible with _GNU_SOURCE, but the kernel always knows it. */
+#ifndef POLLRDHUP
+#define POLLRDHUP			0x2000
+#endif
+#endif /* WITH_URING */
+
+
+static struct reactor **reactors;
+static u_int reactor_count;
+static pthread_mutex_t mtx_reactors = PTHREAD_MUTEX_INITIALIZER;
+
+/* Reactors parked by reactor_pause(). */
+static int reactor_paused;
+static u_int reactor_parked;
+static pthread_mutex_t mtx_pause = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_pause = PTHREAD_COND_INITIALIZER;
+
+
+/*
+ * Get the current time in milliseconds from a monotonic clock.
+ * Return value:
+ *   Returns the number of milliseconds since some unspecified point.
+ */
+uint64_t
+reactor_time(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return((uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000);
+}
+
+/*
+ * Run any tasks queued for this reactor by other threads.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_run_tasks(struct reactor *r)
+{
+	uint64_t count;
+	struct reactor_task *task, *next;
+	
+	/* Drain our eventfd so we don't get woken up again. */
+	if(read(r->wakefd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+		perror("[ERROR] reactor_run_tasks(): read()");
+	
+	/* Steal the whole queue so callbacks may queue more tasks. */
+	pthread_mutex_lock(&r->mtx_tasks);
+	task = r->t_first;
+	r->t_first = r->t_last = NULL;
+	pthread_mutex_unlock(&r->mtx_tasks);
+	
+	for(; task != NULL; task = next)
+	{
+		next = task->next;
+		(*task->callback)(task->arg);
+		free(task);
+	}
+}
+
+/*
+ * Fire any timers whose deadline has passed.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_run_timers(struct reactor *r)
+{
+	uint64_t now = reactor_time();
+	struct reactor_timer *t;
+	
+	while((t = r->timers) != NULL && t->deadline <= now)
+	{
+		/* Unlink the timer before calling it, it may want to rearm. */
+		r->timers = t->next;
+		if(r->timers != NULL)
+			r->timers->prev = NULL;
+		
+		t->armed = 0;
+		t->prev = t->next = NULL;
+		(*t->callback)(t->arg);
+		
+		now = reactor_time();
+	}
+}
+
+/*
+ * Work out how long we may sleep before the next timer is due.
+ * Return value:
+ *   Returns a timeout in milliseconds for epoll_wait(), or -1 if there
+ *   are no timers.
+ */
+static int
+reactor_next_timeout(struct reactor *r)
+{
+	uint64_t now;
+	
+	if(r->timers == NULL)
+		return(-1);
+	
+	if((now = reactor_time()) >= r->timers->deadline)
+		return(0);
+	
+	if(r->timers->deadline-now > INT_MAX)
+		return(INT_MAX);
+	
+	return((int)(r->timers->deadline-now));
+}
+
+/*
+ * Call every handler that asked to be called once this loop iteration's
+ * events have all been dispatched.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_run_deferred(struct reactor *r)
+{
+	struct reactor_handler *h;
+	
+	while((h = r->deferred) != NULL)
+	{
+		r->deferred = h->d_next;
+		h->d_next = NULL;
+		h->deferred = 0;
+		
+		if(!h->removed)
+			(*h->callback)(h, REACTOR_FLUSH);
+	}
+}
+
+/*
+ * Free handlers that have been removed, once nothing can reference them.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_reap(struct reactor *r)
+{
+	struct reactor_handler **hp = &r->dead;
+	
+	while(*hp != NULL)
+	{
+		struct reactor_handler *h = *hp;
+		
+		/* The kernel may still complete requests made for it. */
+		if(h->pending > 0)
+		{
+			hp = &h->next;
+			continue;
+		}
+		
+		*hp = h->next;
+		if(h->reap != NULL)
+			(*h->reap)(h->arg);
+		free(h);
+	}
+}
+
+/*
+ * Wait for events with epoll and dispatch them.
+ * Return value:
+ *   Returns 0 on success, or -1 if the reactor can't go on.
+ */
+static int
+reactor_epoll_wait(struct reactor *r, int timeout)
+{
+	int i, nfds;
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	
+	if((nfds = epoll_wait(r->epfd, events, REACTOR_MAX_EVENTS, timeout)) == -1)
+	{
+		if(errno == EINTR)
+			return(0);
+		
+		perror("[ERROR] reactor_thread(): epoll_wait()");
+		return(-1);
+	}
+	
+	for(i = 0; i < nfds; i++)
+	{
+		int ev = 0;
+		struct reactor_handler *h = events[i].data.ptr;
+		
+		/* Our eventfd is the only descriptor without a handler. */
+		if(h == NULL)
+		{
+			reactor_run_tasks(r);
+			continue;
+		}
+		
+		/* Skip handlers removed earlier in this batch. */
+		if(h->removed)
+			continue;
+		
+		if(events[i].events & EPOLLIN)
+			ev |= REACTOR_READ;
+		if(events[i].events & EPOLLOUT)
+			ev |= REACTOR_WRITE;
+		if(events[i].events & (EPOLLERR|EPOLLHUP))
+			ev |= REACTOR_ERROR;
+		
+		(*h->callback)(h, ev);
+	}
+	
+	return(0);
+}
+
+#ifdef WITH_URING
+/*
+ * Translate a handler's events into a poll mask. Reads are left out when
+ * the kernel is already receiving for the handler.
+ * Return value:
+ *   Returns the poll event mask.
+ */
+static uint32_t
+reactor_poll_events(struct reactor_handler *h)
+{
+	uint32_t ev = 0;
+	
+	if((h->events & REACTOR_READ) && !h->recving)
+		ev |= POLLIN|POLLRDHUP;
+	if(h->events & REACTOR_WRITE)
+		ev |= POLLOUT;
+	
+	return(ev);
+}
+
+/*
+ * Queue a multishot poll for a handler, or for our eventfd if h is NULL.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_uring_poll(struct reactor *r, struct reactor_handler *h)
+{
+	struct io_uring_sqe *sqe;
+	
+	if((sqe = uring_sqe(r->uring)) == NULL)
+	{
+		perror("[ERROR] reactor_uring_poll(): uring_sqe()");
+		return;
+	}
+	
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	
+	if(h == NULL)
+	{
+		sqe->fd = r->wakefd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = REACTOR_OP_WAKE;
+		return;
+	}
+	
+	sqe->fd = h->fd;
+	sqe->poll32_events = reactor_poll_events(h);
+	sqe->user_data = (uintptr_t)h|REACTOR_OP_POLL;
+	
+	h->polling = 1;
+	h->pending++;
+}
+
+/*
+ * Change the mask of a handler's poll in place, or arm one if there is
+ * none at the moment.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_uring_update(struct reactor_handler *h)
+{
+	struct io_uring_sqe *sqe;
+	
+	if(!h->polling)
+	{
+		reactor_uring_poll(h->reactor, h);
+		return;
+	}
+	
+	if((sqe = uring_sqe(h->reactor->uring)) == NULL)
+	{
+		perror("[ERROR] reactor_uring_update(): uring_sqe()");
+		return;
+	}
+	
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = (uintptr_t)h|REACTOR_OP_POLL;
+	sqe->len = IORING_POLL_UPDATE_EVENTS|IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = reactor_poll_events(h);
+}
+
+/*
+ * Queue a multishot receive for a handler. The kernel picks one of our
+ * registered buffers whenever data arrives.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_uring_recv(struct reactor_handler *h)
+{
+	struct io_uring_sqe *sqe;
+	
+	if((sqe = uring_sqe(h->reactor->uring)) == NULL)
+	{
+		perror("[ERROR] reactor_uring_recv(): uring_sqe()");
+		return;
+	}
+	
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = h->fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = (uintptr_t)h|REACTOR_OP_RECV;
+	
+	h->pending++;
+}
+
+/*
+ * Handle a poll completion.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_uring_polled(struct reactor_handler *h, int res, u_int flags)
+{
+	int ev = 0;
+	
+	if(!(flags & IORING_CQE_F_MORE))
+	{
+		h->polling = 0;
+		h->pending--;
+	}
+	
+	if(h->removed || res == -ECANCELED)
+		return;
+	
+	if(res < 0)
+		ev = REACTOR_ERROR;
+	else
+	{
+		if(res & (POLLIN|POLLRDHUP))
+			ev |= REACTOR_READ;
+		if(res & POLLOUT)
+			ev |= REACTOR_WRITE;
+		if(res & (POLLERR|POLLHUP))
+			ev |= REACTOR_ERROR;
+	}
+	
+	if(ev != 0)
+		(*h->callback)(h, ev);
+	
+	/* The kernel may end a multishot poll on its own. */
+	if(res >= 0 && !h->removed && !h->polling)
+		reactor_uring_poll(h->reactor, h);
+}
+
+/*
+ * Handle a receive completion. The buffer is lent to the handler until
+ * it calls reactor_recv_done().
+ * Return value:
+ *   None.
+ */
+static void
+reactor_uring_recvd(struct reactor_handler *h, int res, u_int flags)
+{
+	struct reactor *r = h->reactor;
+	int more = (flags & IORING_CQE_F_MORE);
+	
+	if(!more)
+		h->pending--;
+	
+	if(h->removed)
+	{
+		if(flags & IORING_CQE_F_BUFFER)
+			uring_buf_release(r->uring, flags >> IORING_CQE_BUFFER_SHIFT);
+		return;
+	}
+	
+	switch(res)
+	{
+		case -ECANCELED:
+			return;
+		case -ENOBUFS:
+			/* Everyone is holding on to buffers, try again once one is back. */
+			if(!h->starved)
+			{
+				h->starved = 1;
+				h->s_next = r->starved;
+				r->starved = h;
+			}
+			return;
+		case -EINVAL:
+			/* No multishot receive here, go back to polling for reads. */
+			h->recving = 0;
+			reactor_uring_update(h);
+			(*h->callback)(h, REACTOR_READ);
+			return;
+	}
+	
+	h->result = res;
+	h->rx_data = NULL;
+	
+	if(res > 0 && (flags & IORING_CQE_F_BUFFER))
+	{
+		h->rx_bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		h->rx_data = uring_buf(r->uring, h->rx_bid);
+	}
+	
+	(*h->callback)(h, REACTOR_RECV);
+	
+	if(res > 0 && !more && !h->removed)
+		reactor_uring_recv(h);
+}
+
+/*
+ * Submit queued requests, wait for completions with io_uring and dispatch
+ * them.
+ * Return value:
+ *   Returns 0 on success, or -1 if the reactor can't go on.
+ */
+static int
+reactor_uring_wait(struct reactor *r, int timeout)
+{
+	struct io_uring_cqe *cqe;
+	struct reactor_handler *h;
+	
+	/*
+	 * Retry cancels there was no room for. The descriptor is closed by
+	 * now and its number may be in use again, so go by our own request
+	 * tags instead.
+	 */
+	for(h = r->dead; h != NULL; h = h->next)
+	{
+		int op;
+		
+		if(!h->cancel || h->pending == 0)
+			continue;
+		
+		h->cancel = 0;
+		for(op = REACTOR_OP_POLL; op <= REACTOR_OP_SEND; op++)
+		{
+			struct io_uring_sqe *sqe = uring_sqe(r->uring);
+			
+			if(sqe == NULL)
+			{
+				h->cancel = 1;
+				break;
+			}
+			
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (uintptr_t)h|op;
+			sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+		}
+	}
+	
+	/* Buffers came back, let starved handlers receive again. */
+	if(r->refilled)
+	{
+		r->refilled = 0;
+		
+		while(r->starved != NULL)
+		{
+			struct reactor_handler *h = r->starved;
+			
+			r->starved = h->s_next;
+			h->s_next = NULL;
+			h->starved = 0;
+			reactor_uring_recv(h);
+		}
+	}
+	
+	if(uring_wait(r->uring, timeout) == -1)
+	{
+		perror("[ERROR] reactor_thread(): uring_wait()");
+		return(-1);
+	}
+	
+	while((cqe = uring_cqe(r->uring)) != NULL)
+	{
+		int res = cqe->res;
+		u_int flags = cqe->flags;
+		uint64_t data = cqe->user_data;
+		
+		/* Free the slot first, callbacks may cause more completions. */
+		uring_cqe_seen(r->uring);
+		h = (struct reactor_handler *)(uintptr_t)(data & ~(uint64_t)REACTOR_OP_MASK);
+		
+		switch(data & REACTOR_OP_MASK)
+		{
+			case REACTOR_OP_WAKE:
+				reactor_run_tasks(r);
+				if(!(flags & IORING_CQE_F_MORE))
+					reactor_uring_poll(r, NULL);
+				break;
+			case REACTOR_OP_POLL:
+				reactor_uring_polled(h, res, flags);
+				break;
+			case REACTOR_OP_RECV:
+				reactor_uring_recvd(h, res, flags);
+				break;
+			case REACTOR_OP_SEND:
+				h->pending--;
+				if(!h->removed)
+				{
+					h->result = res;
+					(*h->callback)(h, REACTOR_SENT);
+				}
+				break;
+			default:
+				/* Results of poll updates and cancellations. */
+				break;
+		}
+	}
+	
+	return(0);
+}
+#endif /* WITH_URING */
+
+/*
+ * Event loop for a single reactor thread. Every connection registered
+ * with this reactor is serviced from here.
+ * Return value:
+ *   None.
+ */
+static void *
+reactor_thread(void *arg)
+{
+	int status, timeout;
+	struct reactor *r = (struct reactor *)arg;
+	
+	pthread_setspecific(m_reactor, r);
+	
+	while(1)
+	{
+		reactor_run_timers(r);
+		reactor_run_deferred(r);
+		reactor_reap(r);
+		
+		timeout = reactor_next_timeout(r);
+
+#ifdef WITH_URING
+		if(r->uring != NULL)
+			status = reactor_uring_wait(r, timeout);
+		else
+#endif /* WITH_URING */
+			status = reactor_epoll_wait(r, timeout);
+		
+		if(status == -1)
+			break;
+	}
+	
+	return(NULL);
+}
+
+#ifdef WITH_URING
+/*
+ * Try to give a reactor an io_uring instance instead of epoll.
+ * Return value:
+ *   Returns 0 on success, or -1 if the kernel won't let us.
+ */
+static int
+reactor_uring_new(struct reactor *r)
+{
+	static int warned;
+	
+	if((r->uring = malloc(sizeof(*r->uring))) == NULL)
+		return(-1);
+	
+	if(uring_init(r->uring, URING_ENTRIES) == -1)
+	{
+		/* Old kernels and seccomp filters are common, epoll will do. */
+		if(!warned++)
+			perror("[NOTICE] io_uring unavailable, using epoll");
+		
+		free(r->uring);
+		r->uring = NULL;
+		return(-1);
+	}
+	
+	reactor_uring_poll(r, NULL);
+	
+	return(0);
+}
+#endif /* WITH_URING */
+
+/*
+ * Create a new reactor and its io_uring or epoll instance.
+ * Return value:
+ *   Returns a new reactor, or NULL on error.
+ */
+static struct reactor *
+reactor_new(u_int id)
+{
+	struct epoll_event ev;
+	struct reactor *r;
+	
+	if((r = calloc(1, sizeof(*r))) == NULL)
+		return(NULL);
+	
+	r->r_id = id;
+	r->epfd = -1;
+	pthread_mutex_init(&r->mtx_tasks, NULL);
+	
+	if((r->wakefd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1)
+	{
+		perror("[ERROR] reactor_new(): eventfd()");
+		goto err_eventfd;
+	}
+	
+#ifdef WITH_URING
+	if(reactor_uring_new(r) == 0)
+		return(r);
+#endif /* WITH_URING */
+	
+	if((r->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+	{
+		perror("[ERROR] reactor_new(): epoll_create1()");
+		goto err_epoll;
+	}
+	
+	/* Register our wake up descriptor, it has no handler. */
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	
+	if(epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakefd, &ev) == -1)
+	{
+		perror("[ERROR] reactor_new(): epoll_ctl()");
+		goto err_ctl;
+	}
+	
+	return(r);
+
+err_ctl:
+	close(r->epfd);
+err_epoll:
+	close(r->wakefd);
+err_eventfd:
+	free(r);
+	return(NULL);
+}
+
+/*
+ * Start a pool of reactor threads. Bots are spread across these threads
+ * instead of each getting a thread of their own.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+reactor_init(u_int threads)
+{
+	u_int i;
+	pthread_attr_t attr;
+	
+	/* Make sure we haven't already been started. */
+	if(reactors != NULL)
+		return(-1);
+	
+	if(threads < 1)
+		threads = REACTOR_DEFAULT_THREADS;
+	else if(threads > REACTOR_MAX_THREADS)
+		threads = REACTOR_MAX_THREADS;
+	
+	if((reactors = calloc(threads, sizeof(*reactors))) == NULL)
+		return(-1);
+	
+	/* Our reactor threads live forever, so make them detachable. */
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	for(i = 0; i < threads; i++)
+	{
+		struct reactor *r;
+		
+		if((r = reactor_new(i+1)) == NULL)
+			break;
+		
+		if(pthread_create(&r->thread_id, &attr, reactor_thread, r) != 0)
+		{
+			perror("[ERROR] reactor_init(): pthread_create()");
+#ifdef WITH_URING
+			if(r->uring != NULL)
+			{
+				uring_free(r->uring);
+				free(r->uring);
+			}
+#endif /* WITH_URING */
+			if(r->epfd != -1)
+				close(r->epfd);
+			close(r->wakefd);
+			free(r);
+			break;
+		}
+		
+		reactors[reactor_count++] = r;
+	}
+	
+	pthread_attr_destroy(&attr);
+	
+	return(reactor_count > 0 ? 0 : -1);
+}
+
+/*
+ * Choose the least loaded reactor for a new connection.
+ * Return value:
+ *   Returns a reactor, or NULL if none are running.
+ */
+struct reactor *
+reactor_pick(void)
+{
+	u_int i;
+	struct reactor *r = NULL;
+	
+	pthread_mutex_lock(&mtx_reactors);
+	
+	for(i = 0; i < reactor_count; i++)
+	{
+		if(r == NULL || reactors[i]->r_load < r->r_load)
+			r = reactors[i];
+	}
+	
+	if(r != NULL)
+		r->r_load++;
+	
+	pthread_mutex_unlock(&mtx_reactors);
+	
+	return(r);
+}
+
+/*
+ * Give back a reactor picked by reactor_pick().
+ * Return value:
+ *   None.
+ */
+void
+reactor_release(struct reactor *r)
+{
+	if(r == NULL)
+		return;
+	
+	pthread_mutex_lock(&mtx_reactors);
+	if(r->r_load > 0)
+		r->r_load--;
+	pthread_mutex_unlock(&mtx_reactors);
+}
+
+/*
+ * Queue a function to be run on a reactor's thread. This is the only
+ * reactor function that is safe to call from any thread.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+reactor_call(struct reactor *r, void (*callback)(void *), void *arg)
+{
+	uint64_t one = 1;
+	struct reactor_task *task;
+	
+	if(r == NULL || callback == NULL)
+		return(-1);
+	
+	if((task = calloc(1, sizeof(*task))) == NULL)
+		return(-1);
+	
+	task->callback = callback;
+	task->arg = arg;
+	
+	pthread_mutex_lock(&r->mtx_tasks);
+	if(r->t_last == NULL)
+		r->t_first = r->t_last = task;
+	else
+		r->t_last = r->t_last->next = task;
+	pthread_mutex_unlock(&r->mtx_tasks);
+	
+	/* Kick the reactor out of epoll_wait(). */
+	if(write(r->wakefd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+		perror("[ERROR] reactor_call(): write()");
+	
+	return(0);
+}
+
+/*
+ * Sit in a task until reactor_resume(), so nothing else runs on this
+ * reactor in the meantime.
+ * Return value:
+ *   None.
+ */
+static void
+reactor_park(void *arg)
+{
+	(void)arg;
+	
+	pthread_mutex_lock(&mtx_pause);
+	reactor_parked++;
+	pthread_cond_broadcast(&cond_pause);
+	
+	while(reactor_paused)
+		pthread_cond_wait(&cond_pause, &mtx_pause);
+	
+	reactor_parked--;
+	pthread_mutex_unlock(&mtx_pause);
+}
+
+/*
+ * Bring every reactor to a stop between events, after which the caller
+ * may look at anything the reactors own. Not to be called from a reactor
+ * thread, it would wait for itself.
+ * Return value:
+ *   Returns 0 once all reactors are parked, or -1 on failure.
+ */
+int
+reactor_pause(void)
+{
+	u_int i;
+	
+	pthread_mutex_lock(&mtx_pause);
+	reactor_paused = 1;
+	pthread_mutex_unlock(&mtx_pause);
+	
+	for(i = 0; i < reactor_count; i++)
+	{
+		if(reactor_call(reactors[i], reactor_park, NULL) == -1)
+		{
+			reactor_resume();
+			return(-1);
+		}
+	}
+	
+	pthread_mutex_lock(&mtx_pause);
+	while(reactor_parked < reactor_count)
+		pthread_cond_wait(&cond_pause, &mtx_pause);
+	pthread_mutex_unlock(&mtx_pause);
+	
+	return(0);
+}
+
+/*
+ * Let reactors stopped by reactor_pause() carry on.
+ * Return value:
+ *   None.
+ */
+void
+reactor_resume(void)
+{
+	pthread_mutex_lock(&mtx_pause);
+	reactor_paused = 0;
+	pthread_cond_broadcast(&cond_pause);
+	pthread_mutex_unlock(&mtx_pause);
+}
+
+/*
+ * Translate our event bitmap into epoll's.
+ * Return value:
+ *   Returns the epoll event mask.
+ */
+static uint32_t
+reactor_epoll_events(int events)
+{
+	uint32_t ev = 0;
+	
+	if(events & REACTOR_READ)
+		ev |= EPOLLIN|EPOLLRDHUP;
+	if(events & REACTOR_WRITE)
+		ev |= EPOLLOUT;
+	
+	return(ev);
+}
+
+/*
+ * Register a file descriptor with a reactor. The callback will be run on
+ * the reactor's thread whenever one of events is ready.
+ * Return value:
+ *   Returns a handler for the descriptor, or NULL on error.
+ */
+struct reactor_handler *
+reactor_add(struct reactor *r, int fd, int events,
+			void (*callback)(struct reactor_handler *, int), void *arg)
+{
+	struct epoll_event ev;
+	struct reactor_handler *h;
+	
+	/* Sanity checks. */
+	if(r == NULL || fd < 0 || callback == NULL)
+		return(NULL);
+	
+	if((h = calloc(1, sizeof(*h))) == NULL)
+		return(NULL);
+	
+	h->fd = fd;
+	h->events = events;
+	h->callback = callback;
+	h->arg = arg;
+	h->reactor = r;
+	
+#ifdef WITH_URING
+	if(r->uring != NULL)
+	{
+		reactor_uring_poll(r, h);
+		return(h);
+	}
+#endif /* WITH_URING */
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = reactor_epoll_events(events);
+	ev.data.ptr = h;
+	
+	if(epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+	{
+		perror("[ERROR] reactor_add(): epoll_ctl()");
+		free(h);
+		return(NULL);
+	}
+	
+	return(h);
+}
+
+/*
+ * Change the events a handler is interested in.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+reactor_modify(struct reactor_handler *h, int events)
+{
+	struct epoll_event ev;
+	
+	if(h == NULL || h->removed)
+		return(-1);
+	
+	if(h->events == events)
+		return(0);
+	
+#ifdef WITH_URING
+	if(h->reactor->uring != NULL)
+	{
+		h->events = events;
+		reactor_uring_update(h);
+		return(0);
+	}
+#endif /* WITH_URING */
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = reactor_epoll_events(events);
+	ev.data.ptr = h;
+	
+	if(epoll_ctl(h->reactor->epfd, EPOLL_CTL_MOD, h->fd, &ev) == -1)
+	{
+		perror("[ERROR] reactor_modify(): epoll_ctl()");
+		return(-1);
+	}
+	
+	h->events = events;
+	
+	return(0);
+}
+
+/*
+ * Unregister a handler. Must be called from the reactor's own thread and
+ * before the descriptor is closed. The handler is freed once the current
+ * batch of events has been dispatched.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+reactor_remove(struct reactor_handler *h)
+{
+	struct reactor *r;
+	
+	if(h == NULL || h->removed)
+		return(-1);
+	
+	r = h->reactor;
+
+#ifdef WITH_URING
+	if(r->uring != NULL)
+	{
+		struct reactor_handler **hp;
+		
+		/* Stop waiting for buffers on its behalf. */
+		for(hp = &r->starved; *hp != NULL; hp = &(*hp)->s_next)
+		{
+			if(*hp == h)
+			{
+				*hp = h->s_next;
+				break;
+			}
+		}
+		
+		/*
+		 * Cancel whatever the kernel is doing for this descriptor. This
+		 * can't wait for the next loop, the caller is about to close it.
+		 */
+		if(h->pending > 0)
+		{
+			struct io_uring_sqe *sqe = uring_sqe(r->uring);
+			
+			if(sqe != NULL)
+			{
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->fd = h->fd;
+				sqe->cancel_flags = IORING_ASYNC_CANCEL_FD|IORING_ASYNC_CANCEL_ALL;
+			}
+			else
+				h->cancel = 1;
+			
+			uring_submit(r->uring);
+		}
+	}
+	else
+#endif /* WITH_URING */
+		epoll_ctl(r->epfd, EPOLL_CTL_DEL, h->fd, NULL);
+	
+	h->removed = 1;
+	h->next = r->dead;
+	r->dead = h;
+	
+	return(0);
+}
+
+
+/*
+ * Unregister a handler like reactor_remove(), and call reap with its arg
+ * once the handler itself is freed. With io_uring that is only after the
+ * kernel is done with every request made for it, so memory handed to
+ * reactor_send() can be freed by reap.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+reactor_remove_free(struct reactor_handler *h, void (*reap)(void *))
+{
+	if(h == NULL)
+		return(-1);
+	
+	h->reap = reap;
+	if(!h->removed)
+		reactor_remove(h);
+	
+	return(0);
+}
+/*
+ * Ask for a handler's callback to be run with REACTOR_FLUSH once all of
+ * the current loop iteration's events have been dispatched. Asking more
+ * than once per iteration only gets one call.
+ * Return value:
+ *   None.
+ */
+void
+reactor_defer(struct reactor_handler *h)
+{
+	if(h == NULL || h->removed || h->deferred)
+		return;
+	
+	h->deferred = 1;
+	h->d_next = h->reactor->deferred;
+	h->reactor->deferred = h;
+}
+
+/*
+ * Have the kernel receive for a handler as data arrives, instead of
+ * telling us when we may read. Data is handed to the callback with
+ * REACTOR_RECV, h->rx_data and h->result hold the bytes received, zero
+ * on EOF or a negative errno value. Only possible with io_uring.
+ * Return value:
+ *   Returns 0 on success, or -1 if the owner must read for itself.
+ */
+int
+reactor_recv(struct reactor_handler *h)
+{
+#ifdef WITH_URING
+	if(h != NULL && !h->removed && h->reactor->uring != NULL)
+	{
+		if(!h->recving)
+		{
+			h->recving = 1;
+			reactor_uring_recv(h);
+			reactor_uring_update(h);
+		}
+		
+		return(0);
+	}
+#else
+	(void)h;
+#endif /* WITH_URING */
+	
+	return(-1);
+}
+
+/*
+ * Give back a receive buffer handed over with REACTOR_RECV.
+ * Return value:
+ *   None.
+ */
+void
+reactor_recv_done(struct reactor_handler *h, u_int bid)
+{
+#ifdef WITH_URING
+	if(h != NULL && h->reactor->uring != NULL)
+	{
+		uring_buf_release(h->reactor->uring, bid);
+		h->reactor->refilled = 1;
+	}
+#else
+	(void)h;
+	(void)bid;
+#endif /* WITH_URING */
+}
+
+/*
+ * Have the kernel write iov to a handler's descriptor. The callback gets
+ * REACTOR_SENT once it is done, with the byte count or a negative errno
+ * value in h->result. iov must stay put until then. Only possible with
+ * io_uring.
+ * Return value:
+ *   Returns 0 on success, or -1 if the owner must write for itself.
+ */
+int
+reactor_send(struct reactor_handler *h, const struct iovec *iov, int iovcnt)
+{
+#ifdef WITH_URING
+	struct io_uring_sqe *sqe;
+	
+	if(h != NULL && !h->removed && h->reactor->uring != NULL &&
+	   (sqe = uring_sqe(h->reactor->uring)) != NULL)
+	{
+		sqe->opcode = IORING_OP_WRITEV;
+		sqe->fd = h->fd;
+		sqe->addr = (uintptr_t)iov;
+		sqe->len = iovcnt;
+		sqe->off = (uint64_t)-1;
+		sqe->user_data = (uintptr_t)h|REACTOR_OP_SEND;
+		
+		h->pending++;
+		return(0);
+	}
+#else
+	(void)h;
+	(void)iov;
+	(void)iovcnt;
+#endif /* WITH_URING */
+	
+	return(-1);
+}
+
+/*
+ * Arm a timer to call callback after ms milliseconds. Timers are owned by
+ * the caller and may be rearmed from within their own callback.
+ * Return value:
+ *   None.
+ */
+void
+reactor_timer_set(struct reactor *r, struct reactor_timer *t, u_int ms,
+				  void (*callback)(void *), void *arg)
+{
+	struct reactor_timer *cur;
+	
+	if(r == NULL || t == NULL)
+		return;
+	
+	if(t->armed)
+		reactor_timer_cancel(t);
+	
+	t->armed = 1;
+	t->deadline = reactor_time()+ms;
+	t->callback = callback;
+	t->arg = arg;
+	t->reactor = r;
+	
+	/* Keep the list sorted by deadline, soonest first. */
+	if(r->timers == NULL || t->deadline < r->timers->deadline)
+	{
+		t->prev = NULL;
+		t->next = r->timers;
+		if(r->timers != NULL)
+			r->timers->prev = t;
+		r->timers = t;
+		return;
+	}
+	
+	for(cur = r->timers;
+		cur->next != NULL && cur->next->deadline <= t->deadline;
+		cur = cur->next);
+	
+	t->prev = cur;
+	t->next = cur->next;
+	if(cur->next != NULL)
+		cur->next->prev = t;
+	cur->next = t;
+}
+
+/*
+ * Disarm a timer if it is armed.
+ * Return value:
+ *   None.
+ */
+void
+reactor_timer_cancel(struct reactor_timer *t)
+{
+	if(t == NULL || !t->armed)
+		return;
+	
+	/* Pointer dance. */
+	if(t->prev != NULL)
+		t->prev->next = t->next;
+	else
+		t->reactor->timers = t->next;
+	
+	if(t->next != NULL)
+		t->next->prev = t->prev;
+	
+	t->armed = 0;
+	t->prev = t->next = NULL;
+}
@@ -0,0 +1,377 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "resolver.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <netinet/in.h>
+#include <resolv.h>
+
+
+static struct resolver_entry *cache;
+static struct resolver_entry *q_first;
+static struct resolver_entry *q_last;
+static pthread_mutex_t mtx_resolver = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_resolver = PTHREAD_COND_INITIALIZER;
+static int started;
+static int stopping;
+static u_int busy;
+
+
+/*
+ * Drop a reference to an entry, mtx_resolver must be held.
+ * Return value:
+ *   None.
+ */
+static void
+resolver_unref(struct resolver_entry *e)
+{
+	if(--e->refs > 0)
+		return;
+	
+	if(e->ai != NULL)
+		freeaddrinfo(e->ai);
+	
+	free(e->host);
+	free(e->port);
+	free(e);
+}
+
+/*
+ * Give back an entry handed to a lookup callback.
+ * Return value:
+ *   None.
+ */
+void
+resolver_release(struct resolver_entry *e)
+{
+	if(e == NULL)
+		return;
+	
+	pthread_mutex_lock(&mtx_resolver);
+	resolver_unref(e);
+	pthread_mutex_unlock(&mtx_resolver);
+}
+
+/*
+ * Run a lookup callback on the thread of the reactor that asked for it.
+ * Return value:
+ *   None.
+ */
+static void
+resolver_deliver(void *arg)
+{
+	struct resolver_waiter *w = (struct resolver_waiter *)arg;
+	
+	(*w->callback)(w->entry, w->arg);
+	free(w);
+}
+
+/*
+ * Send an entry to a waiter, which now owns one reference to it.
+ * Return value:
+ *   None.
+ */
+static void
+resolver_notify(struct resolver_waiter *w)
+{
+	if(reactor_call(w->reactor, resolver_deliver, w) == -1)
+	{
+		/* Nobody will ever hear about it, don't leak it. */
+		resolver_release(w->entry);
+		free(w);
+	}
+}
+
+/*
+ * Ask DNS how long the addresses for host may be kept. getaddrinfo()
+ * doesn't tell us, so the A and AAAA records are queried for their TTL.
+ * Return value:
+ *   Returns the number of seconds to cache the addresses for.
+ */
+static u_int
+resolver_ttl(res_state res, const char *host)
+{
+	int i, j, len;
+	u_int ttl = 0;
+	int types[] = { ns_t_a, ns_t_aaaa };
+	u_char answer[NS_PACKETSZ*4];
+	struct in6_addr addr;
+	
+	/* Numeric addresses never change on us. */
+	if(inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1)
+		return(RESOLVER_MAXTTL);
+	
+	for(i = 0; i < 2; i++)
+	{
+		ns_msg msg;
+		ns_rr rr;
+		
+		if((len = res_nquery(res, host, ns_c_in, types[i], answer, sizeof(answer))) < 0)
+			continue;
+		
+		if(ns_initparse(answer, len, &msg) == -1)
+			continue;
+		
+		/* The whole answer, CNAMEs included, is only good as its shortest TTL. */
+		for(j = 0; j < ns_msg_count(msg, ns_s_an); j++)
+		{
+			if(ns_parserr(&msg, ns_s_an, j, &rr) == 0 && (ttl == 0 || ns_rr_ttl(rr) < ttl))
+				ttl = ns_rr_ttl(rr);
+		}
+	}
+	
+	if(ttl == 0)
+		return(RESOLVER_TTL);
+	
+	if(ttl < RESOLVER_MINTTL)
+		ttl = RESOLVER_MINTTL;
+	else if(ttl > RESOLVER_MAXTTL)
+		ttl = RESOLVER_MAXTTL;
+	
+	return(ttl);
+}
+
+/*
+ * Resolver worker. Blocking lookups happen here so no reactor ever has to
+ * wait on DNS.
+ * Return value:
+ *   None.
+ */
+static void *
+resolver_thread(void *arg)
+{
+	int status;
+	u_int ttl;
+	struct __res_state res;
+	struct addrinfo hints, *ai;
+	struct resolver_entry *e;
+	struct resolver_waiter *w, *next;
+	
+	(void)arg;
+	
+	memset(&res, 0, sizeof(res));
+	res_ninit(&res);
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	
+	while(1)
+	{
+		pthread_mutex_lock(&mtx_resolver);
+		while(q_first == NULL || stopping)
+			pthread_cond_wait(&cond_resolver, &mtx_resolver);
+		
+		e = q_first;
+		if((q_first = e->q_next) == NULL)
+			q_last = NULL;
+		busy++;
+		pthread_mutex_unlock(&mtx_resolver);
+		
+		ai = NULL;
+		if((status = getaddrinfo(e->host, e->port, &hints, &ai)) == 0)
+			ttl = resolver_ttl(&res, e->host);
+		else
+			ttl = RESOLVER_NEGTTL;
+		
+		/* Everyone who asked in the meantime gets the same answer. */
+		pthread_mutex_lock(&mtx_resolver);
+		e->ai = ai;
+		e->status = status;
+		e->expires = reactor_time()+(uint64_t)ttl*1000;
+		e->pending = 0;
+		w = e->waiters;
+		e->waiters = NULL;
+		pthread_mutex_unlock(&mtx_resolver);
+		
+		for(; w != NULL; w = next)
+		{
+			next = w->next;
+			resolver_notify(w);
+		}
+		
+		pthread_mutex_lock(&mtx_resolver);
+		if(--busy == 0 && stopping)
+			pthread_cond_broadcast(&cond_resolver);
+		pthread_mutex_unlock(&mtx_resolver);
+	}
+	
+	return(NULL);
+}
+
+/*
+ * Start the resolver's worker threads.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+resolver_init(u_int threads)
+{
+	u_int i;
+	pthread_t thread_id;
+	pthread_attr_t attr;
+	
+	if(started)
+		return(-1);
+	
+	if(threads < 1)
+		threads = RESOLVER_THREADS;
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	for(i = 0; i < threads; i++)
+	{
+		if(pthread_create(&thread_id, &attr, resolver_thread, NULL) != 0)
+		{
+			perror("[ERROR] resolver_init(): pthread_create()");
+			break;
+		}
+		
+		started++;
+	}
+	
+	pthread_attr_destroy(&attr);
+	
+	return(started > 0 ? 0 : -1);
+}
+
+/*
+ * Stop the worker threads from taking any more lookups, and wait for the
+ * ones in progress to be delivered.
+ * Return value:
+ *   None.
+ */
+void
+resolver_stop(void)
+{
+	pthread_mutex_lock(&mtx_resolver);
+	stopping = 1;
+	while(busy > 0)
+		pthread_cond_wait(&cond_resolver, &mtx_resolver);
+	pthread_mutex_unlock(&mtx_resolver);
+}
+
+/*
+ * Look up host and port without blocking. The callback is run on r's
+ * thread with an entry holding the result, which it must give back with
+ * resolver_release(). Results are cached for their DNS TTL and shared by
+ * everyone asking for the same host and port, and only one lookup is ever
+ * in flight for them.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+resolver_lookup(struct reactor *r, const char *host, const char *port,
+				void (*callback)(struct resolver_entry *, void *), void *arg)
+{
+	uint64_t now = reactor_time();
+	struct resolver_entry *e, **ep;
+	struct resolver_waiter *w;
+	
+	if(r == NULL || host == NULL || port == NULL || callback == NULL)
+		return(-1);
+	
+	if((w = calloc(1, sizeof(*w))) == NULL)
+		return(-1);
+	
+	w->reactor = r;
+	w->callback = callback;
+	w->arg = arg;
+	
+	pthread_mutex_lock(&mtx_resolver);
+	
+	/* Look for a cached answer, clearing out stale ones as we go. */
+	for(ep = &cache; (e = *ep) != NULL;)
+	{
+		if(!e->pending && e->expires <= now)
+		{
+			*ep = e->next;
+			resolver_unref(e);
+			continue;
+		}
+		
+		if(strcasecmp(e->host, host) == 0 && strcmp(e->port, port) == 0)
+			break;
+		
+		ep = &e->next;
+	}
+	
+	if(e == NULL)
+	{
+		/* New to us, the cache keeps one reference of its own. */
+		if((e = calloc(1, sizeof(*e))) == NULL ||
+		   (e->host = strdup(host)) == NULL || (e->port = strdup(port)) == NULL)
+		{
+			pthread_mutex_unlock(&mtx_resolver);
+			if(e != NULL)
+			{
+				free(e->host);
+				free(e);
+			}
+			free(w);
+			return(-1);
+		}
+		
+		e->refs = 1;
+		e->pending = 1;
+		e->next = cache;
+		cache = e;
+		
+		if(q_last == NULL)
+			q_first = q_last = e;
+		else
+			q_last = q_last->q_next = e;
+		
+		pthread_cond_signal(&cond_resolver);
+	}
+	
+	e->refs++;
+	w->entry = e;
+	
+	if(e->pending)
+	{
+		w->next = e->waiters;
+		e->waiters = w;
+		w = NULL;
+	}
+	
+	pthread_mutex_unlock(&mtx_resolver);
+	
+	/* A cached answer still goes through the reactor, like any other. */
+	if(w != NULL)
+		resolver_notify(w);
+	
+	return(0);
+}
@@ -0,0 +1,430 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "irc_sched.h"
+#include "socket.h"
+
+
+static void sched_run(void *arg);
+
+/* Commands that may carry several targets, indexed by SCHED_JOIN and co. */
+static const char *sched_cmds[SCHED_MERGEABLE] = {"JOIN", "PART", "PRIVMSG", "NOTICE"};
+
+/*
+ * Work out if a line can be merged with others and where its list of
+ * targets ends. A JOIN with keys or a PART with a reason is left alone,
+ * as is anything without a proper target list.
+ * Return value:
+ *   Returns the command's index, or -1 if the line can't be merged.
+ */
+static int
+sched_kind(const char *data, size_t *start, size_t *end)
+{
+	int kind;
+	size_t n;
+	
+	for(kind = 0; kind < SCHED_MERGEABLE; kind++)
+	{
+		n = strlen(sched_cmds[kind]);
+		if(strncmp(data, sched_cmds[kind], n) == 0 && data[n] == ' ')
+			break;
+	}
+	
+	if(kind == SCHED_MERGEABLE)
+		return(-1);
+	
+	*start = n+1;
+	*end = *start+strcspn(data+*start, " \r");
+	
+	if(*end == *start)
+		return(-1);
+	if(kind == SCHED_JOIN || kind == SCHED_PART)
+		return(data[*end] == '\r' ? kind : -1);
+	return(strncmp(data+*end, " :", 2) == 0 ? kind : -1);
+}
+
+/*
+ * Count the targets in a comma separated list.
+ * Return value:
+ *   The number of targets.
+ */
+static u_int
+sched_targets(const char *list, size_t len)
+{
+	u_int n = 1;
+	
+	while(len-- > 0)
+		if(*list++ == ',')
+			n++;
+	
+	return(n);
+}
+
+/*
+ * Unlink the first line of the target after prev, freeing the target if
+ * that was its last line.
+ * Return value:
+ *   The line, which the caller frees.
+ */
+static struct sched_line *
+sched_pop(struct sched *q, int class, struct sched_target *prev)
+{
+	struct sched_target *t = prev->next;
+	struct sched_line *l = t->first;
+	
+	if((t->first = l->next) == NULL)
+	{
+		if(t == prev)
+			q->ring[class] = NULL;
+		else
+		{
+			prev->next = t->next;
+			if(q->ring[class] == t)
+				q->ring[class] = prev;
+		}
+		
+		free(t->name);
+		free(t);
+	}
+	q->queued--;
+	
+	return(l);
+}
+
+/*
+ * Fold queued lines into the one about to be sent, so a line costs one
+ * token however many targets it carries. Channels to join or part are
+ * packed from the lines right behind it, messages take the same text
+ * waiting at the head of other targets' queues. The server's TARGMAX and
+ * the 512 byte line limit decide how far this goes.
+ * Return value:
+ *   Returns buf if anything was merged, otherwise the line's own data.
+ */
+static const char *
+sched_merge(struct sched *q, int class, struct sched_target *t, char *buf)
+{
+	int kind;
+	u_int count;
+	size_t start, end, mstart, mend, len, tail;
+	struct sched_line *l = t->first, *m;
+	struct sched_target *p, *u;
+	
+	if((kind = sched_kind(l->data, &start, &end)) == -1 || q->targmax[kind] == 1)
+		return(l->data);
+	
+	/* Everything after the targets, less the CRLF, is shared. */
+	if((tail = strlen(l->data+end)) < 2 || strcmp(l->data+end+tail-2, "\r\n") != 0)
+		return(l->data);
+	tail -= 2;
+	len = end;
+	memcpy(buf, l->data, len);
+	count = sched_targets(l->data+start, end-start);
+	
+	if(kind == SCHED_JOIN || kind == SCHED_PART)
+	{
+		while((m = l->next) != NULL && sched_kind(m->data, &mstart, &mend) == kind &&
+			  len+1+mend-mstart <= SCHED_LINEMAX)
+		{
+			count += sched_targets(m->data+mstart, mend-mstart);
+			if(q->targmax[kind] != 0 && count > q->targmax[kind])
+				break;
+			
+			buf[len++] = ',';
+			memcpy(buf+len, m->data+mstart, mend-mstart);
+			len += mend-mstart;
+			
+			if((l->next = m->next) == NULL)
+				t->last = l;
+			q->queued--;
+			free(m);
+		}
+	}
+	else
+	{
+		for(p = t; (u = p->next) != t; p = u)
+		{
+			m = u->first;
+			if(sched_kind(m->data, &mstart, &mend) != kind ||
+			   strcmp(m->data+mend, l->data+end) != 0 ||
+			   len+1+mend-mstart+tail > SCHED_LINEMAX)
+				continue;
+			
+			if(q->targmax[kind] != 0 &&
+			   count+sched_targets(m->data+mstart, mend-mstart) > q->targmax[kind])
+				continue;
+			count += sched_targets(m->data+mstart, mend-mstart);
+			
+			buf[len++] = ',';
+			memcpy(buf+len, m->data+mstart, mend-mstart);
+			len += mend-mstart;
+			
+			/* If that emptied u, p now points past it. */
+			m = sched_pop(q, class, p);
+			free(m);
+			if(p->next != u)
+				u = p;
+		}
+	}
+	
+	if(len == end)
+		return(l->data);
+	
+	memcpy(buf+len, l->data+end, tail);
+	memcpy(buf+len+tail, "\r\n", 3);
+	
+	return(buf);
+}
+
+/*
+ * Send whatever the token bucket allows, highest class first and one line
+ * per target in turn within a class. If something is left over the timer
+ * brings us back once the next token has been earned.
+ * Return value:
+ *   None.
+ */
+static void
+sched_run(void *arg)
+{
+	int class, last;
+	char buf[SCHED_LINEMAX+3];
+	const char *data;
+	uint64_t now = reactor_time();
+	struct sched *q = (struct sched *)arg;
+	struct sched_target *t;
+	int64_t cap = (int64_t)q->burst*q->rate;
+	
+	q->tokens += now-q->stamp;
+	if(q->tokens > cap)
+		q->tokens = cap;
+	q->stamp = now;
+	
+	while(q->queued > 0)
+	{
+		for(class = 0; q->ring[class] == NULL; class++);
+		
+		/* Urgent lines never wait, though they still use up the budget. */
+		if(class != SCHED_URGENT && q->tokens < q->rate)
+		{
+			reactor_timer_set(q->reactor, &q->timer, q->rate-q->tokens, sched_run, q);
+			return;
+		}
+		
+		/* The ring points at the target served last, so take the next one. */
+		t = q->ring[class]->next;
+		data = sched_merge(q, class, t, buf);
+		socket_send(q->sock, data);
+		
+		/* Merging may have moved the ring, but it still sits right before t. */
+		last = (t->first->next == NULL);
+		free(sched_pop(q, class, q->ring[class]));
+		if(!last)
+			q->ring[class] = t;
+		
+		if((q->tokens -= q->rate) < -cap)
+			q->tokens = -cap;
+	}
+}
+
+/*
+ * Set up the output scheduler for a fresh connection. A rate of 0 turns
+ * flood control off.
+ * Return value:
+ *   None.
+ */
+void
+sched_init(struct sched *q, struct reactor *r, struct socket_in *s, u_int burst, u_int rate)
+{
+	sched_clear(q);
+	
+	q->burst = (burst > 0 ? burst : 1);
+	q->rate = rate;
+	q->tokens = (int64_t)q->burst*q->rate;
+	q->targmax[SCHED_JOIN] = q->targmax[SCHED_PART] = 0;
+	q->targmax[SCHED_PRIVMSG] = q->targmax[SCHED_NOTICE] = 1;
+	q->stamp = reactor_time();
+	q->sock = s;
+	q->reactor = r;
+}
+
+/*
+ * Queue a line for the server. Lines to the same target go out in order,
+ * lines to different targets take turns.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+int
+sched_push(struct sched *q, int class, const char *target, const char *line)
+{
+	size_t len = strlen(line);
+	struct sched_target *t = NULL;
+	struct sched_line *l;
+	
+	if(q->sock == NULL || class < 0 || class >= SCHED_CLASSES)
+		return(-1);
+	
+	if(target == NULL)
+		target = "";
+	
+	if((l = malloc(sizeof(*l)+len+1)) == NULL)
+		return(-1);
+	memcpy(l->data, line, len+1);
+	l->next = NULL;
+	
+	/* Find the target's queue, there are seldom more than a handful. */
+	if(q->ring[class] != NULL)
+	{
+		t = q->ring[class];
+		do
+		{
+			if(strcasecmp(t->name, target) == 0)
+				break;
+		}
+		while((t = t->next) != q->ring[class]);
+		
+		if(strcasecmp(t->name, target) != 0)
+			t = NULL;
+	}
+	
+	if(t != NULL)
+		t->last = t->last->next = l;
+	else
+	{
+		if((t = malloc(sizeof(*t))) == NULL || (t->name = strdup(target)) == NULL)
+		{
+			free(t);
+			free(l);
+			return(-1);
+		}
+		t->first = t->last = l;
+		
+		/* New targets wait for their turn behind everybody else. */
+		if(q->ring[class] == NULL)
+			t->next = t;
+		else
+		{
+			t->next = q->ring[class]->next;
+			q->ring[class]->next = t;
+		}
+		q->ring[class] = t;
+	}
+	q->queued++;
+	
+	/*
+	 * Urgent lines go right away. Anything else waits for the end of this
+	 * pass through the reactor, so lines queued together can be merged.
+	 */
+	if(class == SCHED_URGENT)
+		sched_run(q);
+	else if(q->timer.armed == 0)
+		reactor_timer_set(q->reactor, &q->timer, 0, sched_run, q);
+	
+	return(0);
+}
+
+/*
+ * Note how many targets the server takes for a command, as announced by
+ * TARGMAX in ISUPPORT. 0 means no limit, 1 turns merging off.
+ * Return value:
+ *   Returns 0 on success or -1 if the command isn't one we merge.
+ */
+int
+sched_targmax(struct sched *q, const char *cmd, u_int max)
+{
+	int kind;
+	
+	for(kind = 0; kind < SCHED_MERGEABLE; kind++)
+	{
+		if(strcasecmp(cmd, sched_cmds[kind]) == 0)
+		{
+			q->targmax[kind] = max;
+			return(0);
+		}
+	}
+	
+	return(-1);
+}
+
+/*
+ * Start over with a full bucket, for when the server has stopped counting
+ * what we sent so far.
+ * Return value:
+ *   None.
+ */
+void
+sched_refill(struct sched *q)
+{
+	q->tokens = (int64_t)q->burst*q->rate;
+	q->stamp = reactor_time();
+	
+	if(q->queued > 0)
+		reactor_timer_set(q->reactor, &q->timer, 0, sched_run, q);
+}
+
+/*
+ * Throw away everything still queued, used when the connection goes.
+ * Return value:
+ *   None.
+ */
+void
+sched_clear(struct sched *q)
+{
+	int class;
+	struct sched_target *t;
+	struct sched_line *l;
+	
+	reactor_timer_cancel(&q->timer);
+	
+	for(class = 0; class < SCHED_CLASSES; class++)
+	{
+		if(q->ring[class] == NULL)
+			continue;
+		
+		/* Break the ring open and walk it like a list. */
+		t = q->ring[class]->next;
+		q->ring[class]->next = NULL;
+		q->ring[class] = NULL;
+		
+		while(t != NULL)
+		{
+			struct sched_target *next = t->next;
+			
+			while((l = t->first) != NULL)
+			{
+				t->first = l->next;
+				free(l);
+			}
+			free(t->name);
+			free(t);
+			t = next;
+		}
+	}
+	
+	q->queued = 0;
+	q->sock = NULL;
+}
@@ -29,17 +29,129 @@
 #define _SSL_STACK
 
 #include "global.h"
+#include "framer.h"
 #include "socket.h"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 
+static void socket_consume(struct socket_in *s, size_t bytes);
+static void socket_event(struct reactor_handler *h, int events);
+static void socket_body_event(struct socket_in *s);
+static void socket_received(struct socket_in *s, struct reactor_handler *h);
+static void socket_free(void *arg);
+
+/*
+ * Wrap a freshly connected descriptor in a socket structure, turning on
+ * the options we like and setting up SSL if asked to, for host and port
+ * so earlier sessions can be resumed. The SSL handshake is left to the
+ * caller. The descriptor is closed on failure.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+static int
+socket_setup(struct socket_in **s, int fd, const struct sockaddr *addr,
+			 socklen_t addrlen, int ssl, const char *host, const char *port)
+{
+	int optval = 1;
+	socklen_t optsize = sizeof(optval);
+	struct socket_in *sock;
+	
+	/* Get some memory for our socket structure. */
+	if((sock = calloc(1, sizeof(*sock))) == NULL)
+		goto err_sock;
+	
+	sock->fd = fd;
+	if(addrlen <= sizeof(sock->addr))
+	{
+		memcpy(&sock->addr, addr, addrlen);
+		sock->addrlen = addrlen;
+	}
+	
+	/* Get some memory for our receive ring, it grows on demand. */
+	if((sock->buffer = calloc(1, sizeof(*sock->buffer))) == NULL)
+		goto err_buffer;
+	
+	if((sock->buffer->r_data = malloc(SOCKET_RBUFSIZE)) == NULL)
+		goto err_data;
+	
+	sock->buffer->r_size = SOCKET_RBUFSIZE;
+	sock->buffer->r_max = SOCKET_RBUFMAX;
+
+	/* Set in non-blocking mode and turn on TCP Keep-Alive and disable Nagle aglorithm. */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	if(addr->sa_family != AF_UNIX)
+	{
+		setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &optval, optsize);
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, optsize);
+	}
+	
+#ifdef OPENSSL_ENABLED
+	if(ssl == 1 && ssl_start(sock, host, port) == -1)
+	{
+		fprintf(stderr, "[ERROR] socket_setup(): Unable to set up SSL.\n");
+		if(sock->ssl != NULL)
+			SSL_free(sock->ssl);
+		goto err_ssl;
+	}
+#endif /* OPENSSL_ENABLED */
+	
+	*s = sock;
+	
+	return(0);
+
+#ifdef OPENSSL_ENABLED
+err_ssl:
+	free(sock->buffer->r_data);
+#endif /* OPENSSL_ENABLED */
+err_data:
+	free(sock->buffer);
+err_buffer:
+	free(sock);
+err_sock:
+	close(fd);
+	return(-1);
+}
+
+/*
+ * Turn a "unix:/path/to/socket" address into a sockaddr_un.
+ * Return value:
+ *   Returns the length of the address in sun, 0 if addr is not a unix
+ *   socket address, or -1 if the path is too long.
+ */
+static int
+socket_unix_addr(const char *addr, struct sockaddr_un *sun)
+{
+	size_t len;
+	
+	if(strncmp(addr, SOCKET_UNIXPREFIX, sizeof(SOCKET_UNIXPREFIX)-1) != 0)
+		return(0);
+	
+	addr += sizeof(SOCKET_UNIXPREFIX)-1;
+	if((len = strlen(addr)) == 0 || len >= sizeof(sun->sun_path))
+	{
+		fprintf(stderr, "[ERROR] Bad unix socket path: %s\n", addr);
+		return(-1);
+	}
+	
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	memcpy(sun->sun_path, addr, len);
+	
+	return(offsetof(struct sockaddr_un, sun_path)+len+1);
+}
+
 /*
  * Create a socket for use by either the FreeSWITCH client or
- * the IRC client.
+ * the IRC client. This blocks while resolving and connecting, from a
+ * reactor use socket_connect() instead. An addr of "unix:/path" connects
+ * to a local socket.
  *
  * Return value:
  *   Returns 0 on success or -1 on failure. The socket file
@@ -48,291 +160,1812 @@
 int
 socket_create(struct socket_in **s, const char *addr, const char *port, int ssl)
 {
-	int status;
+	int fd = -1, status, len;
 	struct addrinfo hints;
-	struct addrinfo *servinfo;
-	struct socket_in *sock;
+	struct addrinfo *servinfo, *ai;
+	struct sockaddr_un sun;
 	
-	/* Get some memory for our socket structure. */
-	if((*s = calloc(1, sizeof(**s))) == NULL)
+	/* Local sockets skip the lookup and the TCP stack altogether. */
+	if((len = socket_unix_addr(addr, &sun)) != 0)
+	{
+		if(len == -1 || (fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0)) == -1)
+			return(-1);
+		
+		if(connect(fd, (struct sockaddr *)&sun, len) == -1)
+		{
+			perror("[ERROR] socket_create(): connect()");
+			close(fd);
+			return(-1);
+		}
+		
+		status = socket_setup(s, fd, (struct sockaddr *)&sun, len, ssl, addr, port);
+		goto handshake;
+	}
+	
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	
+	if((status = getaddrinfo(addr, port, &hints, &servinfo)) != 0)
+	{
+		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		return(-1);
+	}
+	
+	/* Try each address in turn until one of them answers. */
+	for(ai = servinfo; ai != NULL; ai = ai->ai_next)
+	{
+		if((fd = socket(ai->ai_family, ai->ai_socktype|SOCK_CLOEXEC, ai->ai_protocol)) == -1)
+		{
+			perror("[ERROR] socket_create(): socket()");
+			continue;
+		}
+		
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+		
+		perror("[ERROR] socket_create(): connect()");
+		close(fd);
+		fd = -1;
+	}
+	
+	if(fd == -1)
+	{
+		freeaddrinfo(servinfo);
+		return(-1);
+	}
+	
+	status = socket_setup(s, fd, ai->ai_addr, ai->ai_addrlen, ssl, addr, port);
+	freeaddrinfo(servinfo);
+	
+handshake:
+#ifdef OPENSSL_ENABLED
+	/* We are allowed to block here, so just wait on the handshake. */
+	if(status == 0 && (*s)->ssl != NULL)
+	{
+		struct pollfd pfd;
+		
+		pfd.fd = (*s)->fd;
+		
+		while((status = ssl_handshake(*s)) == 1)
+		{
+			pfd.events = ((*s)->rd_want == REACTOR_WRITE ? POLLOUT : POLLIN);
+			if(poll(&pfd, 1, SOCKET_CONNTIMEOUT) < 1)
+			{
+				status = -1;
+				break;
+			}
+		}
+		
+		if(status == -1)
+		{
+			fprintf(stderr, "[ERROR] socket_create(): SSL handshake failed.\n");
+			socket_close(*s);
+			*s = NULL;
+		}
+	}
+#endif /* OPENSSL_ENABLED */
+	
+	return(status);
+}
+
+/*
+ * Ask the reactor for whatever the socket is waiting on. We always want
+ * to hear about reads, writes only while something is blocked on them.
+ * Return value:
+ *   None.
+ */
+static void
+socket_interest(struct socket_in *s)
+{
+	int events = REACTOR_READ;
+	
+	if(s->handler == NULL)
+		return;
+	
+	if((s->rd_want|s->wr_want) & REACTOR_WRITE)
+		events |= REACTOR_WRITE;
+	
+	reactor_modify(s->handler, events);
+}
+
+#ifdef OPENSSL_ENABLED
+/*
+ * The SSL handshake is over one way or another, tell whoever connected.
+ * Return value:
+ *   None.
+ */
+static void
+socket_handshake_done(struct socket_in *s, int status)
+{
+	void *arg = s->hs_arg;
+	void (*callback)(struct socket_in *, int, void *) = s->hs_callback;
+	
+	reactor_timer_cancel(&s->hs_timer);
+	s->handshaking = 0;
+	s->hs_callback = NULL;
+	
+	if(status == -1)
+	{
+		socket_close(s);
+		s = NULL;
+	}
+	else
+		socket_interest(s);
+	
+	(*callback)(s, status, arg);
+}
+
+/*
+ * Push the SSL handshake along whenever the socket is ready for it.
+ * Return value:
+ *   None.
+ */
+static void
+socket_handshake_step(struct socket_in *s)
+{
+	switch(ssl_handshake(s))
+	{
+		case 0:
+			socket_handshake_done(s, 0);
+			break;
+		case 1:
+			socket_interest(s);
+			break;
+		default:
+			fprintf(stderr, "[ERROR] socket_handshake(): SSL handshake failed.\n");
+			socket_handshake_done(s, -1);
+			break;
+	}
+}
+
+/*
+ * Give up on an SSL handshake that is taking too long.
+ * Return value:
+ *   None.
+ */
+static void
+socket_handshake_expired(void *arg)
+{
+	fprintf(stderr, "[ERROR] socket_handshake(): SSL handshake timed out.\n");
+	socket_handshake_done((struct socket_in *)arg, -1);
+}
+
+/*
+ * Run the SSL handshake on reactor r, allowing it timeout milliseconds.
+ * The callback gets the socket once it is done, or NULL and -1 if it
+ * failed, in which case the socket is already closed.
+ * Return value:
+ *   Returns 0 if the handshake is under way or -1 on failure.
+ */
+static int
+socket_handshake(struct socket_in *s, struct reactor *r, u_int timeout,
+				 void (*callback)(struct socket_in *, int, void *), void *arg)
+{
+	if((s->handler = reactor_add(r, s->fd, REACTOR_READ, socket_event, s)) == NULL)
+		return(-1);
+	
+	s->handshaking = 1;
+	s->hs_callback = callback;
+	s->hs_arg = arg;
+	reactor_timer_set(r, &s->hs_timer, timeout, socket_handshake_expired, s);
+	
+	/* Our ClientHello can go out right away. */
+	socket_handshake_step(s);
+	
+	return(0);
+}
+#endif /* OPENSSL_ENABLED */
+
+/*
+ * Free a connection attempt's state once both the connect and the lookup
+ * are over with.
+ * Return value:
+ *   None.
+ */
+static void
+socket_conn_free(struct socket_conn *c)
+{
+	reactor_timer_cancel(&c->timer);
+	resolver_release(c->dns);
+	free(c->host);
+	free(c->port);
+	free(c);
+}
+
+/*
+ * Wrap up a connection attempt, keeping the winning descriptor if there
+ * is one and closing all the others, then tell the caller how it went.
+ * Return value:
+ *   None.
+ */
+static void
+socket_conn_finish(struct socket_conn *c, struct socket_attempt *winner)
+{
+	int fd = -1;
+	struct socket_in *s = NULL;
+	struct socket_attempt *a;
+	
+	reactor_timer_cancel(&c->timer);
+	
+	while((a = c->attempts) != NULL)
+	{
+		c->attempts = a->next;
+		reactor_timer_cancel(&a->timer);
+		reactor_remove(a->handler);
+		
+		if(a == winner)
+			fd = a->fd;
+		else
+		{
+			if(a->sock != NULL)
+				socket_close(a->sock);
+			else
+				close(a->fd);
+			free(a);
+		}
+	}
+	
+	/* A fast open winner already has its socket, hello and all. */
+	if(winner != NULL && winner->sock != NULL)
+		s = winner->sock;
+	else if(fd != -1 && socket_setup(&s, fd, (struct sockaddr *)&winner->addr,
+									 winner->addrlen, c->ssl, c->host, c->port) == -1)
+		s = NULL;
+	
+	if(s == NULL)
+		fprintf(stderr, "[ERROR] socket_connect(): Unable to connect to %s.\n", c->host);
+	
+#ifdef OPENSSL_ENABLED
+	/* SSL connections aren't ready for the caller until the handshake is. */
+	if(s != NULL && s->ssl != NULL)
+	{
+		if(socket_handshake(s, c->reactor, c->timeout, c->callback, c->arg) == -1)
+		{
+			socket_close(s);
+			(*c->callback)(NULL, -1, c->arg);
+		}
+	}
+	else
+#endif /* OPENSSL_ENABLED */
+		(*c->callback)(s, (s != NULL ? 0 : -1), c->arg);
+	
+	free(winner);
+	
+	/* The resolver still owes us an answer, clean up once it arrives. */
+	if(!c->resolved)
+	{
+		c->done = 1;
+		return;
+	}
+	
+	socket_conn_free(c);
+}
+
+/*
+ * Forget about a failed connection attempt.
+ * Return value:
+ *   None.
+ */
+static void
+socket_attempt_drop(struct socket_conn *c, struct socket_attempt *a)
+{
+	struct socket_attempt **ap;
+	
+	for(ap = &c->attempts; *ap != NULL; ap = &(*ap)->next)
+	{
+		if(*ap == a)
+		{
+			*ap = a->next;
+			break;
+		}
+	}
+	
+	reactor_timer_cancel(&a->timer);
+	reactor_remove(a->handler);
+	if(a->sock != NULL)
+		socket_close(a->sock);
+	else if(a->fd != -1)
+		close(a->fd);
+	free(a);
+}
+
+static void socket_attempt_event(struct reactor_handler *h, int events);
+static void socket_attempt_expired(void *arg);
+#ifdef OPENSSL_ENABLED
+static int socket_deferred(int fd);
+static int socket_attempt_hello(struct socket_conn *c, struct socket_attempt *a);
+#endif /* OPENSSL_ENABLED */
+
+/*
+ * Start connecting to one address. TCP Fast Open is only worth asking for
+ * when we are going to speak first.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+static int
+socket_attempt_start(struct socket_conn *c, const struct sockaddr *addr,
+					 socklen_t addrlen, int fastopen)
+{
+	int fd;
+	struct socket_attempt *a;
+	
+	if(addrlen > sizeof(a->addr))
+		return(-1);
+	
+	if((fd = socket(addr->sa_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0)) == -1)
+		return(-1);
+
+#if defined(TCP_FASTOPEN_CONNECT) && defined(OPENSSL_ENABLED)
+	if(fastopen && addr->sa_family != AF_UNIX)
+	{
+		int optval = 1;
+		
+		/* Our first write rides along with the SYN, if the server knows us. */
+		if(setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &optval, sizeof(optval)) == -1)
+			fastopen = 0;
+	}
+	else
+		fastopen = 0;
+#else
+	fastopen = 0;
+#endif /* TCP_FASTOPEN_CONNECT && OPENSSL_ENABLED */
+	
+	if(connect(fd, addr, addrlen) == -1 && errno != EINPROGRESS)
+	{
+		close(fd);
+		return(-1);
+	}
+	
+	if((a = calloc(1, sizeof(*a))) == NULL)
+	{
+		close(fd);
+		return(-1);
+	}
+	
+	a->fd = fd;
+	a->fastopen = fastopen;
+	a->conn = c;
+	memcpy(&a->addr, addr, addrlen);
+	a->addrlen = addrlen;
+	
+	/* Writable means the connect finished, one way or the other. */
+	if((a->handler = reactor_add(c->reactor, fd, REACTOR_WRITE,
+								 socket_attempt_event, a)) == NULL)
+	{
+		close(fd);
+		free(a);
 		return(-1);
+	}
+	
+	/* A blackholed address must not hold us up forever. */
+	reactor_timer_set(c->reactor, &a->timer, c->timeout, socket_attempt_expired, a);
+	
+	a->next = c->attempts;
+	c->attempts = a;
+	
+	return(0);
+}
+
+/*
+ * Start a connection attempt to the next address on the list. Until one
+ * succeeds a new attempt is started every SOCKET_ATTEMPTDELAY
+ * milliseconds, or as soon as one fails, without giving up on the ones
+ * still going (RFC 8305). The last address that worked goes first, even
+ * before the resolver has answered.
+ * Return value:
+ *   None.
+ */
+static void
+socket_attempt_next(void *arg)
+{
+	struct socket_conn *c = (struct socket_conn *)arg;
+	
+	while(1)
+	{
+		if(c->lastlen > 0 && !c->last_tried)
+		{
+			c->last_tried = 1;
+			if(socket_attempt_start(c, (struct sockaddr *)&c->last, c->lastlen, c->ssl) == -1)
+				continue;
+		}
+		else if(c->a_next < c->a_count)
+		{
+			const struct addrinfo *ai = c->addrs[c->a_next++];
+			
+			/* Already tried it above. */
+			if(ai->ai_addrlen == c->lastlen && memcmp(ai->ai_addr, &c->last, c->lastlen) == 0)
+				continue;
+			
+			if(socket_attempt_start(c, ai->ai_addr, ai->ai_addrlen, 0) == -1)
+				continue;
+		}
+		else
+			break;
+		
+		if(c->a_next < c->a_count || !c->resolved)
+			reactor_timer_set(c->reactor, &c->timer, SOCKET_ATTEMPTDELAY,
+							  socket_attempt_next, c);
+		return;
+	}
+	
+	/* Out of addresses with nothing left in flight, we failed. */
+	if(c->attempts == NULL && c->resolved)
+		socket_conn_finish(c, NULL);
+}
+
+/*
+ * Called by the reactor when a connection attempt has finished.
+ * Return value:
+ *   None.
+ */
+static void
+socket_attempt_event(struct reactor_handler *h, int events)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+	struct socket_attempt *a = (struct socket_attempt *)h->arg;
+	struct socket_conn *c = a->conn;
+	
+	if(getsockopt(a->fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1)
+		err = errno;
+	
+	if(err == 0 && (events & REACTOR_WRITE))
+	{
+#ifdef OPENSSL_ENABLED
+		/*
+		 * With a fast open cookie the kernel holds the SYN back for our
+		 * first write and calls us writable straight away. Send the
+		 * ClientHello now so it goes with the SYN, but keep racing until
+		 * the connection really comes up.
+		 */
+		if(a->fastopen && a->sock == NULL && socket_deferred(a->fd))
+		{
+			if(socket_attempt_hello(c, a) == 0)
+				return;
+		}
+		else
+#endif /* OPENSSL_ENABLED */
+		{
+			socket_conn_finish(c, a);
+			return;
+		}
+	}
+	
+	/* This one is a dud, don't wait around to try the next address. */
+	socket_attempt_drop(c, a);
+	reactor_timer_cancel(&c->timer);
+	socket_attempt_next(c);
+}
+
+#ifdef OPENSSL_ENABLED
+/*
+ * Check if a fast open connect is still waiting for our first write,
+ * with no SYN sent yet.
+ * Return value:
+ *   Returns 1 if it is, otherwise 0.
+ */
+static int
+socket_deferred(int fd)
+{
+	struct tcp_info info;
+	socklen_t len = sizeof(info);
+	
+	if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+		return(0);
+	
+	return(info.tcpi_state == TCP_SYN_SENT);
+}
+
+/*
+ * Set up SSL on a fast open attempt and write our ClientHello, which
+ * sends the SYN with it. The attempt stays in the race and wins once the
+ * connection is up, socket_handshake() then carries on from here.
+ * Return value:
+ *   Returns 0 if the hello is on its way or -1 on failure.
+ */
+static int
+socket_attempt_hello(struct socket_conn *c, struct socket_attempt *a)
+{
+	/* socket_setup() closes the descriptor if it fails, so let go first. */
+	reactor_remove(a->handler);
+	a->handler = NULL;
+	
+	if(socket_setup(&a->sock, a->fd, (struct sockaddr *)&a->addr, a->addrlen,
+					c->ssl, c->host, c->port) == -1)
+	{
+		a->sock = NULL;
+		a->fd = -1;
+		return(-1);
+	}
+	
+	if(ssl_handshake(a->sock) == -1)
+		return(-1);
+	
+	/* Writable again means the SYN was answered. */
+	if((a->handler = reactor_add(c->reactor, a->fd, REACTOR_WRITE,
+								 socket_attempt_event, a)) == NULL)
+		return(-1);
+	
+	return(0);
+}
+#endif /* OPENSSL_ENABLED */
+
+/*
+ * Called when a connection attempt has taken too long.
+ * Return value:
+ *   None.
+ */
+static void
+socket_attempt_expired(void *arg)
+{
+	struct socket_attempt *a = (struct socket_attempt *)arg;
+	struct socket_conn *c = a->conn;
+	
+	socket_attempt_drop(c, a);
+	reactor_timer_cancel(&c->timer);
+	socket_attempt_next(c);
+}
+
+/*
+ * The resolver has answered, order the addresses for connecting.
+ * Return value:
+ *   None.
+ */
+static void
+socket_resolved(struct resolver_entry *e, void *arg)
+{
+	u_int i, n[2] = { 0, 0 };
+	const struct addrinfo *ai, *fam[2][SOCKET_ADDRMAX];
+	struct socket_conn *c = (struct socket_conn *)arg;
+	
+	c->dns = e;
+	c->resolved = 1;
+	
+	/* The last good address already got us connected. */
+	if(c->done)
+	{
+		socket_conn_free(c);
+		return;
+	}
+	
+	if(e->status != 0)
+	{
+		fprintf(stderr, "[ERROR] socket_connect(): getaddrinfo(): %s: %s\n",
+				e->host, gai_strerror(e->status));
+		
+		if(c->attempts == NULL)
+			socket_conn_finish(c, NULL);
+		return;
+	}
+	
+	/*
+	 * Alternate between address families, starting with whichever the
+	 * system prefers, so one broken family can't hold up the other.
+	 */
+	for(ai = e->ai; ai != NULL; ai = ai->ai_next)
+	{
+		i = (ai->ai_family != e->ai->ai_family);
+		if(n[i] < SOCKET_ADDRMAX)
+			fam[i][n[i]++] = ai;
+	}
+	
+	for(i = 0; c->a_count < SOCKET_ADDRMAX && (i < n[0] || i < n[1]); i++)
+	{
+		if(i < n[0])
+			c->addrs[c->a_count++] = fam[0][i];
+		if(i < n[1] && c->a_count < SOCKET_ADDRMAX)
+			c->addrs[c->a_count++] = fam[1][i];
+	}
+	
+	/* Unless an attempt is still in its head start, go right away. */
+	if(!c->timer.armed)
+		socket_attempt_next(c);
+}
+
+/*
+ * Connect to addr and port without blocking the calling reactor. The name
+ * is resolved off the reactor and the addresses raced against each
+ * other, each attempt getting timeout milliseconds. If last is given it
+ * is tried first, before the resolver answers, with TCP Fast Open for
+ * SSL. An addr of "unix:/path" connects to a local socket instead. The
+ * callback is run on r's thread with the new socket, or NULL and -1 if
+ * every address failed.
+ * Return value:
+ *   Returns 0 if the connect is under way or -1 on failure.
+ */
+int
+socket_connect(struct reactor *r, const char *addr, const char *port, int ssl,
+			   u_int timeout, const struct sockaddr *last, socklen_t lastlen,
+			   void (*callback)(struct socket_in *, int, void *), void *arg)
+{
+	int len;
+	struct socket_conn *c;
+	struct sockaddr_un sun;
+	
+	if(r == NULL || addr == NULL || port == NULL || callback == NULL)
+		return(-1);
+	
+	if((c = calloc(1, sizeof(*c))) == NULL)
+		return(-1);
+	
+	/* SSL sessions are cached by the name we were given, not the address. */
+	if((c->host = strdup(addr)) == NULL || (c->port = strdup(port)) == NULL)
+	{
+		free(c->host);
+		free(c);
+		return(-1);
+	}
+	
+	c->ssl = ssl;
+	c->timeout = (timeout > 0 ? timeout : SOCKET_CONNTIMEOUT);
+	c->reactor = r;
+	c->callback = callback;
+	c->arg = arg;
+	
+	/* Local sockets need no lookup, connect on the next loop iteration. */
+	if((len = socket_unix_addr(addr, &sun)) != 0)
+	{
+		if(len == -1)
+		{
+			socket_conn_free(c);
+			return(-1);
+		}
+		
+		memcpy(&c->last, &sun, len);
+		c->lastlen = len;
+		c->resolved = 1;
+		reactor_timer_set(r, &c->timer, 0, socket_attempt_next, c);
+		
+		return(0);
+	}
+	
+	if(last != NULL && lastlen > 0 && lastlen <= sizeof(c->last))
+	{
+		memcpy(&c->last, last, lastlen);
+		c->lastlen = lastlen;
+	}
+	
+	if(resolver_lookup(r, addr, port, socket_resolved, c) == -1)
+	{
+		free(c->host);
+		free(c->port);
+		free(c);
+		return(-1);
+	}
+	
+	if(c->lastlen > 0)
+		socket_attempt_next(c);
+	
+	return(0);
+}
+
+/*
+ * Called by the reactor for our socket. Output is written here, anything
+ * else is passed on to the socket's owner.
+ * Return value:
+ *   None.
+ */
+static void
+socket_event(struct reactor_handler *h, int events)
+{
+	struct socket_in *s = (struct socket_in *)h->arg;
+	
+#ifdef OPENSSL_ENABLED
+	if(s->handshaking)
+	{
+		socket_handshake_step(s);
+		return;
+	}
+#endif /* OPENSSL_ENABLED */
+	
+	/* The kernel received for us, the owner reads it like any other data. */
+	if(events & REACTOR_RECV)
+	{
+		socket_received(s, h);
+		events = (events & ~REACTOR_RECV)|REACTOR_READ;
+	}
+	
+	/* The kernel finished a write for us, carry on with the rest. */
+	if(events & REACTOR_SENT)
+	{
+		s->w_busy = 0;
+		
+		if(h->result < 0)
+			s->error = -h->result;
+		else
+			socket_consume(s, h->result);
+		
+		if(s->error == 0 && s->w_first != NULL)
+			events |= REACTOR_FLUSH;
+		else if(s->error != 0)
+			events |= REACTOR_ERROR;
+		
+		events &= ~REACTOR_SENT;
+	}
+	
+	/* SSL may have a read waiting to write, or a write waiting to read. */
+	if((events & REACTOR_WRITE) && (s->rd_want & REACTOR_WRITE))
+		events |= REACTOR_READ;
+	if((events & REACTOR_READ) && (s->wr_want & REACTOR_READ))
+		events |= REACTOR_FLUSH;
+	
+	/* Write out what was queued this loop iteration, or waiting for room. */
+	if(events & (REACTOR_WRITE|REACTOR_FLUSH))
+	{
+		if(socket_flush(s) == -1)
+			events |= REACTOR_ERROR;
+		
+		events &= ~(REACTOR_WRITE|REACTOR_FLUSH);
+	}
+	
+	/* A body being read gets the data before the owner does. */
+	if(s->rb_callback != NULL && (events & (REACTOR_READ|REACTOR_ERROR)))
+	{
+		socket_body_event(s);
+		return;
+	}
+	
+	if(events != 0 && s->callback != NULL)
+		(*s->callback)(s, events, s->arg);
+}
+
+/*
+ * Register a socket with a reactor. The callback is run on the reactor's
+ * thread when the socket has data or an error, output is handled for us.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+int
+socket_attach(struct socket_in *s, struct reactor *r,
+			  void (*callback)(struct socket_in *, int, void *), void *arg)
+{
+	if(s == NULL || r == NULL)
+		return(-1);
+	
+	s->callback = callback;
+	s->arg = arg;
+	
+	/* The SSL handshake already registered us. */
+	if(s->handler != NULL)
+	{
+		if(s->handler->reactor != r)
+			return(-1);
+		
+		if(s->w_first != NULL)
+			reactor_defer(s->handler);
+		
+		return(0);
+	}
+	
+	if((s->handler = reactor_add(r, s->fd, REACTOR_READ, socket_event, s)) == NULL)
+		return(-1);
+	
+	/* Let io_uring receive plain connections for us when it can. */
+#ifdef OPENSSL_ENABLED
+	if(s->ssl == NULL)
+#endif /* OPENSSL_ENABLED */
+		reactor_recv(s->handler);
+	
+	/* Anything queued before we were attached can go out now. */
+	if(s->w_first != NULL)
+		reactor_defer(s->handler);
+	
+	return(0);
+}
+
+/*
+ * Queue data in buf to be sent on the socket. Everything queued during one
+ * reactor loop iteration is written with a single writev()/SSL_write once
+ * the iteration is over.
+ * Return value:
+ *   Returns the number of bytes queued, or -1 on failure.
+ */
+size_t
+socket_send(struct socket_in *s, const char *buf)
+{
+	size_t n, len, bytes = 0;
+	struct socket_chunk *c;
+	
+	if(s == NULL || buf == NULL)
+		return(-1);
+	
+	len = strlen(buf);
+	
+	while(bytes < len)
+	{
+		/* Fill up the last chunk before starting a new one. */
+		if((c = s->w_last) == NULL || c->c_end == SOCKET_CHUNKSIZE)
+		{
+			if((c = s->w_free) != NULL)
+				s->w_free = c->c_next;
+			else if((c = malloc(sizeof(*c))) == NULL)
+				return(-1);
+			
+			c->c_start = c->c_end = 0;
+			c->c_next = NULL;
+			
+			if(s->w_last == NULL)
+				s->w_first = s->w_last = c;
+			else
+				s->w_last = s->w_last->c_next = c;
+		}
+		
+		n = SOCKET_CHUNKSIZE-c->c_end;
+		if(n > len-bytes)
+			n = len-bytes;
+		
+		memcpy(c->c_data+c->c_end, buf+bytes, n);
+		c->c_end += n;
+		bytes += n;
+	}
+	
+	/* Without a reactor there is nobody to flush for us later. */
+	if(s->handler != NULL)
+		reactor_defer(s->handler);
+	else
+		socket_flush(s);
+	
+	return(bytes);
+}
+
+/*
+ * Drop bytes that have been written from the front of the output queue.
+ * Return value:
+ *   None.
+ */
+static void
+socket_consume(struct socket_in *s, size_t bytes)
+{
+	size_t n;
+	struct socket_chunk *c;
+	
+	while((c = s->w_first) != NULL && bytes > 0)
+	{
+		n = c->c_end-c->c_start;
+		if(n > bytes)
+			n = bytes;
+		
+		c->c_start += n;
+		bytes -= n;
+		
+		/* Recycle chunks that are all used up. */
+		if(c->c_start == c->c_end)
+		{
+			if((s->w_first = c->c_next) == NULL)
+				s->w_last = NULL;
+			
+			c->c_next = s->w_free;
+			s->w_free = c;
+		}
+	}
+}
+
+/*
+ * Write as much of the output queue as the socket will take. If it fills
+ * up we ask the reactor to tell us when there is room again.
+ * Return value:
+ *   Returns 0 when the queue is empty, 1 if data is still waiting, or -1
+ *   on failure.
+ */
+int
+socket_flush(struct socket_in *s)
+{
+	ssize_t bytes;
+	
+	if(s == NULL)
+		return(-1);
+	
+	if(s->error != 0)
+	{
+		errno = s->error;
+		return(-1);
+	}
+	
+	/* The kernel is still busy with our last write. */
+	if(s->w_busy)
+		return(1);
+	
+	while(s->w_first != NULL)
+	{
+#ifdef OPENSSL_ENABLED
+		/* With kTLS the kernel encrypts, so SSL goes the plain way too. */
+		if(s->ssl != NULL && !s->ktls)
+			bytes = ssl_write(s, s->w_first->c_data+s->w_first->c_start,
+							  s->w_first->c_end-s->w_first->c_start);
+		
+		else
+#endif /* OPENSSL_ENABLED */
+		
+		{
+			int n = 0;
+			struct socket_chunk *c = s->w_first;
+			
+			/* Gather the whole queue into one system call. */
+			for(; c != NULL && n < SOCKET_IOVMAX; c = c->c_next, n++)
+			{
+				s->w_iov[n].iov_base = c->c_data+c->c_start;
+				s->w_iov[n].iov_len = c->c_end-c->c_start;
+			}
+			
+			/* With io_uring the write goes out with the next batch. */
+			if(reactor_send(s->handler, s->w_iov, n) == 0)
+			{
+				s->w_busy = 1;
+				return(1);
+			}
+			
+			bytes = writev(s->fd, s->w_iov, n);
+		}
+		
+		if(bytes == -1)
+		{
+			if(errno == EINTR)
+				continue;
+			
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				/* SSL tells us what it waits on, otherwise it is room. */
+#ifdef OPENSSL_ENABLED
+				if(s->ssl == NULL || s->ktls)
+#endif /* OPENSSL_ENABLED */
+					s->wr_want = REACTOR_WRITE;
+				
+				socket_interest(s);
+				return(1);
+			}
+			
+			s->error = errno;
+			return(-1);
+		}
+		
+		socket_consume(s, bytes);
+	}
+	
+	/* Everything is out, stop asking about writability. */
+	s->wr_want = 0;
+	socket_interest(s);
+	
+	return(0);
+}
+
+/*
+ * Read whatever is available into buf, from either a plain or SSL socket.
+ * Return value:
+ *   Returns the number of bytes read, 0 on EOF, or -1 on failure.
+ */
+static ssize_t
+socket_read(struct socket_in *s, char *buf, size_t len)
+{
+#ifdef OPENSSL_ENABLED
+	if(s->ssl != NULL)
+		return(ssl_read(s, buf, len));
+#endif /* OPENSSL_ENABLED */
+	
+	return(recv(s->fd, buf, len, 0));
+}
+
+/*
+ * Find room at the tail of the receive ring. If the ring is full it is
+ * doubled, up to its high-water mark. Data is only ever moved when the
+ * ring grows.
+ * Return value:
+ *   Returns the number of contiguous bytes free at the tail, 0 if full.
+ */
+static size_t
+socket_ring_space(struct socket_buf *b)
+{
+	size_t off, used = b->r_tail-b->r_head;
+	
+	if(used > b->r_peak)
+		b->r_peak = used;
+	
+	/* Growing moves the data, so not while views point into it. */
+	if(used == b->r_size && b->r_size < b->r_max && b->r_views == 0)
+	{
+		char *data;
+		size_t first;
+		
+		if((data = malloc(b->r_size*2)) != NULL)
+		{
+			/* Unwrap our data into the start of the new ring. */
+			off = b->r_head & (b->r_size-1);
+			first = (used < b->r_size-off ? used : b->r_size-off);
+			memcpy(data, b->r_data+off, first);
+			memcpy(data+first, b->r_data, used-first);
+			
+			free(b->r_data);
+			b->r_data = data;
+			b->r_size *= 2;
+			b->r_scan -= b->r_head;
+			b->r_peek -= b->r_head;
+			b->r_head = 0;
+			b->r_tail = used;
+		}
+	}
+	
+	off = b->r_tail & (b->r_size-1);
+	
+	/* Free space may wrap, only hand back the contiguous part. */
+	if(b->r_size-used < b->r_size-off)
+		return(b->r_size-used);
+	
+	return(b->r_size-off);
+}
+
+/*
+ * Give memory from a burst back once the ring has been quiet for a while.
+ * Each time the ring is found empty after reads that used less than a
+ * quarter of it counts as quiet, after enough of those it is halved.
+ * Return value:
+ *   None.
+ */
+static void
+socket_ring_shrink(struct socket_buf *b)
+{
+	char *data;
+	
+	/* Only an empty ring nobody is looking at can be swapped out. */
+	if(b->r_size <= SOCKET_RBUFSIZE || b->r_head != b->r_tail || b->r_views > 0)
+		return;
+	
+	if(b->r_peak*4 > b->r_size)
+		b->r_quiet = 0;
+	else if(++b->r_quiet >= SOCKET_RBUFIDLE && (data = malloc(b->r_size/2)) != NULL)
+	{
+		free(b->r_data);
+		b->r_data = data;
+		b->r_size /= 2;
+		b->r_head = b->r_peek = b->r_scan = b->r_tail = 0;
+		b->r_quiet = 0;
+		
+		/* The scratch line only ever held lines that wrapped. */
+		free(b->r_line);
+		b->r_line = NULL;
+		b->r_linesize = 0;
+	}
+	
+	b->r_peak = 0;
+}
+
+/*
+ * Search the receive ring for delim, starting where the last search gave
+ * up so no byte is looked at twice.
+ * Return value:
+ *   Returns the ring position of delim, or SOCKET_NPOS if not found.
+ */
+static size_t
+socket_ring_find(struct socket_buf *b, const char *delim, size_t delim_len)
+{
+	size_t i, hit, off, run, mask = b->r_size-1, pos = b->r_scan;
+	
+	if(pos < b->r_peek)
+		pos = b->r_peek;
+	
+	while(pos+delim_len <= b->r_tail)
+	{
+		/* Look at one contiguous run of the ring at a time. */
+		off = pos & mask;
+		run = b->r_tail-pos;
+		if(run > b->r_size-off)
+			run = b->r_size-off;
+		
+		if((hit = framer_scan(b->r_data+off, run, delim, delim_len)) == FRAMER_NPOS)
+		{
+			pos += run;
+			continue;
+		}
+		pos += hit;
+		
+		/* The rest of the delimiter may be on the other side of the wrap. */
+		for(i = 1;
+			i < delim_len && pos+i < b->r_tail && b->r_data[(pos+i) & mask] == delim[i];
+			i++);
+		
+		if(i == delim_len)
+			return(pos);
+		
+		/* Only part of the delimiter has arrived so far. */
+		if(pos+i == b->r_tail)
+			break;
+		
+		pos++;
+	}
+	
+	b->r_scan = pos;
+	
+	return(SOCKET_NPOS);
+}
+
+/*
+ * Copy len bytes starting at ring position pos into dest.
+ * Return value:
+ *   None.
+ */
+static void
+socket_ring_copy(struct socket_buf *b, size_t pos, char *dest, size_t len)
+{
+	size_t first, off = pos & (b->r_size-1);
+	
+	first = (len < b->r_size-off ? len : b->r_size-off);
+	memcpy(dest, b->r_data+off, first);
+	memcpy(dest+first, b->r_data, len-first);
+}
+
+/*
+ * Take over a buffer the kernel received data into. It is copied into the
+ * ring by socket_recv() and given back once it is used up.
+ * Return value:
+ *   None.
+ */
+static void
+socket_received(struct socket_in *s, struct reactor_handler *h)
+{
+	struct socket_rx *x;
+	
+	if(h->result <= 0)
+	{
+		s->error = (h->result == 0 ? ECONNRESET : -h->result);
+		return;
+	}
+	
+	if((x = s->rx_free) != NULL)
+		s->rx_free = x->x_next;
+	else if((x = malloc(sizeof(*x))) == NULL)
+	{
+		reactor_recv_done(h, h->rx_bid);
+		s->error = ENOMEM;
+		return;
+	}
+	
+	x->x_data = h->rx_data;
+	x->x_len = h->result;
+	x->x_off = 0;
+	x->x_bid = h->rx_bid;
+	x->x_next = NULL;
+	
+	if(s->rx_last == NULL)
+		s->rx_first = s->rx_last = x;
+	else
+		s->rx_last = s->rx_last->x_next = x;
+}
+
+/*
+ * The first buffer the kernel received into is used up, it may have it
+ * back.
+ * Return value:
+ *   None.
+ */
+static void
+socket_rx_done(struct socket_in *s)
+{
+	struct socket_rx *x = s->rx_first;
+	
+	if((s->rx_first = x->x_next) == NULL)
+		s->rx_last = NULL;
+	
+	reactor_recv_done(s->handler, x->x_bid);
+	x->x_next = s->rx_free;
+	s->rx_free = x;
+}
+
+/*
+ * Move data the kernel received for us into the ring.
+ * Return value:
+ *   Returns the number of bytes moved, or -1 once everything before an
+ *   error has been handed over.
+ */
+static ssize_t
+socket_recv_queued(struct socket_in *s)
+{
+	size_t n, space;
+	ssize_t bytes = 0;
+	struct socket_rx *x;
+	struct socket_buf *b = s->buffer;
+	
+	while((x = s->rx_first) != NULL)
+	{
+		if((space = socket_ring_space(b)) == 0)
+		{
+			b->r_full = 1;
+			break;
+		}
+		
+		n = x->x_len-x->x_off;
+		if(n > space)
+			n = space;
+		
+		memcpy(b->r_data+(b->r_tail & (b->r_size-1)), x->x_data+x->x_off, n);
+		b->r_tail += n;
+		x->x_off += n;
+		bytes += n;
+		
+		if(x->x_off == x->x_len)
+			socket_rx_done(s);
+	}
+	
+	if(bytes == 0 && s->error != 0)
+	{
+		errno = s->error;
+		return(-1);
+	}
+	
+	return(bytes);
+}
+
+/*
+ * Read everything available from the socket into its receive ring. If the
+ * ring fills up r_full is set, and the caller should take some lines out
+ * with socket_next_line() and call us again.
+ * Return value:
+ *   Returns the number of bytes recieved, or -1 on failure.
+ */
+ssize_t
+socket_recv(struct socket_in *s)
+{
+	size_t space;
+	ssize_t temp_bytes, bytes = 0;
+	struct socket_buf *b;
+	
+	/* Sanity checks. */
+	if(s == NULL || s->buffer == NULL)
+		return(-1);
+	
+	b = s->buffer;
+	b->r_full = 0;
 	
-	sock = *s;
+	/* Nothing is read for lines until the body being read is complete. */
+	if(s->rb_callback != NULL)
+		return(0);
 	
-	memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
+	socket_ring_shrink(b);
 	
-	if((status = getaddrinfo(addr, port, &hints, &servinfo)) != 0)
+	/* With io_uring the data is already here, it just needs moving. */
+	if(s->rx_first != NULL || (s->handler != NULL && s->handler->recving))
+		return(socket_recv_queued(s));
+	
+	/* An earlier read or write already found the connection dead. */
+	if(s->error != 0)
 	{
-		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		errno = s->error;
 		return(-1);
 	}
 	
-	if((sock->fd = socket(servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol)) == -1)
+	while(1)
 	{
-		perror("[ERROR] socket_create(): socket()");
-		return(-1);
+		if((space = socket_ring_space(b)) == 0)
+		{
+			b->r_full = 1;
+			break;
+		}
+		
+		temp_bytes = socket_read(s, b->r_data+(b->r_tail & (b->r_size-1)), space);
+		if(temp_bytes == -1)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			
+			s->error = errno;
+		}
+		
+		/* The other end hung up on us. */
+		else if(temp_bytes == 0)
+			s->error = ECONNRESET;
+		
+		/* Hand over what we did get, the error is reported next time. */
+		if(s->error != 0)
+		{
+			if(bytes > 0)
+				break;
+			
+			errno = s->error;
+			return(-1);
+		}
+		
+		b->r_tail += temp_bytes;
+		bytes += temp_bytes;
 	}
 	
-	if(connect(sock->fd, servinfo->ai_addr, servinfo->ai_addrlen) == -1)
+	/* An SSL read may be stuck until the socket can be written to. */
+	socket_interest(s);
+	
+	return(bytes);
+}
+
+/*
+ * Read as much of the body as we can without blocking. Bytes that already
+ * made it into the ring after the last line come first, then anything the
+ * kernel received for us, then the socket itself.
+ * Return value:
+ *   Returns 0 once the body is complete, 1 if it must wait for more data,
+ *   or -1 on failure.
+ */
+static int
+socket_body_fill(struct socket_in *s)
+{
+	size_t n;
+	ssize_t bytes;
+	struct socket_rx *x;
+	
+	s->rb_got += socket_take(s, s->rb_buf+s->rb_got, s->rb_len-s->rb_got);
+	
+	while(s->rb_got < s->rb_len && (x = s->rx_first) != NULL)
 	{
-		perror("[ERROR] socket_create(): connect()");
-		return(-1);
+		n = x->x_len-x->x_off;
+		if(n > s->rb_len-s->rb_got)
+			n = s->rb_len-s->rb_got;
+		
+		memcpy(s->rb_buf+s->rb_got, x->x_data+x->x_off, n);
+		x->x_off += n;
+		s->rb_got += n;
+		
+		if(x->x_off == x->x_len)
+			socket_rx_done(s);
 	}
 	
-#ifdef OPENSSL_ENABLED
-	if(ssl == 1)
+	/* With io_uring receiving for us the rest comes as completions. */
+	while(s->rb_got < s->rb_len && s->error == 0 &&
+		  (s->handler == NULL || !s->handler->recving))
 	{
-		if(ssl_start(sock) < 1)
+		if((bytes = socket_read(s, s->rb_buf+s->rb_got, s->rb_len-s->rb_got)) == -1)
 		{
-			/* XXX We have an issue with SSL connectivity. */
+			if(errno == EINTR)
+				continue;
+			if(errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			
+			s->error = errno;
 		}
+		else if(bytes == 0)
+			s->error = ECONNRESET;
+		else
+			s->rb_got += bytes;
 	}
-#endif /* OPENSSL_ENABLED */
 	
+	if(s->rb_got == s->rb_len)
+		return(0);
+	
+	if(s->error != 0)
 	{
-		int optval = 1;
-		socklen_t optsize = sizeof(optval);
-		/* Set in non-blocking mode and turn on TCP Keep-Alive and disable Nagle aglorithm. */
-		fcntl(sock->fd, F_SETFL, O_NONBLOCK);
-		setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, &optval, optsize);
-		setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &optval, optsize);
+		errno = s->error;
+		return(-1);
 	}
 	
-	/* Get some memory for our work buffer. */
-	if((sock->buffer = calloc(1, sizeof(*sock->buffer))) == NULL)
-		return(-1);
+	/* An SSL read may be stuck until the socket can be written to. */
+	socket_interest(s);
 	
-	if((sock->buffer->w_next = calloc(SOCKET_WBUFSIZE, sizeof(*sock->buffer->w_next))) == NULL)
-		return(-1);
+	return(1);
+}
+
+/*
+ * The socket has data or an error for the body being read. The callback
+ * is run once the body is complete or the read failed.
+ * Return value:
+ *   None.
+ */
+static void
+socket_body_event(struct socket_in *s)
+{
+	int status;
+	void *arg = s->rb_arg;
+	void (*callback)(struct socket_in *, int, void *) = s->rb_callback;
 	
-	sock->buffer->w_start = sock->buffer->w_next;
-	sock->servinfo = servinfo;
+	if((status = socket_body_fill(s)) == 1)
+		return;
 	
-	return(0);
+	s->rb_buf = NULL;
+	s->rb_callback = NULL;
+	s->rb_arg = NULL;
+	
+	(*callback)(s, status, arg);
 }
 
 /*
- * Send data in buf to the socket in socket_fd.
+ * Read exactly len bytes into buf, for bodies whose length is known up
+ * front. Bytes already received after the last line handed out are used
+ * first. If the rest isn't here yet the reactor waits for it, no lines
+ * are handed out in the meantime, and the callback is run on the
+ * socket's reactor with 0 once buf is full or -1 on failure. Data after
+ * the body may already be waiting when it runs, so it should go on
+ * reading lines. The socket must be attached to a reactor.
  * Return value:
- *   Returns the number of bytes sent, or -1 on failure.
+ *   Returns 0 if the whole body was already here, 1 if the callback will
+ *   be run, or -1 on failure.
  */
-size_t
-socket_send(struct socket_in *s, const char *buf)
+int
+socket_read_bytes(struct socket_in *s, char *buf, size_t len,
+				  void (*callback)(struct socket_in *, int, void *), void *arg)
 {
-	size_t bytes = 0;
+	int status;
 	
-#ifdef OPENSSL_ENABLED
-	if(s->ssl != NULL)
-		bytes = ssl_send(s, buf);
+	if(s == NULL || s->handler == NULL || s->rb_callback != NULL ||
+	   buf == NULL || callback == NULL)
+		return(-1);
 	
-	else
-#endif /* OPENSSL_ENABLED */
+	s->rb_buf = buf;
+	s->rb_len = len;
+	s->rb_got = 0;
 	
+	if((status = socket_body_fill(s)) != 1)
 	{
-		int temp_bytes;
-		size_t len = strlen(buf);
-		do
-		{
-			if((temp_bytes = send(s->fd, buf+bytes, len-bytes, 0)) == -1)
-				return -1;
-			bytes += temp_bytes;
-		}
-		while(bytes < len);
+		s->rb_buf = NULL;
+		return(status);
 	}
 	
-	return(bytes);
+	s->rb_callback = callback;
+	s->rb_arg = arg;
+	
+	return(1);
 }
 
 /*
- * Recieve up to len bytes from the socket in socket_fd and
- * store the result in buf.
+ * Read exactly len bytes into buf from a socket that isn't attached to a
+ * reactor, waiting for them as long as it takes. Bytes already received
+ * after the last line handed out are used first.
  * Return value:
- *   Returns the number of bytes recieved, or -1 on failure.
+ *   Returns the number of bytes read, or -1 on failure.
  */
 ssize_t
-socket_recv(struct socket_in *s, const char *delim)
+socket_recv_bytes(struct socket_in *s, char *buf, size_t len)
 {
-	ssize_t bytes = 0;
+	int status;
+	struct pollfd pfd;
 	
-	/* Sanity checks. */
-	if(s == NULL || s->buffer == NULL)
+	if(s == NULL || buf == NULL || s->handler != NULL)
 		return(-1);
 	
-#ifdef OPENSSL_ENABLED
-	if(s->ssl != NULL)
-		bytes = ssl_recv(s, delim);
-		
-	else
-#endif /* OPENSSL_ENABLED */
+	s->rb_buf = buf;
+	s->rb_len = len;
+	s->rb_got = 0;
 	
+	pfd.fd = s->fd;
+	
+	/* Sleep until there is more rather than spinning on EAGAIN. */
+	while((status = socket_body_fill(s)) == 1)
 	{
-		struct socket_buf *b = s->buffer;
-		ssize_t temp_bytes;
-		bytes = (b->w_next-b->w_start);
-		
-		do
+		pfd.events = (s->rd_want == REACTOR_WRITE ? POLLOUT : POLLIN);
+		if(poll(&pfd, 1, -1) == -1 && errno != EINTR)
 		{
-			if((temp_bytes = recv(s->fd, b->w_next, SOCKET_WBUFSIZE-bytes, 0)) == -1)
-			{
-				if(errno != EAGAIN && errno != EINTR)
-					return(errno);
-				
-				break;
-			}
-			
-			bytes += temp_bytes;
-			b->w_next += sizeof(*b->w_next)*temp_bytes;
+			s->error = errno;
+			perror("[ERROR] socket_recv_bytes(): poll()");
 		}
-		while(strstr(b->w_start, delim) == NULL && bytes < SOCKET_WBUFSIZE);
 	}
 	
-	/* Split up the results into a linked-list. */
-	socket_chunk(s, delim);
+	s->rb_buf = NULL;
 	
-	return(bytes);
+	return(status == 0 ? (ssize_t)len : -1);
 }
 
 /*
- * Recieve up to len bytes from the socket in socket_fd and
- * store the result in buf.
+ * Get the next line ending in delim as a view straight into the receive
+ * ring. The line is NUL terminated in place of its delimiter. Only a line
+ * that wraps around the end of the ring is copied, into a scratch buffer
+ * that is reused. Views stay valid until given back, in the order they
+ * were taken, with socket_release().
  * Return value:
- *   Returns the number of bytes recieved, or -1 on failure.
+ *   Returns 0 and fills in v, or -1 if there is no whole line yet.
  */
-size_t
-socket_recv_bytes(struct socket_in *s, char *buf, size_t max_bytes)
+int
+socket_next_line(struct socket_in *s, const char *delim, struct socket_view *v)
 {
-	size_t bytes = 0;
+	char note[64];
+	size_t len, pos, start, delim_len, mask;
+	struct socket_buf *b;
+	
+	if(s == NULL || s->buffer == NULL || delim == NULL || v == NULL)
+		return(-1);
 	
-	if(buf == NULL)
-		return 0;
+	b = s->buffer;
+	mask = b->r_size-1;
+	delim_len = strlen(delim);
 	
-#ifdef OPENSSL_ENABLED
-	if(s->ssl != NULL)
-	{
-		/*
-		 * XXX Add ssl ~ socket_recv_bytes()
-		 */
-	}
-#endif /* OPENSSL_ENABLED */
+	/* The bytes that follow belong to a body, not to lines. */
+	if(s->rb_callback != NULL)
+		return(-1);
 	
+	while((pos = socket_ring_find(b, delim, delim_len)) != SOCKET_NPOS)
 	{
-		int temp_bytes;
-		do
+		start = b->r_peek;
+		len = pos-start;
+		b->r_peek = b->r_scan = pos+delim_len;
+		
+		/* Skip empty lines and the tail end of lines we dropped. */
+		if(len == 0 || b->r_discard)
+		{
+			b->r_discard = 0;
+			if(b->r_views == 0)
+				b->r_head = b->r_peek;
+			continue;
+		}
+		
+		/* Hand out the line in place if it and its NUL are contiguous. */
+		if((start & mask)+len < b->r_size)
+		{
+			v->v_data = b->r_data+(start & mask);
+		}
+		else
 		{
-			if((temp_bytes = recv(s->fd, buf+bytes, max_bytes-bytes, MSG_WAITALL)) == -1)
+			if(b->r_linesize < len+1)
 			{
-				if(errno == EAGAIN)
-					continue;
+				char *temp;
 				
-				perror("socket_recv_bytes()");
-				return -1;
+				if((temp = realloc(b->r_line, len+1)) == NULL)
+					return(-1);
+				
+				b->r_line = temp;
+				b->r_linesize = len+1;
 			}
-			bytes += temp_bytes;
+			
+			socket_ring_copy(b, start, b->r_line, len);
+			v->v_data = b->r_line;
 		}
-		while(bytes < max_bytes);
+		
+		v->v_data[len] = '\0';
+		v->v_len = len;
+		v->v_end = b->r_peek;
+		b->r_views++;
+		
+		return(0);
 	}
 	
-	return(bytes);
+	/*
+	 * Full without a single whole line, so we can't just stop reading or
+	 * the connection wedges. Anything from where the search stopped may
+	 * be the start of the delimiter, and is kept to find the line's end.
+	 */
+	if(b->r_views == 0 && b->r_tail-b->r_head == b->r_size)
+	{
+		/* More of a line we already dealt with. */
+		if(b->r_discard)
+		{
+			b->r_head = b->r_peek = b->r_scan;
+			return(-1);
+		}
+		
+		switch(b->r_policy)
+		{
+			case SOCKET_LINE_CLOSE:
+				b->r_dropped++;
+				vout(3, VOUT_FLOW_INBOUND, "SOCKET", "Line too long for buffer, closing connection.");
+				s->error = EMSGSIZE;
+				break;
+			
+			case SOCKET_LINE_TRUNCATE:
+				b->r_truncated++;
+				snprintf(note, sizeof(note), "Line too long for buffer, truncating it (%lu so far).",
+						 b->r_truncated);
+				vout(3, VOUT_FLOW_INBOUND, "SOCKET", note);
+				
+				len = b->r_scan-b->r_peek;
+				if(b->r_linesize < len+1)
+				{
+					char *temp;
+					
+					if((temp = realloc(b->r_line, len+1)) == NULL)
+						return(-1);
+					
+					b->r_line = temp;
+					b->r_linesize = len+1;
+				}
+				
+				socket_ring_copy(b, b->r_peek, b->r_line, len);
+				b->r_peek = b->r_scan;
+				b->r_discard = 1;
+				
+				v->v_data = b->r_line;
+				v->v_data[len] = '\0';
+				v->v_len = len;
+				v->v_end = b->r_peek;
+				b->r_views++;
+				
+				return(0);
+			
+			default:
+				b->r_dropped++;
+				snprintf(note, sizeof(note), "Line too long for buffer, dropping it (%lu so far).",
+						 b->r_dropped);
+				vout(3, VOUT_FLOW_INBOUND, "SOCKET", note);
+				b->r_head = b->r_peek = b->r_scan;
+				b->r_discard = 1;
+				break;
+		}
+	}
+	
+	return(-1);
+}
+
+/*
+ * Give back a view from socket_next_line(), its bytes may be reused.
+ * Return value:
+ *   None.
+ */
+void
+socket_release(struct socket_in *s, const struct socket_view *v)
+{
+	struct socket_buf *b;
+	
+	if(s == NULL || s->buffer == NULL || v == NULL)
+		return;
+	
+	b = s->buffer;
+	
+	if(b->r_views > 0)
+		b->r_views--;
+	
+	/* With no views left also drop any lines skipped in between. */
+	b->r_head = (b->r_views == 0 ? b->r_peek : v->v_end);
 }
 
 /*
- * Parse work buffer into a linked-list of data, using delim.
+ * Take up to len bytes that follow the last line handed out, for bodies
+ * that aren't delimited.
  * Return value:
- *   Returns 0 if delim is NULL or not found, otherwise the number
- *    of bytes moved from the work buffer.
+ *   Returns the number of bytes copied into buf.
  */
 size_t
-socket_chunk(struct socket_in *s, const char *delim)
+socket_take(struct socket_in *s, char *buf, size_t len)
 {
-	size_t len, delim_len, bytes_handled = 0;
-	char *raw_data, *delim_search;
+	size_t avail;
 	struct socket_buf *b;
-	struct socket_line *buf_line;
 	
-	if(s == NULL || s->buffer == NULL || delim == NULL)
+	if(s == NULL || s->buffer == NULL || buf == NULL)
 		return(0);
 	
 	b = s->buffer;
-	delim_len = strlen(delim);
-	raw_data = b->w_start;
 	
-	while(1)
+	if((avail = b->r_tail-b->r_peek) < len)
+		len = avail;
+	
+	socket_ring_copy(b, b->r_peek, buf, len);
+	b->r_peek += len;
+	
+	if(b->r_scan < b->r_peek)
+		b->r_scan = b->r_peek;
+	if(b->r_views == 0)
+		b->r_head = b->r_peek;
+	
+	return(len);
+}
+
+/*
+ * Copy out everything received on the socket that hasn't been read yet,
+ * so it can be handed to another process along with the descriptor.
+ * Return value:
+ *   Returns the number of bytes in *data, which the caller frees, or -1
+ *   on failure.
+ */
+ssize_t
+socket_unread(struct socket_in *s, char **data)
+{
+	size_t len;
+	struct socket_rx *x;
+	struct socket_buf *b = s->buffer;
+	
+	len = b->r_tail-b->r_peek;
+	for(x = s->rx_first; x != NULL; x = x->x_next)
+		len += x->x_len-x->x_off;
+	
+	if((*data = malloc(len+1)) == NULL)
+		return(-1);
+	
+	socket_ring_copy(b, b->r_peek, *data, b->r_tail-b->r_peek);
+	len = b->r_tail-b->r_peek;
+	
+	for(x = s->rx_first; x != NULL; x = x->x_next)
 	{
-		if((delim_search = strstr(raw_data, delim)) == NULL)
-			break;
-		
-		if((len = (delim_search-raw_data)) < 1)
-			break;
-		
-		/* Allocate memory for out chunk struct. */
-		if((buf_line = calloc(1, sizeof(*buf_line))) == NULL)
-			break;
-		if((buf_line->l_data = calloc(len+1, sizeof(*buf_line->l_data))) == NULL)
-			break;
-		
-		/* Copy our data into the new chunk. */
-		strncpy(buf_line->l_data, raw_data, len);
-		
-		raw_data += len+delim_len;
-		bytes_handled += len+delim_len;
-		
-		/* Find the end of the list and add our chunk. */
-		if(b->l_first == NULL)
-			b->l_first = b->l_last = buf_line;
-		else
-			b->l_last = b->l_last->l_next = buf_line;
+		memcpy(*data+len, x->x_data+x->x_off, x->x_len-x->x_off);
+		len += x->x_len-x->x_off;
 	}
 	
-	/* Remove processed data off of our work buffer and reset the pointers. */
-	if(bytes_handled > 0)
+	return(len);
+}
+
+/*
+ * Copy out everything queued on the socket that hasn't been sent yet.
+ * Return value:
+ *   Returns the number of bytes in *data, NUL terminated, which the caller
+ *   frees, or -1 on failure.
+ */
+ssize_t
+socket_unsent(struct socket_in *s, char **data)
+{
+	size_t len = 0;
+	struct socket_chunk *c;
+	
+	for(c = s->w_first; c != NULL; c = c->c_next)
+		len += c->c_end-c->c_start;
+	
+	if((*data = malloc(len+1)) == NULL)
+		return(-1);
+	
+	len = 0;
+	for(c = s->w_first; c != NULL; c = c->c_next)
 	{
-		len = b->w_next-raw_data;
-		b->w_next -= raw_data-b->w_start;
-		
-		memmove(raw_data, b->w_start, len);
-		memset(b->w_next, 0, SOCKET_WBUFSIZE-len);
+		memcpy(*data+len, c->c_data+c->c_start, c->c_end-c->c_start);
+		len += c->c_end-c->c_start;
 	}
+	(*data)[len] = '\0';
 	
-	return(bytes_handled);
+	return(len);
 }
 
 /*
- * Get the next chunk of data from the socket buffer and put it in buf.
+ * Take over a connected plain socket another process handed us, along
+ * with the bytes it had received but not yet read.
  * Return value:
- *   Returns a pointer to the next chunk, or NULL on error.
+ *   Returns 0 on success or -1 on failure, in which case fd is closed.
  */
-char *
-socket_next_chunk(struct socket_in *s)
+int
+socket_adopt(struct socket_in **s, int fd, const char *data, size_t len)
 {
-	char *data;
+	size_t n, space;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof(addr);
 	struct socket_buf *b;
-	struct socket_line *next_chunk;
 	
-	/* Sanity checks. */
-	if(s == NULL || s->buffer == NULL || s->buffer->l_first == NULL)
-		return(NULL);
+	if(getpeername(fd, (struct sockaddr *)&addr, &addrlen) == -1)
+	{
+		perror("[ERROR] socket_adopt(): getpeername()");
+		close(fd);
+		return(-1);
+	}
 	
-	b = s->buffer;
+	/* Don't let it leak into whatever we exec next. */
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
 	
-	/* Make 'em pointers dance a bit. */
-	next_chunk = b->l_first;
-	b->l_first = b->l_first->l_next;
+	if(socket_setup(s, fd, (struct sockaddr *)&addr, addrlen, 0, NULL, NULL) == -1)
+		return(-1);
 	
-	/*
-	 * If we are popping off the last frame in the stack, then
-	 * we should be able to safely set the last frame to NULL.
-	 */
-	if(next_chunk == b->l_last)
-		b->l_last = NULL;
+	b = (*s)->buffer;
+	while(len > 0 && (space = socket_ring_space(b)) > 0)
+	{
+		n = (len < space ? len : space);
+		memcpy(b->r_data+(b->r_tail & (b->r_size-1)), data, n);
+		b->r_tail += n;
+		data += n;
+		len -= n;
+	}
+	
+	return(0);
+}
+
+/*
+ * Set how large the receive ring may grow, rounded up to a power of two,
+ * and what policy applies to lines that don't fit: SOCKET_LINE_DROP,
+ * SOCKET_LINE_TRUNCATE or SOCKET_LINE_CLOSE. A max of 0 keeps the default,
+ * anything over SOCKET_RBUFLIMIT is capped there.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+int
+socket_limits(struct socket_in *s, size_t max, int policy)
+{
+	size_t size = SOCKET_RBUFSIZE;
+	
+	if(s == NULL || s->buffer == NULL)
+		return(-1);
+	
+	if(policy != SOCKET_LINE_DROP && policy != SOCKET_LINE_TRUNCATE &&
+	   policy != SOCKET_LINE_CLOSE)
+		return(-1);
 	
-	/* Free our structure but keep our char* buffer for parsing. */
-	data = next_chunk->l_data;
-	free(next_chunk);
+	if(max == 0)
+		max = SOCKET_RBUFMAX;
+	else if(max > SOCKET_RBUFLIMIT)
+		max = SOCKET_RBUFLIMIT;
 	
-	return(data);
+	/* Stays a power of two, the ceiling is one so this can't overflow. */
+	while(size < max)
+		size *= 2;
+	
+	/* A ring already bigger than this shrinks back once it is idle. */
+	s->buffer->r_max = size;
+	s->buffer->r_policy = policy;
+	
+	return(0);
 }
 
 /*
@@ -343,50 +1976,102 @@ socket_next_chunk(struct socket_in *s)
 int
 socket_close(struct socket_in *s)
 {
+	int status = 0;
+	
+	/* Give whatever is still queued, like a QUIT, one last chance. */
+	if(s->w_first != NULL)
+		socket_flush(s);
+	
+	/* Hand back receive buffers still lent to us. */
+	while(s->rx_first != NULL)
+	{
+		struct socket_rx *x = s->rx_first;
+		
+		s->rx_first = x->x_next;
+		reactor_recv_done(s->handler, x->x_bid);
+		free(x);
+	}
+	
+	while(s->rx_free != NULL)
+	{
+		struct socket_rx *x = s->rx_free;
+		
+		s->rx_free = x->x_next;
+		free(x);
+	}
+	
 #ifdef OPENSSL_ENABLED
+	reactor_timer_cancel(&s->hs_timer);
+	
 	if(s->ssl != NULL)
 		SSL_shutdown(s->ssl);
 #endif /* OPENSSL_ENABLED */
 	
+	/*
+	 * The reactor must forget us before the descriptor goes away. With
+	 * io_uring a write may still be reading our chunks, so the reactor
+	 * frees us once the kernel is done.
+	 */
+	if(s->handler != NULL)
+		reactor_remove_free(s->handler, socket_free);
+	
 	if(close(s->fd) == -1)
 	{
 		perror("[ERROR] socket_close(): close()");
-		return(-1);
+		status = -1;
 	}
 	
+	if(s->handler == NULL)
+		socket_free(s);
+	
+	return(status);
+}
+
+/*
+ * Free a socket closed by socket_close() along with its buffers.
+ * Return value:
+ *   None.
+ */
+static void
+socket_free(void *arg)
+{
+	struct socket_in *s = arg;
 	
 	/* Loop through any existing buffer chunks and free them. */
 	if(s->buffer != NULL)
 	{
 		struct socket_buf *b = s->buffer;
 		
-		if(b->w_start != NULL)
-			free(b->w_start);
+		if(b->r_data != NULL)
+			free(b->r_data);
 		
-		if(b->l_first != NULL)
-		{
-			struct socket_line *temp, *chunk = b->l_first;
-			while(chunk != NULL)
-			{
-				temp = chunk;
-				chunk = chunk->l_next;
-				
-				if(temp->l_data != NULL)
-					free(temp->l_data);
-				free(temp);
-			}
-		}
+		if(b->r_line != NULL)
+			free(b->r_line);
 		
 		/* Free our actual buffer struct. */
 		free(s->buffer);
 	}
 	
+	/* Free anything we never got to send, and our spare chunks. */
+	while(s->w_first != NULL)
+	{
+		struct socket_chunk *c = s->w_first;
+		
+		s->w_first = c->c_next;
+		free(c);
+	}
+	
+	while(s->w_free != NULL)
+	{
+		struct socket_chunk *c = s->w_free;
+		
+		s->w_free = c->c_next;
+		free(c);
+	}
+
 #ifdef OPENSSL_ENABLED
 	if(s->ssl != NULL)
 		SSL_free(s->ssl);
 #endif /* OPENSSL_ENABLED */
-	freeaddrinfo(s->servinfo);
 	free(s);
-	
-	return(0);
 }
@@ -31,6 +31,13 @@
 #include "global.h"
 #include "socket.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
 
 #ifdef OPENSSL_ENABLED
 
@@ -43,6 +50,214 @@ static struct
 	SSL_CTX *ctx;
 } *ssl_master;
 
+/* Client sessions worth resuming, one per host:port. */
+static pthread_mutex_t mtx_sessions = PTHREAD_MUTEX_INITIALIZER;
+static struct ssl_session
+{
+	char *s_key;
+	SSL_SESSION *s_sess;
+	struct ssl_session *s_next;
+} *ssl_sessions;
+
+static char *ssl_session_file;
+static time_t ssl_session_saved;
+static int ssl_session_dirty;
+
+/*
+ * Find the cache slot for key, making one if it is new. Slots live as
+ * long as we do, there is only ever one per server we talk to. The
+ * session lock must be held.
+ * Return value:
+ *   Returns the slot, or NULL if we ran out of memory.
+ */
+static struct ssl_session *
+ssl_session_slot(const char *key)
+{
+	struct ssl_session *e;
+	
+	for(e = ssl_sessions; e != NULL; e = e->s_next)
+	{
+		if(strcmp(e->s_key, key) == 0)
+			return(e);
+	}
+	
+	if((e = calloc(1, sizeof(*e))) == NULL)
+		return(NULL);
+	
+	if((e->s_key = strdup(key)) == NULL)
+	{
+		free(e);
+		return(NULL);
+	}
+	
+	e->s_next = ssl_sessions;
+	ssl_sessions = e;
+	
+	return(e);
+}
+
+/*
+ * Called by OpenSSL whenever the server hands us a session, after the
+ * handshake for TLS 1.2 or in a ticket any time later for TLS 1.3. The
+ * newest one replaces whatever we had for the server.
+ * Return value:
+ *   Returns 1 to tell OpenSSL we kept a reference to the session.
+ */
+static int
+ssl_session_new(SSL *ssl, SSL_SESSION *sess)
+{
+	int save = 0;
+	struct ssl_session *e = SSL_get_app_data(ssl);
+	
+	if(e == NULL)
+		return(0);
+	
+	pthread_mutex_lock(&mtx_sessions);
+	if(e->s_sess != NULL)
+		SSL_SESSION_free(e->s_sess);
+	e->s_sess = sess;
+	ssl_session_dirty = 1;
+	
+	/* A reconnect storm shouldn't rewrite the file for every bot. */
+	if(ssl_session_file != NULL && time(NULL) >= ssl_session_saved+SSL_SESSION_SAVEDELAY)
+		save = 1;
+	pthread_mutex_unlock(&mtx_sessions);
+	
+	if(save)
+		ssl_session_save();
+	
+	return(1);
+}
+
+/*
+ * Read sessions saved by an earlier run, skipping any that have expired.
+ * Each is a "host:port" line followed by the PEM encoded session.
+ * Return value:
+ *   Returns the number of sessions loaded, or -1 on failure.
+ */
+static int
+ssl_session_load(const char *file)
+{
+	int count = 0;
+	char key[SSL_SESSION_KEYMAX];
+	FILE *fp;
+	SSL_SESSION *sess;
+	struct ssl_session *e;
+	
+	if((fp = fopen(file, "r")) == NULL)
+		return(errno == ENOENT ? 0 : -1);
+	
+	pthread_mutex_lock(&mtx_sessions);
+	while(fgets(key, sizeof(key), fp) != NULL)
+	{
+		key[strcspn(key, "\r\n")] = '\0';
+		
+		if((sess = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL)) == NULL)
+			break;
+		
+		if(SSL_SESSION_get_time(sess)+SSL_SESSION_get_timeout(sess) <= time(NULL) ||
+		   (e = ssl_session_slot(key)) == NULL)
+		{
+			SSL_SESSION_free(sess);
+			continue;
+		}
+		
+		if(e->s_sess != NULL)
+			SSL_SESSION_free(e->s_sess);
+		e->s_sess = sess;
+		count++;
+	}
+	pthread_mutex_unlock(&mtx_sessions);
+	
+	fclose(fp);
+	
+	return(count);
+}
+
+/*
+ * Write the session cache out to the session file, if there is one and
+ * anything changed. The file is replaced in one go so a crash halfway
+ * through can't leave it truncated.
+ * Return value:
+ *   Returns 0 on success, otherwise -1.
+ */
+int
+ssl_session_save(void)
+{
+	int fd, status = 0;
+	char *temp;
+	FILE *fp;
+	struct ssl_session *e;
+	
+	if(ssl_session_file == NULL)
+		return(0);
+	
+	if((temp = malloc(strlen(ssl_session_file)+5)) == NULL)
+		return(-1);
+	sprintf(temp, "%s.tmp", ssl_session_file);
+	
+	pthread_mutex_lock(&mtx_sessions);
+	if(!ssl_session_dirty)
+		goto out;
+	
+	/*
+	 * Sessions hold their master secrets, so only we may read them. A temp
+	 * file left over from before keeps its old mode, hence the fchmod().
+	 */
+	if((fd = open(temp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600)) == -1)
+	{
+		perror("[ERROR] ssl_session_save(): open()");
+		status = -1;
+		goto out;
+	}
+	
+	if(fchmod(fd, 0600) == -1 || (fp = fdopen(fd, "w")) == NULL)
+	{
+		perror("[ERROR] ssl_session_save()");
+		close(fd);
+		unlink(temp);
+		status = -1;
+		goto out;
+	}
+	
+	for(e = ssl_sessions; e != NULL; e = e->s_next)
+	{
+		if(e->s_sess == NULL || !SSL_SESSION_is_resumable(e->s_sess))
+			continue;
+		
+		fprintf(fp, "%s\n", e->s_key);
+		PEM_write_SSL_SESSION(fp, e->s_sess);
+	}
+	
+	if(fclose(fp) != 0 || rename(temp, ssl_session_file) == -1)
+	{
+		perror("[ERROR] ssl_session_save()");
+		unlink(temp);
+		status = -1;
+		goto out;
+	}
+	
+	ssl_session_dirty = 0;
+	ssl_session_saved = time(NULL);
+
+out:
+	pthread_mutex_unlock(&mtx_sessions);
+	free(temp);
+	
+	return(status);
+}
+
+/*
+ * Save the session cache one last time on the way out.
+ * Return value:
+ *   None.
+ */
+static void
+ssl_session_exit(void)
+{
+	ssl_session_save();
+}
+
 /*
  * In case we have a major SSL failure, print the error and exit.
  * Return value:
@@ -60,13 +275,19 @@ berr_exit(char *string)
 }
 
 /*
- * Negotiate a new SSL connection.
+ * Set up a new SSL connection on the socket to host and port, offering
+ * the last session we had with them. The handshake itself is done by
+ * ssl_handshake().
  * Return value:
  *   Returns 0 on success, otherwise -1.
  */
 int
-ssl_start(struct socket_in *s)
+ssl_start(struct socket_in *s, const char *host, const char *port)
 {
+	char key[SSL_SESSION_KEYMAX];
+	struct in6_addr ip;
+	struct ssl_session *e;
+	
 	if(ssl_master == NULL || ssl_master->ctx == NULL)
 		return(-1);
 	
@@ -76,148 +297,140 @@ ssl_start(struct socket_in *s)
 	if(SSL_set_fd(s->ssl, s->fd) != 1)
 		return(-1);
 	
-	while(SSL_connect(s->ssl) == SSL_ERROR_NONE);
+	SSL_set_connect_state(s->ssl);
+	
+	if(host == NULL || port == NULL)
+		return(0);
+	
+	/* Servers may tie their tickets to the name, so send it along. */
+	if(inet_pton(AF_INET, host, &ip) != 1 && inet_pton(AF_INET6, host, &ip) != 1)
+		SSL_set_tlsext_host_name(s->ssl, host);
+	
+	snprintf(key, sizeof(key), "%s:%s", host, port);
+	
+	pthread_mutex_lock(&mtx_sessions);
+	if((e = ssl_session_slot(key)) != NULL)
+	{
+		SSL_set_app_data(s->ssl, e);
+		
+		if(e->s_sess != NULL && SSL_SESSION_is_resumable(e->s_sess))
+			SSL_set_session(s->ssl, e->s_sess);
+	}
+	pthread_mutex_unlock(&mtx_sessions);
 	
 	return(0);
 }
 
 /*
- * Send a string to an SSL connection.
+ * Take the handshake as far as it will go without blocking. When it has
+ * to wait s->rd_want says whether for REACTOR_READ or REACTOR_WRITE.
  * Return value:
- *   The number of bytes actually sent.
+ *   Returns 0 once the handshake is done, 1 if it must be called again
+ *   when the socket is ready, or -1 on failure.
  */
-size_t
-ssl_send(struct socket_in *s, const char *buf)
+int
+ssl_handshake(struct socket_in *s)
 {
-	size_t bytes = 0, len = strlen(buf);
-	int status;
+	int status = SSL_connect(s->ssl);
 	
-	do
+	switch(SSL_get_error(s->ssl, status))
 	{
-		status = SSL_write(s->ssl, buf+bytes, len-bytes);
-		switch(SSL_get_error(s->ssl, status))
-		{
-			case SSL_ERROR_NONE:
-				bytes += status;
-				break;
-			case SSL_ERROR_WANT_READ:
-			case SSL_ERROR_WANT_WRITE:
-			case SSL_ERROR_WANT_CONNECT:
-				return bytes;
-			default:
-				break;//berr_exit("ssl_send(): An error occured while writing to SSL socket.");
-		}
+		case SSL_ERROR_NONE:
+			s->rd_want = 0;
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+			/* The kernel took over encrypting, we can write plain data. */
+			s->ktls = BIO_get_ktls_send(SSL_get_wbio(s->ssl));
+#endif /* SSL_OP_ENABLE_KTLS */
+			return(0);
+		case SSL_ERROR_WANT_READ:
+			s->rd_want = REACTOR_READ;
+			return(1);
+		case SSL_ERROR_WANT_WRITE:
+			s->rd_want = REACTOR_WRITE;
+			return(1);
+		default:
+			ERR_print_errors(bio_err);
+			return(-1);
 	}
-	while(bytes < len);
-	
-	return(bytes);
 }
 
 /*
- * Receive some bytes from an SSL connection.
+ * Write up to len bytes from buf to an SSL connection.
  * Return value:
- *   Returns the number of bytes received.
+ *   Returns the number of bytes written, or -1 on failure with errno
+ *   set to EAGAIN if the same data must be written again later.
  */
 ssize_t
-ssl_recv(struct socket_in *s, const char *delim)
+ssl_write(struct socket_in *s, const char *buf, size_t len)
 {
-	int temp_bytes;
-	ssize_t bytes = 0;
-	struct socket_buf *b = s->buffer;
-	
-	bytes = (b->w_next-b->w_start);
+	int status = SSL_write(s->ssl, buf, len);
 	
-	do
+	/* A renegotiation can leave a write waiting on a read, and vice versa. */
+	switch(SSL_get_error(s->ssl, status))
 	{
-		temp_bytes = SSL_read(s->ssl, b->w_next, SOCKET_WBUFSIZE-bytes);
-		switch(SSL_get_error(s->ssl, temp_bytes))
-		{
-			case SSL_ERROR_NONE:
-				bytes += temp_bytes;
-				b->w_next += temp_bytes;
-			case SSL_ERROR_WANT_READ:
-			case SSL_ERROR_WANT_WRITE:
-				break;
-			case SSL_ERROR_WANT_CONNECT:
-				goto out;
-			default:
-				berr_exit("ssl_recv(): An error occured while reading from SSL socket.");
-		}
-	}
-	while(strstr(b->w_start, delim) == NULL && bytes < SOCKET_WBUFSIZE);
-	
-out:
-	return(bytes);
-	/*
-	int temp_bytes;
-	ssize_t bytes = 0;
-	struct socket_buf *b = &s->buffer;
-	
-	
-	bytes = b->offset;
-	do
-	{
-		temp_bytes = SSL_read(s->ssl, b->buf+bytes, (SOCKET_BUFSIZE-bytes)-1);
-		switch(SSL_get_error(s->ssl, temp_bytes))
-		{
-			case SSL_ERROR_NONE:
-				bytes += temp_bytes;
-				break;
-			case SSL_ERROR_WANT_READ:
-			case SSL_ERROR_WANT_WRITE:
-			case SSL_ERROR_WANT_CONNECT:
-				goto out;
-			default:
-				berr_exit("ssl_recv(): An error occured while reading from SSL socket.");
-		}
+		case SSL_ERROR_NONE:
+			s->wr_want = 0;
+			return(status);
+		case SSL_ERROR_WANT_READ:
+			s->wr_want = REACTOR_READ;
+			errno = EAGAIN;
+			return(-1);
+		case SSL_ERROR_WANT_WRITE:
+			s->wr_want = REACTOR_WRITE;
+			errno = EAGAIN;
+			return(-1);
+		default:
+			ERR_print_errors(bio_err);
+			errno = ECONNRESET;
+			return(-1);
 	}
-	while(strstr(b->buf, delim) == NULL && bytes < SOCKET_BUFSIZE);
-out:
-	b->offset = bytes;
-	
-	return(bytes);
-	*/
 }
 
 /*
- * Receive a certain number of bytes.
+ * Read whatever is available from an SSL connection into buf.
  * Return value:
- *   The number of bytes actually received.
+ *   Returns the number of bytes read, 0 on EOF, or -1 on failure with
+ *   errno set to EAGAIN if we must wait for more data.
  */
-size_t
-ssl_recv_bytes(struct socket_in *s, char *buf, size_t max_bytes)
+ssize_t
+ssl_read(struct socket_in *s, char *buf, size_t len)
 {
-	int temp_bytes;
-	size_t bytes = 0;
+	int status = SSL_read(s->ssl, buf, len);
 	
-	do
+	switch(SSL_get_error(s->ssl, status))
 	{
-		temp_bytes = SSL_read(s->ssl, buf+bytes, (max_bytes-bytes)-1);
-		switch(SSL_get_error(s->ssl, temp_bytes))
-		{
-			case SSL_ERROR_NONE:
-				bytes += temp_bytes;
-				break;
-			case SSL_ERROR_WANT_READ:
-			case SSL_ERROR_WANT_WRITE:
-			case SSL_ERROR_WANT_CONNECT:
-				break;
-			default:
-				berr_exit("ssl_recv_bytes(): An error occured while reading from SSL socket.");
-		}
+		case SSL_ERROR_NONE:
+			s->rd_want = 0;
+			return(status);
+		case SSL_ERROR_ZERO_RETURN:
+			return(0);
+		case SSL_ERROR_WANT_READ:
+			s->rd_want = REACTOR_READ;
+			errno = EAGAIN;
+			return(-1);
+		case SSL_ERROR_WANT_WRITE:
+			s->rd_want = REACTOR_WRITE;
+			errno = EAGAIN;
+			return(-1);
+		default:
+			/*
+			 * Other bots share this thread, so report the error and let
+			 * the caller close the connection rather than exiting.
+			 */
+			ERR_print_errors(bio_err);
+			errno = ECONNRESET;
+			return(-1);
 	}
-	while(bytes < max_bytes);
-	
-	return(bytes);
 }
 
 /*
- * Initialize, setup, and cleanup SSL.
+ * Initialize, setup, and cleanup SSL. Sessions are kept in session_file
+ * across restarts if it is not NULL.
  * Return value:
  *   Returns 0 on success, otherwise -1.
  */
 int
-ssl_init(void)
+ssl_init(const char *session_file, const char *cert_file, const char *key_file)
 {
 	if(mtx_ssl == NULL)
 	{
@@ -260,6 +473,41 @@ ssl_init(void)
 	SSL_CTX_set_options(ssl_master->ctx, SSL_OP_NO_SSLv2);
 	SSL_CTX_set_mode(ssl_master->ctx, SSL_MODE_AUTO_RETRY);
 	SSL_CTX_set_mode(ssl_master->ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_mode(ssl_master->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+	
+#ifdef SSL_OP_ENABLE_KTLS
+	/* Hand the record layer to the kernel if it can take it. */
+	SSL_CTX_set_options(ssl_master->ctx, SSL_OP_ENABLE_KTLS);
+#endif /* SSL_OP_ENABLE_KTLS */
+	
+	/*
+	 * We keep client sessions ourselves, keyed by server rather than by
+	 * session ID, so every bot can resume what any other bot set up.
+	 */
+	SSL_CTX_set_session_cache_mode(ssl_master->ctx,
+								   SSL_SESS_CACHE_CLIENT|SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_master->ctx, ssl_session_new);
+	
+	/* A client certificate lets bots log in with SASL EXTERNAL. */
+	if(cert_file != NULL)
+	{
+		if(SSL_CTX_use_certificate_chain_file(ssl_master->ctx, cert_file) != 1 ||
+		   SSL_CTX_use_PrivateKey_file(ssl_master->ctx, (key_file != NULL ? key_file : cert_file),
+									   SSL_FILETYPE_PEM) != 1)
+		{
+			fprintf(stderr, "[ERROR] ssl_init(): Unable to load client certificate %s.\n",
+					cert_file);
+			ERR_print_errors(bio_err);
+		}
+	}
+	
+	if(session_file != NULL && (ssl_session_file = strdup(session_file)) != NULL)
+	{
+		if(ssl_session_load(ssl_session_file) == -1)
+			perror("[ERROR] ssl_init(): Unable to load SSL sessions");
+		
+		atexit(ssl_session_exit);
+	}
 	
 	/* Initialize our PRNG with random data from /dev/urandom. */
 	RAND_load_file("/dev/urandom", 1024);
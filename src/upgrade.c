@@ -0,0 +1,428 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "bot.h"
+#include "irc.h"
+#include "reactor.h"
+#include "socket.h"
+#include "upgrade.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+static char *upgrade_path;
+static char **upgrade_argv;
+
+static void upgrade_hex(FILE *fp, const char *key, const char *data, size_t len);
+static int upgrade_unhex(const char *hex, char **data, size_t *len);
+static int upgrade_save(struct bot_in *bot_t, FILE *fp);
+
+/*
+ * Remember how we were started, so upgrade_exec() can start the new
+ * binary the same way. The path is made absolute now since daemonize()
+ * changes our directory.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+int
+upgrade_init(char **argv)
+{
+	int argc;
+	
+	for(argc = 0; argv[argc] != NULL; argc++);
+	
+	if((upgrade_argv = calloc(argc+1, sizeof(*upgrade_argv))) == NULL)
+		return(-1);
+	
+	for(argc = 0; argv[argc] != NULL; argc++)
+		upgrade_argv[argc] = argv[argc];
+	
+	/* Without a slash execvp() finds us on the PATH again. */
+	if(strchr(argv[0], '/') == NULL)
+		upgrade_path = argv[0];
+	else if((upgrade_path = realpath(argv[0], NULL)) == NULL)
+	{
+		perror("[ERROR] upgrade_init(): realpath()");
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/*
+ * Write a buffer to the state file as a line of hex.
+ * Return value:
+ *   None.
+ */
+static void
+upgrade_hex(FILE *fp, const char *key, const char *data, size_t len)
+{
+	size_t i;
+	
+	fprintf(fp, "%s ", key);
+	for(i = 0; i < len; i++)
+		fprintf(fp, "%02x", (unsigned char)data[i]);
+	fputc('\n', fp);
+}
+
+/*
+ * Turn a line of hex back into bytes. The result is NUL terminated.
+ * Return value:
+ *   Returns 0 on success or -1 on failure.
+ */
+static int
+upgrade_unhex(const char *hex, char **data, size_t *len)
+{
+	size_t i;
+	u_int byte;
+	
+	*len = strlen(hex)/2;
+	if((*data = malloc(*len+1)) == NULL)
+		return(-1);
+	
+	for(i = 0; i < *len; i++)
+	{
+		if(sscanf(hex+i*2, "%2x", &byte) != 1)
+		{
+			free(*data);
+			*data = NULL;
+			return(-1);
+		}
+		(*data)[i] = byte;
+	}
+	(*data)[i] = '\0';
+	
+	return(0);
+}
+
+/*
+ * Write out what the next process needs to carry on a bot. Only plain
+ * connections that are fully registered and idle can be handed over,
+ * an SSL session can't leave OpenSSL, so those bots just reconnect.
+ * Return value:
+ *   Returns the descriptor handed over, or -1 if there is none.
+ */
+static int
+upgrade_save(struct bot_in *bot_t, FILE *fp)
+{
+	int fd = -1, index = 0;
+	char *rx = NULL, *tx = NULL;
+	ssize_t rx_len, tx_len;
+	struct chan_list *clist;
+	struct server_list *server;
+	struct socket_in *irc_t = bot_t->irc_sock;
+	
+	fprintf(fp, "bot %u\n", bot_t->bot_id);
+	
+	if(irc_t != NULL && (bot_t->bot_status & BOT_STATUS_RUNNING) &&
+#ifdef OPENSSL_ENABLED
+	   irc_t->ssl == NULL &&
+#endif /* OPENSSL_ENABLED */
+	   irc_t->handshaking == 0 && irc_t->rb_buf == NULL && irc_t->w_busy == 0 &&
+	   (rx_len = socket_unread(irc_t, &rx)) != -1 &&
+	   (tx_len = socket_unsent(irc_t, &tx)) != -1)
+	{
+		fd = irc_t->fd;
+		fprintf(fp, "fd %d\n", fd);
+		fprintf(fp, "caps %d\n", bot_t->irc_caps);
+		fprintf(fp, "authed %d\n", bot_t->irc_authed);
+		upgrade_hex(fp, "rx", rx, rx_len);
+		upgrade_hex(fp, "tx", tx, tx_len);
+	}
+	free(rx);
+	free(tx);
+	
+	for(server = bot_t->irc_servers; server != NULL && server != bot_t->irc_server;
+		server = server->next, index++);
+	if(server != NULL)
+		fprintf(fp, "server %d\n", index);
+	
+	fprintf(fp, "nick %s\n", bot_t->irc_nick);
+	if(bot_t->irc_nick_temp != NULL)
+		fprintf(fp, "nicktemp %s\n", bot_t->irc_nick_temp);
+	
+	for(clist = bot_t->irc_channels; clist != NULL; clist = clist->next)
+		fprintf(fp, "chan %s\n", clist->name);
+	
+	fprintf(fp, "end\n");
+	
+	return(fd);
+}
+
+/*
+ * Replace ourselves with a fresh copy of the binary without dropping our
+ * IRC connections. The reactors are stopped, each bot's state goes into
+ * an unlinked file, and the file and the connections' descriptors are
+ * left open across exec() for upgrade_restore() to pick up. If exec()
+ * fails we carry on as before.
+ * Return value:
+ *   None.
+ */
+void
+upgrade_exec(void)
+{
+	int fd, *fds = NULL;
+	u_int i, nfds = 0;
+	char env[16];
+	FILE *fp;
+	struct bot_in *bot_t;
+	
+	if(upgrade_argv == NULL)
+		return;
+	
+	if((fp = tmpfile()) == NULL)
+	{
+		perror("[ERROR] upgrade_exec(): tmpfile()");
+		return;
+	}
+	
+	if(reactor_pause() == -1)
+	{
+		fclose(fp);
+		return;
+	}
+	
+	fprintf(fp, "%s\n", UPGRADE_MAGIC);
+	
+	pthread_mutex_lock(&mtx_bots);
+	for(bot_t = bots->b_first; bot_t != NULL; bot_t = bot_t->next)
+	{
+		if((fd = upgrade_save(bot_t, fp)) == -1)
+			continue;
+		
+		if((nfds & (nfds-1)) == 0)
+		{
+			int *temp = realloc(fds, sizeof(*fds)*(nfds > 0 ? nfds*2 : 1));
+			
+			if(temp == NULL)
+				break;
+			fds = temp;
+		}
+		fds[nfds++] = fd;
+	}
+	pthread_mutex_unlock(&mtx_bots);
+	
+	if(bot_t != NULL || fflush(fp) != 0 || ferror(fp))
+	{
+		fprintf(stderr, "[ERROR] upgrade_exec(): Unable to save our state.\n");
+		goto err_save;
+	}
+
+#ifdef OPENSSL_ENABLED
+	/* Bots on SSL reconnect, let them resume their sessions at least. */
+	ssl_session_save();
+#endif /* OPENSSL_ENABLED */
+	
+	/* Everything else was opened close-on-exec. */
+	for(i = 0; i < nfds; i++)
+		fcntl(fds[i], F_SETFD, fcntl(fds[i], F_GETFD) & ~FD_CLOEXEC);
+	fcntl(fileno(fp), F_SETFD, fcntl(fileno(fp), F_GETFD) & ~FD_CLOEXEC);
+	
+	snprintf(env, sizeof(env), "%d", fileno(fp));
+	setenv(UPGRADE_ENV, env, 1);
+	
+	if(strchr(upgrade_path, '/') == NULL)
+		execvp(upgrade_path, upgrade_argv);
+	else
+		execv(upgrade_path, upgrade_argv);
+	
+	perror("[ERROR] upgrade_exec(): exec()");
+	unsetenv(UPGRADE_ENV);
+	
+	for(i = 0; i < nfds; i++)
+		fcntl(fds[i], F_SETFD, fcntl(fds[i], F_GETFD) | FD_CLOEXEC);
+
+err_save:
+	free(fds);
+	fclose(fp);
+	reactor_resume();
+}
+
+/*
+ * Pick up where the process before us left off, if we were started by
+ * upgrade_exec(). Bots are matched to the config by ID, bots spawned at
+ * runtime are cloned from the first bot again, and bots that had quit
+ * stay gone. Connections handed over are resumed by bot_start().
+ * Return value:
+ *   Returns 1 if state was restored, 0 if there was none, or -1 on failure.
+ */
+int
+upgrade_restore(void)
+{
+	int fd;
+	u_int id, *seen = NULL, nseen = 0;
+	char *env, *line = NULL, *value;
+	size_t i, line_size = 0;
+	ssize_t len;
+	FILE *fp;
+	struct bot_in *bot_t = NULL, *next;
+	struct bot_in *first = bots->b_first;
+	
+	if((env = getenv(UPGRADE_ENV)) == NULL)
+		return(0);
+	
+	fd = atoi(env);
+	unsetenv(UPGRADE_ENV);
+	
+	if(lseek(fd, 0, SEEK_SET) == -1 || (fp = fdopen(fd, "r")) == NULL)
+	{
+		perror("[ERROR] upgrade_restore(): Unable to read our state");
+		return(-1);
+	}
+	
+	if((len = getline(&line, &line_size, fp)) == -1 ||
+	   strncmp(line, UPGRADE_MAGIC"\n", len) != 0)
+	{
+		fprintf(stderr, "[ERROR] upgrade_restore(): Unknown state format.\n");
+		free(line);
+		fclose(fp);
+		return(-1);
+	}
+	
+	while((len = getline(&line, &line_size, fp)) != -1)
+	{
+		if(len > 0 && line[len-1] == '\n')
+			line[--len] = '\0';
+		
+		if((value = strchr(line, ' ')) != NULL)
+			*value++ = '\0';
+		else
+			value = line+len;
+		
+		if(strcmp(line, "bot") == 0)
+		{
+			id = strtoul(value, NULL, 10);
+			
+			for(bot_t = bots->b_first; bot_t != NULL && bot_t->bot_id != id; bot_t = bot_t->next);
+			
+			if(bot_t == NULL && first != NULL)
+				bot_t = bot_clone_config(first);
+			
+			if(bot_t == NULL)
+				continue;
+			
+			/* Keep track of who is still around, the others had quit. */
+			if((nseen & (nseen-1)) == 0)
+			{
+				u_int *temp = realloc(seen, sizeof(*seen)*(nseen > 0 ? nseen*2 : 1));
+				
+				if(temp == NULL)
+					break;
+				seen = temp;
+			}
+			seen[nseen++] = bot_t->bot_id;
+			
+			/* The channels we were in replace those in the config. */
+			while(bot_t->irc_channels != NULL)
+				bot_remove_channel(bot_t, bot_t->irc_channels->name);
+		}
+		else if(bot_t == NULL)
+			continue;
+		else if(strcmp(line, "end") == 0)
+			bot_t = NULL;
+		else if(strcmp(line, "fd") == 0)
+		{
+			upgrade_free(bot_t->irc_resume);
+			if((bot_t->irc_resume = calloc(1, sizeof(*bot_t->irc_resume))) != NULL)
+				bot_t->irc_resume->fd = atoi(value);
+		}
+		else if(strcmp(line, "server") == 0)
+		{
+			int index = atoi(value);
+			
+			for(bot_t->irc_server = bot_t->irc_servers;
+				bot_t->irc_server != NULL && index-- > 0;
+				bot_t->irc_server = bot_t->irc_server->next);
+		}
+		else if(strcmp(line, "nick") == 0)
+		{
+			free(bot_t->irc_nick);
+			bot_t->irc_nick = strdup(value);
+		}
+		else if(strcmp(line, "nicktemp") == 0)
+		{
+			free(bot_t->irc_nick_temp);
+			bot_t->irc_nick_temp = strdup(value);
+		}
+		else if(strcmp(line, "chan") == 0)
+			bot_add_channel(bot_t, value);
+		else if(bot_t->irc_resume == NULL)
+			continue;
+		else if(strcmp(line, "caps") == 0)
+			bot_t->irc_resume->caps = atoi(value);
+		else if(strcmp(line, "authed") == 0)
+			bot_t->irc_resume->authed = atoi(value);
+		else if(strcmp(line, "rx") == 0)
+			upgrade_unhex(value, &bot_t->irc_resume->rx, &bot_t->irc_resume->rx_len);
+		else if(strcmp(line, "tx") == 0)
+		{
+			size_t tx_len;
+			
+			upgrade_unhex(value, &bot_t->irc_resume->tx, &tx_len);
+		}
+	}
+	
+	free(line);
+	fclose(fp);
+	
+	for(bot_t = bots->b_first; bot_t != NULL; bot_t = next)
+	{
+		next = bot_t->next;
+		
+		for(i = 0; i < nseen && seen[i] != bot_t->bot_id; i++);
+		if(i == nseen)
+			bot_destory_config(bot_t);
+	}
+	free(seen);
+	
+	return(1);
+}
+
+/*
+ * Free a connection handed over by upgrade_restore(), closing its
+ * descriptor if it is still ours.
+ * Return value:
+ *   None.
+ */
+void
+upgrade_free(struct upgrade_bot *u)
+{
+	if(u == NULL)
+		return;
+	
+	if(u->fd != -1)
+		close(u->fd);
+	
+	free(u->rx);
+	free(u->tx);
+	free(u);
+}
@@ -0,0 +1,335 @@
+/*-
+ * Copyright (c) 2009 Joshua Piccari
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "global.h"
+#include "uring.h"
+
+#ifdef WITH_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+/*
+ * The kernel and us share the ring indexes, these keep the compiler and
+ * CPU from reordering our accesses to them.
+ */
+#define uring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+/*
+ * Set up an io_uring instance along with a ring of receive buffers the
+ * kernel may pick from. There is no liburing dependency, this talks to
+ * the kernel directly.
+ * Return value:
+ *   Returns 0 on success, or -1 if the kernel can't give us what we need.
+ */
+int
+uring_init(struct uring *u, u_int entries)
+{
+	u_int i;
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	
+	/* Completions can outnumber submissions with multishot requests. */
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE|IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = entries*4;
+	
+	if((u->fd = syscall(__NR_io_uring_setup, entries, &p)) == -1 && errno == EINVAL)
+	{
+		/* Older kernels don't know about cooperative task running. */
+		p.flags &= ~IORING_SETUP_COOP_TASKRUN;
+		u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	}
+	
+	if(u->fd == -1)
+		return(-1);
+	
+	/* We need timeouts on io_uring_enter() and a single ring mapping. */
+	if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		errno = ENOSYS;
+		goto err;
+	}
+	
+	u->sq_ring_size = p.sq_off.array+p.sq_entries*sizeof(u_int);
+	u->cq_ring_size = p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	if(u->cq_ring_size > u->sq_ring_size)
+		u->sq_ring_size = u->cq_ring_size;
+	
+	u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ|PROT_WRITE,
+					  MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if(u->sq_ring == MAP_FAILED)
+	{
+		u->sq_ring = NULL;
+		goto err;
+	}
+	u->cq_ring = u->sq_ring;
+	
+	u->sqes_size = p.sq_entries*sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE,
+				   MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if(u->sqes == MAP_FAILED)
+	{
+		u->sqes = NULL;
+		goto err;
+	}
+	
+	u->sq_entries = p.sq_entries;
+	u->sq_mask = *(u_int *)((char *)u->sq_ring+p.sq_off.ring_mask);
+	u->sq_head = (u_int *)((char *)u->sq_ring+p.sq_off.head);
+	u->sq_tail = (u_int *)((char *)u->sq_ring+p.sq_off.tail);
+	u->sq_array = (u_int *)((char *)u->sq_ring+p.sq_off.array);
+	u->cq_mask = *(u_int *)((char *)u->cq_ring+p.cq_off.ring_mask);
+	u->cq_head = (u_int *)((char *)u->cq_ring+p.cq_off.head);
+	u->cq_tail = (u_int *)((char *)u->cq_ring+p.cq_off.tail);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring+p.cq_off.cqes);
+	
+	/* Our receive buffers, the kernel fills whichever it likes. */
+	if(posix_memalign((void **)&u->br, getpagesize(),
+					  URING_BUFS*sizeof(struct io_uring_buf)) != 0)
+	{
+		u->br = NULL;
+		goto err;
+	}
+	
+	if((u->bufs = malloc(URING_BUFS*URING_BUFSIZE)) == NULL)
+		goto err;
+	
+	memset(u->br, 0, URING_BUFS*sizeof(struct io_uring_buf));
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)u->br;
+	reg.ring_entries = URING_BUFS;
+	reg.bgid = URING_BGID;
+	
+	if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+		goto err;
+	
+	for(i = 0; i < URING_BUFS; i++)
+		uring_buf_release(u, i);
+	
+	return(0);
+
+err:
+	uring_free(u);
+	return(-1);
+}
+
+/*
+ * Tear down an io_uring instance set up by uring_init().
+ * Return value:
+ *   None.
+ */
+void
+uring_free(struct uring *u)
+{
+	int err = errno;
+	
+	if(u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+	
+	if(u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+	
+	if(u->fd != -1)
+		close(u->fd);
+	
+	free(u->br);
+	free(u->bufs);
+	memset(u, 0, sizeof(*u));
+	u->fd = -1;
+	
+	/* Don't let the cleanup hide why we failed. */
+	errno = err;
+}
+
+/*
+ * Get a blank submission queue entry. Entries are only handed to the
+ * kernel by uring_submit() or uring_wait(), so many can be batched into
+ * one system call.
+ * Return value:
+ *   Returns an entry, or NULL if the queue is full and can't be flushed.
+ */
+struct io_uring_sqe *
+uring_sqe(struct uring *u)
+{
+	u_int tail;
+	struct io_uring_sqe *sqe;
+	
+	if(*u->sq_tail+u->sq_pending-uring_load(u->sq_head) >= u->sq_entries)
+	{
+		if(uring_submit(u) == -1)
+			return(NULL);
+		
+		if(*u->sq_tail-uring_load(u->sq_head) >= u->sq_entries)
+			return(NULL);
+	}
+	
+	tail = (*u->sq_tail+u->sq_pending++) & u->sq_mask;
+	u->sq_array[tail] = tail;
+	
+	sqe = &u->sqes[tail];
+	memset(sqe, 0, sizeof(*sqe));
+	
+	return(sqe);
+}
+
+/*
+ * Make queued entries visible to the kernel.
+ * Return value:
+ *   Returns the number of entries the kernel has yet to consume.
+ */
+static u_int
+uring_publish(struct uring *u)
+{
+	if(u->sq_pending > 0)
+	{
+		uring_store(u->sq_tail, *u->sq_tail+u->sq_pending);
+		u->sq_pending = 0;
+	}
+	
+	return(*u->sq_tail-uring_load(u->sq_head));
+}
+
+/*
+ * Hand every queued entry to the kernel without waiting for anything.
+ * Return value:
+ *   Returns 0 on success, or -1 on failure.
+ */
+int
+uring_submit(struct uring *u)
+{
+	u_int pending = uring_publish(u);
+	
+	while(pending > 0 && syscall(__NR_io_uring_enter, u->fd, pending, 0, 0, NULL, 0) == -1)
+	{
+		if(errno != EINTR)
+			return(-1);
+	}
+	
+	return(0);
+}
+
+/*
+ * Submit anything queued and wait for at least one completion, or until
+ * timeout milliseconds have gone by. A negative timeout waits forever.
+ * Return value:
+ *   Returns 0 on success, or -1 on failure.
+ */
+int
+uring_wait(struct uring *u, int timeout)
+{
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	
+	memset(&arg, 0, sizeof(arg));
+	if(timeout >= 0)
+	{
+		ts.tv_sec = timeout/1000;
+		ts.tv_nsec = (timeout%1000)*1000000;
+		arg.ts = (uintptr_t)&ts;
+	}
+	
+	if(syscall(__NR_io_uring_enter, u->fd, uring_publish(u), 1,
+			   IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) == -1)
+	{
+		/* Timing out or being interrupted is just an empty wait. */
+		if(errno == ETIME || errno == EINTR || errno == EBUSY)
+			return(0);
+		
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/*
+ * Peek at the oldest unseen completion.
+ * Return value:
+ *   Returns a completion, or NULL if there are none.
+ */
+struct io_uring_cqe *
+uring_cqe(struct uring *u)
+{
+	u_int head = *u->cq_head;
+	
+	if(head == uring_load(u->cq_tail))
+		return(NULL);
+	
+	return(&u->cqes[head & u->cq_mask]);
+}
+
+/*
+ * Let the kernel reuse the completion returned by uring_cqe().
+ * Return value:
+ *   None.
+ */
+void
+uring_cqe_seen(struct uring *u)
+{
+	uring_store(u->cq_head, *u->cq_head+1);
+}
+
+/*
+ * Find the memory behind a receive buffer id.
+ * Return value:
+ *   Returns a pointer to URING_BUFSIZE bytes.
+ */
+char *
+uring_buf(struct uring *u, u_int bid)
+{
+	return(u->bufs+(size_t)bid*URING_BUFSIZE);
+}
+
+/*
+ * Give a receive buffer back to the kernel.
+ * Return value:
+ *   None.
+ */
+void
+uring_buf_release(struct uring *u, u_int bid)
+{
+	struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (URING_BUFS-1)];
+	
+	buf->addr = (uintptr_t)uring_buf(u, bid);
+	buf->len = URING_BUFSIZE;
+	buf->bid = bid;
+	
+	u->br_tail++;
+	uring_store(&u->br->tail, u->br_tail);
+}
+
+#endif /* WITH_URING */